@@ -0,0 +1,310 @@
+#include "stdafx.h"
+
+#include "Acquisition.h"
+#include "DeviceRegistry.h"
+#include <iostream>
+#include <algorithm>
+#include <climits>
+
+using namespace std;
+using namespace cv;
+
+DeviceClock::DeviceClock() :
+	next(0) {
+	offsets.reserve(SAMPLES);
+	sorted.reserve(SAMPLES);
+}
+
+int64_t DeviceClock::toHost(const int64_t device, const int64_t trigger) {
+	if (offsets.size() < SAMPLES){
+		offsets.push_back(device - trigger);
+	}
+	else{
+		offsets[next] = device - trigger;
+	}
+	next = (next + 1) % SAMPLES;
+	sorted.assign(offsets.begin(), offsets.end());
+	nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+	return device - sorted[sorted.size() / 2];
+}
+
+AcquisitionEngine::AcquisitionEngine(const vector<Ptr<TriggeredCam> >& cams,
+	const double fps, const int framecount, const size_t ringCapacity,
+	const vector<CamOpener>& openers, const SupervisorConfig& supervision, const TriggerConfig& trigger) :
+	trigger(trigger), period(chrono::duration_cast<Clock::duration>(chrono::duration<double>(1. / fps))),
+	epochTick(0), lastTick(framecount < 0 ? INT_MAX : framecount - 1), flags(0), nFrames(0),
+	running(false), stopping(false), pending(false) {
+	assert_throw(fps > 0);
+	assert_throw(ringCapacity > 0);
+	assert_throw(openers.empty() || openers.size() == cams.size());
+	for (size_t i = 0; i < cams.size(); i++){
+		Channel *ch = new Channel(supervision, trigger, ringCapacity);
+		ch->serial = cams[i]->serial;
+		ch->cam = cams[i];
+		if (!openers.empty()){
+			ch->opener = openers[i];
+		}
+		ch->read = 0;
+		ch->failed = 0;
+		ch->skipped = 0;
+		ch->dropped = 0;
+		ch->unpooled = 0;
+		ch->overflows = 0;
+		ch->finished = false;
+		channels.push_back(ch);
+	}
+}
+
+AcquisitionEngine::~AcquisitionEngine() {
+	if (running){
+		stop();
+	}
+	for (size_t i = 0; i < channels.size(); i++){
+		delete channels[i];
+	}
+}
+
+void AcquisitionEngine::start(const Sink& sink) {
+	assert_throw(!running);
+	this->sink = sink;
+	running = true;
+	{
+		// small lead so every grab thread is waiting before the first deadline
+		lock_guard<mutex> lock(scheduleMtx);
+		epoch = Clock::now() + chrono::milliseconds(10);
+		epochTick = 0;
+	}
+	pumpThread = thread(&AcquisitionEngine::pump, this);
+	for (size_t i = 0; i < channels.size(); i++){
+		channels[i]->thread = thread(&AcquisitionEngine::grab, this, ref(*channels[i]));
+	}
+}
+
+/*
+lets every camera finish the next trigger so cameras sharing a trigger line stay
+in step, then drains the rings into the sink
+*/
+void AcquisitionEngine::stop() {
+	if (!running){
+		return;
+	}
+	stopping = true;
+	lastTick = min(int(lastTick), currentTick() + 1);
+	for (size_t i = 0; i < channels.size(); i++){
+		if (channels[i]->thread.joinable()){
+			channels[i]->thread.join();
+		}
+	}
+	running = false;
+	notifyPump();
+	pumpThread.join();
+}
+
+bool AcquisitionEngine::done() const {
+	for (size_t i = 0; i < channels.size(); i++){
+		if (!channels[i]->finished){
+			return false;
+		}
+	}
+	return true;
+}
+
+void AcquisitionEngine::setFlags(const uint64_t flags) {
+	this->flags = flags;
+}
+
+void AcquisitionEngine::setFps(const double fps) {
+	assert_throw(fps > 0);
+	const Clock::duration p = chrono::duration_cast<Clock::duration>(chrono::duration<double>(1. / fps));
+	lock_guard<mutex> lock(scheduleMtx);
+	if (running){
+		// the next tick keeps its time, the new period applies after it
+		const Clock::duration elapsed = Clock::now() - epoch;
+		const int next = (elapsed < Clock::duration::zero() ? -1 : int(elapsed / period)) + epochTick + 1;
+		epoch += (next - epochTick) * period;
+		epochTick = next;
+	}
+	period = p;
+}
+
+double AcquisitionEngine::fps() const {
+	lock_guard<mutex> lock(scheduleMtx);
+	return 1. / chrono::duration<double>(period).count();
+}
+
+uint64_t AcquisitionEngine::frames() const {
+	return nFrames;
+}
+
+vector<AcquisitionEngine::CamStats> AcquisitionEngine::stats() const {
+	vector<CamStats> r(channels.size());
+	for (size_t i = 0; i < channels.size(); i++){
+		r[i].serial = channels[i]->serial;
+		r[i].read = channels[i]->read;
+		r[i].failed = channels[i]->failed;
+		r[i].skipped = channels[i]->skipped;
+		r[i].dropped = channels[i]->dropped;
+		r[i].unpooled = channels[i]->unpooled;
+		r[i].health = channels[i]->supervisor.stats();
+		r[i].timing = channels[i]->scheduler.stats();
+	}
+	return r;
+}
+
+int AcquisitionEngine::currentTick() const {
+	lock_guard<mutex> lock(scheduleMtx);
+	const Clock::duration elapsed = Clock::now() - epoch;
+	if (elapsed < Clock::duration::zero()){
+		return epochTick - 1;
+	}
+	return epochTick + int(elapsed / period);
+}
+
+AcquisitionEngine::Clock::time_point AcquisitionEngine::tickTime(const int tick) const {
+	lock_guard<mutex> lock(scheduleMtx);
+	return epoch + (tick - epochTick) * period;
+}
+
+/*
+trigger/read loop of a single camera
+a tick is fired at most one period late, anything later is skipped so that
+frame numbers stay tied to the schedule shared by all cameras
+*/
+void AcquisitionEngine::grab(Channel& ch) {
+	if (trigger.realtime && !TriggerScheduler::setRealtimePriority()){
+		cerr << "no real-time priority for " << ch.serial << ", triggering at normal priority" << endl;
+	}
+	int tick = -1;
+	while (true){
+		if (!ch.supervisor.up() && !reconnect(ch)){
+			break;
+		}
+		const int next = max(tick + 1, currentTick());
+		if (next > lastTick){
+			break;
+		}
+		ch.skipped += next - tick - 1;
+		tick = next;
+		ch.scheduler.waitUntil(tickTime(tick));
+
+		try{
+			TriggeredFrame f;
+			f.stamps[STAMP_TRIGGER] = TriggeredFrame::now();
+			ch.cam->trigger();
+			f.frame = ch.cam->read();
+			f.stamps[STAMP_READ] = TriggeredFrame::now();
+			f.deviceStamp = ch.cam->deviceTimestamp();
+			// without a camera clock all we know is which trigger the read followed
+			f.captured = f.deviceStamp != 0 ? ch.clock.toHost(f.deviceStamp, f.stamps[STAMP_TRIGGER])
+				: f.stamps[STAMP_TRIGGER];
+			f.flags = flags;
+			f.frame_no = tick;
+			f.serial = ch.cam->serial;
+			f.bayer = ch.cam->bayerPattern();
+			const uint64_t overflows = ch.cam->framePool().overflows();
+			ch.unpooled += overflows - ch.overflows;
+			ch.overflows = overflows;
+			{
+				lock_guard<mutex> lock(ch.ringMtx);
+				if (ch.ring.full()){
+					// ring full, make room by evicting the oldest frame
+					ch.ring.drop();
+					ch.dropped++;
+				}
+				ch.ring.push(move(f));
+			}
+			ch.read++;
+			nFrames++;
+			ch.supervisor.succeeded();
+			notifyPump();
+		}
+		catch (const exception& e){
+			// SDK and assertion errors fail a read like a TriggeredCamError does,
+			// anything leaving the grab thread would terminate the capture
+			ch.failed++;
+			cerr << e.what() << endl;
+			if (ch.opener && ch.supervisor.failed()){
+				cerr << "down: " << ch.serial << endl;
+			}
+		}
+	}
+	ch.finished = true;
+}
+
+/*
+waits out the backoff and reopens a camera that went down until it is back,
+false when the engine stops first
+*/
+bool AcquisitionEngine::reconnect(Channel& ch) {
+	while (true){
+		const Clock::time_point at = ch.supervisor.nextAttempt();
+		while (Clock::now() < at){
+			if (stopping){
+				return false;
+			}
+			this_thread::sleep_for(min(Clock::duration(chrono::milliseconds(10)), at - Clock::now()));
+		}
+		if (stopping){
+			return false;
+		}
+		try{
+			// the old connection has to go before the device can be opened again
+			ch.cam.release();
+			// a camera that went down may come back at another address, the
+			// hardware cameras look it up again instead of using the cached one
+			DeviceRegistry::instance().invalidate(ch.serial);
+			ch.cam = Ptr<TriggeredCam>(ch.opener());
+			assert_throw(ch.cam->serial == ch.serial);
+			ch.clock = DeviceClock();
+			ch.overflows = 0;
+			ch.supervisor.reconnected();
+			cerr << "reconnected: " << ch.serial << endl;
+			return true;
+		}
+		catch (const exception& e){
+			cerr << e.what() << endl;
+			ch.supervisor.reconnectFailed();
+		}
+	}
+}
+
+void AcquisitionEngine::notifyPump() {
+	{
+		lock_guard<mutex> lock(pumpMtx);
+		pending = true;
+	}
+	pumpCv.notify_one();
+}
+
+void AcquisitionEngine::pump() {
+	while (true){
+		bool stopping;
+		{
+			unique_lock<mutex> lock(pumpMtx);
+			pumpCv.wait(lock, [&]{ return pending || !running; });
+			pending = false;
+			stopping = !running;
+		}
+		for (size_t i = 0; i < channels.size(); i++){
+			while (true){
+				TriggeredFrame f;
+				{
+					lock_guard<mutex> lock(channels[i]->ringMtx);
+					if (!channels[i]->ring.pop(f)){
+						break;
+					}
+				}
+				try{
+					f.stamps[STAMP_DISPATCH] = TriggeredFrame::now();
+					sink(f);
+				}
+				catch (const exception& e){
+					cerr << __FILE__ << "[" << __LINE__ << "] " << e.what() << endl;
+				}
+			}
+		}
+		if (stopping){
+			break;
+		}
+	}
+}
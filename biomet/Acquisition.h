@@ -0,0 +1,145 @@
+#include "stdafx.h"
+
+#ifndef ACQUISITION_H_
+#define ACQUISITION_H_
+
+#include "TriggeredCam.h"
+#include "TriggeredFrame.h"
+#include "Startup.h"
+#include "Supervisor.h"
+#include "Scheduler.h"
+#include "FixedQueue.h"
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+/*
+maps a camera's clock onto the host monotonic clock
+the offset is the median of device time minus trigger time over the last
+SAMPLES frames, so a stale buffer handed out under DROP_FRAMES, which is a
+whole period early, does not drag it along and maps to the trigger that
+actually exposed it
+*/
+class DeviceClock {
+public:
+	DeviceClock();
+	int64_t
+		toHost(const int64_t device, const int64_t trigger);
+private:
+	static const size_t SAMPLES = 31;
+	std::vector<int64_t> offsets; // ring of the last SAMPLES, reserved up front
+	size_t next;
+	std::vector<int64_t> sorted;
+};
+
+/*
+asynchronous acquisition engine
+every camera gets a long-lived grab thread that triggers against a shared
+schedule on the monotonic clock, reads its frame and pushes it into a bounded
+ring of its own. a pump thread hands frames to the sink as they arrive, so a
+slow camera only skips its own triggers instead of pacing the whole rig
+given an opener per camera, a camera that keeps failing is torn down and
+reopened by its own grab thread under a CamSupervisor, the other cameras keep
+their cadence. the engine then owns the cameras, references kept elsewhere
+would hold a dead camera's connection open
+*/
+class AcquisitionEngine {
+public:
+	typedef std::function<void(const TriggeredFrame&)> Sink;
+	typedef std::chrono::steady_clock Clock;
+	struct CamStats{
+		uint32_t serial;
+		uint64_t read;    // frames read and queued
+		uint64_t failed;  // read() or trigger() errors
+		uint64_t skipped; // trigger ticks missed because the camera was still busy or down
+		uint64_t dropped; // frames evicted from a full ring
+		uint64_t unpooled; // frames read into fresh buffers because the camera's pool was exhausted
+		CamSupervisor::Stats health;
+		TriggerScheduler::Stats timing; // how late triggers fired
+	};
+	/*
+	framecount < 0 runs until stop() is called
+	*/
+	AcquisitionEngine(const std::vector<cv::Ptr<TriggeredCam> >& cams,
+		const double fps, const int framecount = -1, const size_t ringCapacity = 4,
+		const std::vector<CamOpener>& openers = std::vector<CamOpener>(),
+		const SupervisorConfig& supervision = SupervisorConfig(),
+		const TriggerConfig& trigger = TriggerConfig());
+	~AcquisitionEngine();
+	void
+		start(const Sink& sink);
+	void
+		stop();
+	bool
+		done() const;
+	void
+		setFlags(const uint64_t flags);
+	/*
+	retimes the schedule from the next tick on, cameras stay in step and frame
+	numbers keep counting
+	*/
+	void
+		setFps(const double fps);
+	double
+		fps() const;
+	uint64_t
+		frames() const;
+	std::vector<CamStats>
+		stats() const;
+private:
+	struct Channel{
+		Channel(const SupervisorConfig& supervision, const TriggerConfig& trigger, const size_t ringCapacity) :
+			supervisor(supervision), scheduler(trigger), ring(ringCapacity) {
+		}
+		uint32_t serial;
+		cv::Ptr<TriggeredCam> cam; // grab thread only once started
+		CamOpener opener;          // empty leaves the camera unsupervised
+		CamSupervisor supervisor;
+		TriggerScheduler scheduler;
+		FixedQueue<TriggeredFrame> ring; // guarded by ringMtx, its slots are allocated once
+		std::mutex ringMtx;
+		std::thread thread;
+		std::atomic<uint64_t> read, failed, skipped, dropped, unpooled;
+		std::atomic<bool> finished;
+		DeviceClock clock; // grab thread only
+		uint64_t overflows; // grab thread only, the camera's pool overflows seen so far
+	};
+	AcquisitionEngine(const AcquisitionEngine&);
+	AcquisitionEngine& operator=(const AcquisitionEngine&);
+	int
+		currentTick() const;
+	Clock::time_point
+		tickTime(const int tick) const;
+	void
+		grab(Channel& ch);
+	bool
+		reconnect(Channel& ch);
+	void
+		pump();
+	void
+		notifyPump();
+
+	const TriggerConfig trigger;
+	std::vector<Channel *> channels;
+	// tick n fires at epoch + (n - epochTick) * period
+	Clock::duration period;
+	Clock::time_point epoch;
+	int epochTick;
+	mutable std::mutex scheduleMtx;
+	std::atomic<int> lastTick;
+	std::atomic<uint64_t> flags;
+	std::atomic<uint64_t> nFrames;
+	std::atomic<bool> running;
+	std::atomic<bool> stopping;
+	Sink sink;
+	std::thread pumpThread;
+	std::mutex pumpMtx;
+	std::condition_variable pumpCv;
+	bool pending;
+};
+
+#endif /* ACQUISITION_H_ */
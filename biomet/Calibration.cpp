@@ -0,0 +1,256 @@
+#include "stdafx.h"
+
+#include "Calibration.h"
+#include "Acquisition.h"
+#include "Startup.h"
+#include <boost/property_tree/json_parser.hpp>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <mutex>
+#include <map>
+
+using namespace std;
+using namespace cv;
+using boost::property_tree::ptree;
+
+CalibrationConfig::CalibrationConfig() :
+	packetSizes({ 1400, 4000, 8000, 9000 }), packetDelays({ 0, 1000, 2000, 4000, 8000, 16000, 32000 }),
+	fps(16), seconds(2), maxLoss(0) {
+}
+
+bool CalibrationTrial::stable(const double maxLoss) const {
+	if (!error.empty()){
+		return false;
+	}
+	for (size_t i = 0; i < cams.size(); i++){
+		if (cams[i].read == 0 || cams[i].loss > maxLoss){
+			return false;
+		}
+	}
+	return true;
+}
+
+double CalibrationTrial::MBps() const {
+	double total = 0;
+	for (size_t i = 0; i < cams.size(); i++){
+		total += cams[i].MBps;
+	}
+	return total;
+}
+
+static bool tuned(const CamSpec& cam){
+	return cam.type == CAM_PG || cam.type == CAM_XC || cam.type == CAM_SIM;
+}
+
+/*
+streams every camera with its settings for config.seconds
+*/
+static CalibrationTrial runTrial(const vector<CamSpec>& cams, const CalibrationConfig& config,
+	const OpenerFactory& opener){
+	CalibrationTrial trial;
+	trial.packetSize = trial.packetDelay = 0;
+	vector<CamOpener> openers;
+	for (size_t i = 0; i < cams.size(); i++){
+		openers.push_back(opener(cams[i]));
+	}
+	map<uint32_t, pair<double, double> > received; // bytes, latency ns
+	mutex mtx;
+	vector<AcquisitionEngine::CamStats> stats;
+	double s = 0;
+	try{
+		vector<Ptr<TriggeredCam> > opened = openCameras(openers);
+		AcquisitionEngine engine(opened, config.fps, max(1, int(config.fps * config.seconds)));
+		opened.clear();
+		const chrono::steady_clock::time_point started = chrono::steady_clock::now();
+		engine.start([&](const TriggeredFrame& f){
+			lock_guard<mutex> lock(mtx);
+			pair<double, double>& r = received[f.serial];
+			r.first += double(f.frame.total() * f.frame.elemSize());
+			r.second += double(f.stamps[STAMP_READ] - f.stamps[STAMP_TRIGGER]);
+		});
+		while (!engine.done()){
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+		engine.stop();
+		s = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+		stats = engine.stats();
+	}
+	catch (const exception& e){
+		trial.error = e.what();
+		return trial;
+	}
+	for (size_t i = 0; i < stats.size(); i++){
+		CalibrationTrial::Cam c;
+		c.serial = stats[i].serial;
+		c.tuned = tuned(cams[i]);
+		c.read = stats[i].read;
+		c.failed = stats[i].failed;
+		c.loss = c.read + c.failed > 0 ? double(c.failed) / (c.read + c.failed) : 1;
+		const pair<double, double>& r = received[c.serial];
+		c.MBps = r.first / s / 1e6;
+		c.latencyMs = c.read > 0 ? r.second / c.read / 1e6 : 0;
+		trial.cams.push_back(c);
+	}
+	return trial;
+}
+
+static void printTrial(ostream& log, const CalibrationTrial& trial, const double maxLoss){
+	stringstream ss;
+	if (trial.packetSize > 0){
+		ss << "packet " << setw(5) << trial.packetSize << " delay " << setw(5) << trial.packetDelay;
+	}
+	else{
+		ss << "per camera settings";
+	}
+	if (!trial.error.empty()){
+		ss << ": " << trial.error << endl;
+		log << ss.str();
+		return;
+	}
+	ss << fixed << setprecision(1) << ": " << trial.MBps() << " MB/s" << (trial.stable(maxLoss) ? "" : " unstable");
+	for (size_t i = 0; i < trial.cams.size(); i++){
+		const CalibrationTrial::Cam& c = trial.cams[i];
+		ss << ", " << c.serial << " " << setprecision(1) << c.loss * 100 << "% lost "
+			<< c.latencyMs << " ms";
+	}
+	ss << endl;
+	log << ss.str();
+}
+
+/*
+the rig with the tuned cameras set to settings, by serial
+*/
+static vector<CamSpec> withSettings(vector<CamSpec> cams, const vector<PacketSettings>& settings){
+	for (size_t i = 0; i < cams.size(); i++){
+		for (size_t j = 0; j < settings.size(); j++){
+			if (settings[j].serial == cams[i].serial){
+				cams[i].settings.packetSize = settings[j].packetSize;
+				cams[i].settings.packetDelay = settings[j].packetDelay;
+			}
+		}
+	}
+	return cams;
+}
+
+static vector<PacketSettings> uniform(const vector<CamSpec>& cams, const uint32_t size, const uint32_t delay){
+	vector<PacketSettings> settings;
+	for (size_t i = 0; i < cams.size(); i++){
+		if (tuned(cams[i])){
+			const PacketSettings p = { cams[i].serial, size, delay };
+			settings.push_back(p);
+		}
+	}
+	return settings;
+}
+
+/*
+more data, then less latency, within a percent of throughput counts as a tie
+*/
+static bool better(const double MBps, const double latencyMs, const double bestMBps, const double bestLatencyMs){
+	if (MBps > bestMBps * 1.01){
+		return true;
+	}
+	return MBps >= bestMBps * 0.99 && latencyMs < bestLatencyMs;
+}
+
+CalibrationResult calibrate(const vector<CamSpec>& cams, const CalibrationConfig& config, ostream& log,
+	const OpenerFactory& opener) {
+	assert_throw(!cams.empty() && !config.packetSizes.empty() && !config.packetDelays.empty());
+	assert_throw(config.fps > 0 && config.seconds > 0);
+	CalibrationResult result;
+	for (size_t s = 0; s < config.packetSizes.size(); s++){
+		for (size_t d = 0; d < config.packetDelays.size(); d++){
+			const uint32_t size = config.packetSizes[s], delay = config.packetDelays[d];
+			CalibrationTrial trial = runTrial(withSettings(cams, uniform(cams, size, delay)), config, opener);
+			trial.packetSize = size;
+			trial.packetDelay = delay;
+			printTrial(log, trial, config.maxLoss);
+			result.trials.push_back(trial);
+		}
+	}
+
+	// best uniform setting, the fallback
+	const CalibrationTrial *best = NULL;
+	double bestLatency = 0;
+	for (size_t t = 0; t < result.trials.size(); t++){
+		const CalibrationTrial& trial = result.trials[t];
+		if (!trial.stable(config.maxLoss)){
+			continue;
+		}
+		double latency = 0;
+		for (size_t i = 0; i < trial.cams.size(); i++){
+			latency = max(latency, trial.cams[i].latencyMs);
+		}
+		if (!best || better(trial.MBps(), latency, best->MBps(), bestLatency)){
+			best = &trial;
+			bestLatency = latency;
+		}
+	}
+	if (!best){
+		throw runtime_error("calibration: no packet setting streamed every camera without loss");
+	}
+
+	// every camera's own pick among the stable settings
+	for (size_t i = 0; i < cams.size(); i++){
+		if (!tuned(cams[i])){
+			continue;
+		}
+		const CalibrationTrial *pick = NULL;
+		for (size_t t = 0; t < result.trials.size(); t++){
+			const CalibrationTrial& trial = result.trials[t];
+			if (!trial.stable(config.maxLoss)){
+				continue;
+			}
+			const CalibrationTrial::Cam& c = trial.cams[i];
+			if (!pick || better(c.MBps, c.latencyMs, pick->cams[i].MBps, pick->cams[i].latencyMs)){
+				pick = &trial;
+			}
+		}
+		const PacketSettings p = { cams[i].serial, pick->packetSize, pick->packetDelay };
+		result.settings.push_back(p);
+	}
+	result.verified = runTrial(withSettings(cams, result.settings), config, opener);
+	printTrial(log, result.verified, config.maxLoss);
+	if (!result.verified.stable(config.maxLoss)){
+		log << "per camera settings lose frames together, taking packet " << best->packetSize
+			<< " delay " << best->packetDelay << " for every camera" << endl;
+		result.settings = uniform(cams, best->packetSize, best->packetDelay);
+		result.verified = *best;
+	}
+	return result;
+}
+
+void saveCalibration(const string& path, const vector<PacketSettings>& settings) {
+	ptree tree, list;
+	for (size_t i = 0; i < settings.size(); i++){
+		ptree cam;
+		cam.put("serial", settings[i].serial);
+		cam.put("packetSize", settings[i].packetSize);
+		cam.put("packetDelay", settings[i].packetDelay);
+		list.push_back(make_pair("", cam));
+	}
+	tree.add_child("cameras", list);
+	boost::property_tree::write_json(path, tree);
+}
+
+vector<PacketSettings> loadCalibration(const string& path) {
+	ptree tree;
+	try{
+		boost::property_tree::read_json(path, tree);
+	}
+	catch (const boost::property_tree::json_parser_error& e){
+		stringstream ss;
+		ss << path << "[" << e.line() << "] " << e.message();
+		throw runtime_error(ss.str());
+	}
+	vector<PacketSettings> settings;
+	for (ptree::const_iterator it = tree.get_child("cameras").begin(); it != tree.get_child("cameras").end(); it++){
+		PacketSettings p;
+		p.serial = it->second.get<uint32_t>("serial");
+		p.packetSize = it->second.get<uint32_t>("packetSize");
+		p.packetDelay = it->second.get<uint32_t>("packetDelay");
+		settings.push_back(p);
+	}
+	return settings;
+}
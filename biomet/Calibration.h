@@ -0,0 +1,83 @@
+#include "stdafx.h"
+
+#ifndef CALIBRATION_H_
+#define CALIBRATION_H_
+
+#include "RigConfig.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <functional>
+
+/*
+GigE stream settings of one camera
+*/
+struct PacketSettings{
+	uint32_t serial;
+	uint32_t packetSize;
+	uint32_t packetDelay;
+};
+
+struct CalibrationConfig{
+	CalibrationConfig();
+	std::vector<uint32_t> packetSizes;  // bytes, swept against every delay
+	std::vector<uint32_t> packetDelays; // camera ticks
+	double fps;     // trigger rate of the trials, the rig's
+	double seconds; // streamed per trial
+	double maxLoss; // fraction of a camera's frames that may arrive incomplete for a setting to count as stable
+};
+
+/*
+how every camera fared while all of them streamed with the same settings
+*/
+struct CalibrationTrial{
+	struct Cam{
+		uint32_t serial;
+		bool tuned;       // GigE, streamed with the trial's settings
+		uint64_t read;    // frames that arrived whole
+		uint64_t failed;  // incomplete or timed out
+		double loss;      // failed over read and failed
+		double MBps;      // of whole frames
+		double latencyMs; // mean trigger to read
+	};
+	uint32_t packetSize, packetDelay; // 0 for the verification of per camera settings
+	std::vector<Cam> cams;
+	std::string error; // the cameras refused the settings
+	bool
+		stable(const double maxLoss) const;
+	double
+		MBps() const;
+};
+
+struct CalibrationResult{
+	std::vector<CalibrationTrial> trials;
+	CalibrationTrial verified;
+	std::vector<PacketSettings> settings; // of the tuned cameras
+};
+
+typedef std::function<CamOpener(const CamSpec&)> OpenerFactory;
+
+/*
+sweeps packet size and inter-packet delay of the GigE cameras of a rig while
+all of its cameras stream together, they share the uplink so no camera can be
+tuned on its own. every camera then takes the stable setting it moved the
+most data with, ties going to the lowest latency, and the combination is
+streamed once more. should it lose frames the best setting all cameras
+shared is taken instead. 1394 cameras stream unchanged to load the host as in
+a capture. throws when no setting is stable
+*/
+CalibrationResult
+	calibrate(const std::vector<CamSpec>& cams, const CalibrationConfig& config, std::ostream& log,
+	const OpenerFactory& opener = camOpener);
+
+/*
+{ "cameras": [ { "serial": 5003, "packetSize": 9000, "packetDelay": 4000 } ] }
+loadRig applies the file found beside the rig at startup
+*/
+void
+	saveCalibration(const std::string& path, const std::vector<PacketSettings>& settings);
+std::vector<PacketSettings>
+	loadCalibration(const std::string& path);
+
+#endif /* CALIBRATION_H_ */
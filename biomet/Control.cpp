@@ -0,0 +1,120 @@
+#include "stdafx.h"
+
+#include "Control.h"
+#include "Pipeline.h"
+#include <sstream>
+#include <thread>
+#include <algorithm>
+
+using namespace std;
+
+volatile sig_atomic_t CaptureControl::signals = 0;
+
+CaptureControl::CaptureControl(const uint64_t flags, istream *in, ostream *log) :
+	state(make_shared<State>()) {
+	state->log = log;
+	state->flags = flags;
+	state->quitting = false;
+	state->changed = false;
+	state->fps = 0;
+	signals = 0;
+	previousInt = signal(SIGINT, signalled);
+	previousTerm = signal(SIGTERM, signalled);
+	if (in){
+		shared_ptr<State> s = state;
+		thread([s, in]{
+			string line;
+			while (getline(*in, line)){
+				s->command(line);
+			}
+		}).detach();
+	}
+}
+
+CaptureControl::~CaptureControl() {
+	signal(SIGINT, previousInt);
+	signal(SIGTERM, previousTerm);
+}
+
+void CaptureControl::signalled(int) {
+	signals = 1;
+}
+
+bool CaptureControl::State::command(const string& line) {
+	stringstream ss(line);
+	string word;
+	ss >> word;
+	transform(word.begin(), word.end(), word.begin(), ::tolower);
+	unique_lock<mutex> lock(mtx);
+	if (word == "display" || word == "d"){
+		flags ^= FRAME_DISPLAY;
+	}
+	else if (word == "save" || word == "s"){
+		flags ^= FRAME_SAVE;
+	}
+	else if (word == "start"){
+		flags |= FRAME_SAVE;
+	}
+	else if (word == "stop"){
+		flags &= ~uint64_t(FRAME_SAVE);
+	}
+	else if (word == "quit" || word == "q"){
+		quitting = true;
+	}
+	else if (word == "fps"){
+		double rate = 0;
+		if (!(ss >> rate) || rate <= 0){
+			if (log){
+				*log << "control: fps needs a rate > 0" << endl;
+			}
+			return false;
+		}
+		fps = rate;
+	}
+	else{
+		if (log && !word.empty()){
+			*log << "control: unknown command '" << line << "'" << endl;
+		}
+		return false;
+	}
+	changed = true;
+	lock.unlock();
+	cv.notify_all();
+	return true;
+}
+
+bool CaptureControl::command(const string& line) {
+	return state->command(line);
+}
+
+bool CaptureControl::wait(const Clock::time_point& until) {
+	unique_lock<mutex> lock(state->mtx);
+	// a signal handler can't notify, so signals are looked for every slice
+	const Clock::duration slice = chrono::milliseconds(50);
+	while (!state->changed && !state->quitting && !signals && Clock::now() < until){
+		state->cv.wait_until(lock, min(until, Clock::now() + slice));
+	}
+	state->changed = false;
+	state->quitting = state->quitting || signals;
+	return !state->quitting;
+}
+
+bool CaptureControl::quit() const {
+	lock_guard<mutex> lock(state->mtx);
+	return state->quitting || signals;
+}
+
+uint64_t CaptureControl::flags() const {
+	lock_guard<mutex> lock(state->mtx);
+	return state->flags;
+}
+
+bool CaptureControl::fps(double& rate) {
+	lock_guard<mutex> lock(state->mtx);
+	if (state->fps <= 0){
+		return false;
+	}
+	rate = state->fps;
+	state->fps = 0;
+	return true;
+}
@@ -0,0 +1,83 @@
+#include "stdafx.h"
+
+#ifndef CONTROL_H_
+#define CONTROL_H_
+
+#include <stdint.h>
+#include <string>
+#include <istream>
+#include <ostream>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <csignal>
+
+/*
+controls a capture without a window, in place of the keys of the GUI loop.
+commands come one per line, from stdin or whatever stream is given:
+	display, d    toggle FRAME_DISPLAY
+	save, s       toggle FRAME_SAVE
+	start, stop   turn FRAME_SAVE on or off
+	fps <rate>    retime the trigger
+	quit, q       end the capture
+SIGINT and SIGTERM quit as well, the end of the stream doesn't, so a capture
+started with stdin closed runs until it is signalled
+*/
+class CaptureControl {
+public:
+	typedef std::chrono::steady_clock Clock;
+	/*
+	in is read on a thread of its own until it ends and has to outlive that
+	thread, NULL takes commands through command() only
+	*/
+	CaptureControl(const uint64_t flags, std::istream *in = NULL, std::ostream *log = NULL);
+	~CaptureControl();
+	/*
+	applies one command line, false when it isn't one
+	*/
+	bool
+		command(const std::string& line);
+	/*
+	sleeps until until or the next command, whichever comes first, false once
+	the capture is to end
+	*/
+	bool
+		wait(const Clock::time_point& until);
+	bool
+		quit() const;
+	uint64_t
+		flags() const;
+	/*
+	the rate asked for since the last call, true when there is one
+	*/
+	bool
+		fps(double& rate);
+private:
+	/*
+	shared with the reader thread, which can't be woken from a blocking read
+	and is left to finish on its own
+	*/
+	struct State{
+		std::ostream *log;
+		std::mutex mtx;
+		std::condition_variable cv;
+		uint64_t flags;
+		bool quitting;
+		bool changed; // a command arrived since the last wait()
+		double fps;   // asked for and not yet taken, 0 for none
+		bool
+			command(const std::string& line);
+	};
+	CaptureControl(const CaptureControl&);
+	CaptureControl& operator=(const CaptureControl&);
+	static void
+		signalled(int sig);
+
+	static volatile std::sig_atomic_t signals; // SIGINT and SIGTERM received
+	std::shared_ptr<State> state;
+	void (*previousInt)(int);
+	void (*previousTerm)(int);
+};
+
+#endif /* CONTROL_H_ */
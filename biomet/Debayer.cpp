@@ -0,0 +1,149 @@
+#include "stdafx.h"
+
+#include "Debayer.h"
+#include "TriggeredCam.h"
+#include <tbb/parallel_for.h>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DEBAYER_SSE2
+#endif
+
+using namespace std;
+using namespace cv;
+
+#define DEBAYER_STRIP_ROWS (32)
+
+/*
+rounds up like _mm_avg_epu8, so both paths agree
+*/
+static inline uchar avg(const uchar a, const uchar b){
+	return uchar((a + b + 1) >> 1);
+}
+
+/*
+copies source row y, mirrored at the frame's edges, into dst with one pixel of
+padding on either side
+*/
+static void padRow(const Mat& raw, int y, uchar *dst){
+	y = y < 0 ? 1 : y >= raw.rows ? raw.rows - 2 : y;
+	const uchar *src = raw.ptr<uchar>(y);
+	memcpy(dst + 1, src, raw.cols);
+	dst[0] = src[1];
+	dst[raw.cols + 1] = src[raw.cols - 2];
+}
+
+/*
+interpolates one row of the mosaic from padded rows u, c and d (above, at and
+below it), pointing at the first real pixel
+color is the row's own non-green channel, other the channel of the rows above
+and below. colorFirst tells whether the row starts with a non-green site
+*/
+static void demosaicRow(const uchar *u, const uchar *c, const uchar *d, const int n,
+	const bool colorFirst, uchar *color, uchar *green, uchar *other){
+	int x = 0;
+#if defined(DEBAYER_SSE2)
+	// 0xff at the row's non-green sites, x stays even so the mask never shifts
+	const __m128i m = colorFirst ? _mm_set1_epi16(0x00ff) : _mm_set1_epi16(short(0xff00));
+	for (; x <= n - 16; x += 16){
+		const __m128i c0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(c + x));
+		const __m128i h = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(c + x - 1)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i *>(c + x + 1)));
+		const __m128i v = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(u + x)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i *>(d + x)));
+		const __m128i dg = _mm_avg_epu8(
+			_mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(u + x - 1)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i *>(u + x + 1))),
+			_mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(d + x - 1)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i *>(d + x + 1))));
+		const __m128i p = _mm_avg_epu8(h, v);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(color + x),
+			_mm_or_si128(_mm_and_si128(m, c0), _mm_andnot_si128(m, h)));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(green + x),
+			_mm_or_si128(_mm_and_si128(m, p), _mm_andnot_si128(m, c0)));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(other + x),
+			_mm_or_si128(_mm_and_si128(m, dg), _mm_andnot_si128(m, v)));
+	}
+#endif
+	for (; x < n; x++){
+		const uchar h = avg(c[x - 1], c[x + 1]);
+		const uchar v = avg(u[x], d[x]);
+		if (((x & 1) == 0) == colorFirst){
+			color[x] = c[x];
+			green[x] = avg(h, v);
+			other[x] = avg(avg(u[x - 1], u[x + 1]), avg(d[x - 1], d[x + 1]));
+		}
+		else{
+			color[x] = h;
+			green[x] = c[x];
+			other[x] = v;
+		}
+	}
+}
+
+static void demosaicStrip(const Mat& raw, const BayerPattern pattern, Mat& dst, const int y0, const int y1){
+	const int n = raw.cols;
+	// red on even rows, non-green on even columns of even rows
+	const bool redEven = pattern == BAYER_RGGB || pattern == BAYER_GRBG;
+	const bool firstEven = pattern == BAYER_RGGB || pattern == BAYER_BGGR;
+
+	// three padded source rows that slide down, plus the interpolated planes,
+	// kept per worker thread from strip to strip
+	static thread_local vector<uchar> buf;
+	buf.resize(3 * size_t(n + 2) + 3 * size_t(n));
+	uchar *rows[3] = { &buf[0], &buf[n + 2], &buf[2 * (n + 2)] };
+	uchar *color = &buf[3 * (n + 2)], *green = color + n, *other = green + n;
+	padRow(raw, y0 - 1, rows[0]);
+	padRow(raw, y0, rows[1]);
+	for (int y = y0; y < y1; y++){
+		padRow(raw, y + 1, rows[2]);
+		const bool even = (y & 1) == 0;
+		const bool redRow = even == redEven;
+		demosaicRow(rows[0] + 1, rows[1] + 1, rows[2] + 1, n, even == firstEven, color, green, other);
+
+		const uchar *b = redRow ? other : color, *r = redRow ? color : other;
+		uchar *out = dst.ptr<uchar>(y);
+		for (int x = 0; x < n; x++){
+			out[3 * x] = b[x];
+			out[3 * x + 1] = green[x];
+			out[3 * x + 2] = r[x];
+		}
+		rotate(rows, rows + 1, rows + 3);
+	}
+}
+
+void demosaic(const Mat& raw, const BayerPattern pattern, Mat& dst){
+	assert_throw(raw.type() == CV_8UC1);
+	assert_throw(pattern != BAYER_NONE);
+	assert_throw(raw.rows >= 2 && raw.cols >= 2);
+	dst.create(raw.rows, raw.cols, CV_8UC3);
+	const int strips = (raw.rows + DEBAYER_STRIP_ROWS - 1) / DEBAYER_STRIP_ROWS;
+	tbb::parallel_for(0, strips, [&](const int s){
+		const int y0 = s * DEBAYER_STRIP_ROWS;
+		demosaicStrip(raw, pattern, dst, y0, min(raw.rows, y0 + DEBAYER_STRIP_ROWS));
+	});
+}
+
+Size decimatedSize(const Size& size, const int factor, const BayerPattern pattern) {
+	assert_throw(factor > 0);
+	if (pattern == BAYER_NONE){
+		return Size((size.width + factor - 1) / factor, (size.height + factor - 1) / factor);
+	}
+	return Size((size.width / 2 + factor - 1) / factor * 2, (size.height / 2 + factor - 1) / factor * 2);
+}
+
+void decimate(const Mat& src, const int factor, const BayerPattern pattern, Mat& dst) {
+	assert_throw(dst.size() == decimatedSize(src.size(), factor, pattern) && dst.type() == src.type());
+	// a mosaic is decimated in 2x2 tiles, anything else per pixel
+	const int tile = pattern == BAYER_NONE ? 1 : 2;
+	const size_t bytes = src.elemSize() * tile;
+	for (int y = 0; y < dst.rows; y++){
+		const uchar *s = src.ptr<uchar>((y / tile) * tile * factor + y % tile);
+		uchar *d = dst.ptr<uchar>(y);
+		for (int x = 0; x < dst.cols; x += tile){
+			memcpy(d + x * src.elemSize(), s + size_t(x / tile) * factor * bytes, bytes);
+		}
+	}
+}
@@ -0,0 +1,36 @@
+#include "stdafx.h"
+
+#ifndef DEBAYER_H_
+#define DEBAYER_H_
+
+#include <opencv2/core/core.hpp>
+
+/*
+color filter layout of a raw sensor frame, named by its top-left 2x2 tile read
+row by row
+*/
+enum BayerPattern{
+	BAYER_NONE = 0, // not a mosaic, the frame is used as is
+	BAYER_RGGB = 1,
+	BAYER_GRBG = 2,
+	BAYER_GBRG = 3,
+	BAYER_BGGR = 4
+};
+
+/*
+bilinear demosaic of a CV_8UC1 mosaic into a CV_8UC3 BGR frame
+the frame is split in row strips that run in parallel, the interpolation uses
+SSE2 when the compiler targets it and scalar code with identical results
+otherwise. borders are mirrored
+*/
+void demosaic(const cv::Mat& raw, const BayerPattern pattern, cv::Mat& dst);
+
+/*
+keeps every factor-th pixel of src in both directions, on a mosaic every
+factor-th 2x2 tile so the result is a mosaic of the same pattern
+dst has to be decimatedSize() and of src's type
+*/
+cv::Size decimatedSize(const cv::Size& size, const int factor, const BayerPattern pattern);
+void decimate(const cv::Mat& src, const int factor, const BayerPattern pattern, cv::Mat& dst);
+
+#endif /* DEBAYER_H_ */
@@ -0,0 +1,95 @@
+#include "stdafx.h"
+
+#include "DeviceRegistry.h"
+#include "TriggeredCam.h"
+#include <iostream>
+#include <thread>
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+
+DeviceRegistry::DeviceRegistry() {
+}
+
+DeviceRegistry& DeviceRegistry::instance() {
+	static DeviceRegistry registry;
+	return registry;
+}
+
+void DeviceRegistry::setEnumerator(const DeviceBus bus, const Ptr<DeviceEnumerator>& enumerator) {
+	assert_throw(bus >= 0 && bus < BUSES);
+	Bus& b = buses[bus];
+	lock_guard<mutex> lock(b.mtx);
+	b.enumerator = enumerator;
+	b.devices.clear();
+	b.enumerated = false;
+}
+
+bool DeviceRegistry::hasEnumerator(const DeviceBus bus) const {
+	assert_throw(bus >= 0 && bus < BUSES);
+	const Bus& b = buses[bus];
+	lock_guard<mutex> lock(b.mtx);
+	return !b.enumerator.empty();
+}
+
+/*
+replaces the cached devices of a bus, called with its lock held
+*/
+void DeviceRegistry::enumerate(Bus& b) {
+	assert_throw(!b.enumerator.empty());
+	const vector<DeviceInfo> found = b.enumerator->enumerate();
+	b.devices.clear();
+	for (size_t i = 0; i < found.size(); i++){
+		b.devices[found[i].serial] = found[i];
+	}
+	b.enumerated = true;
+	b.enumeratedAt = Clock::now();
+	b.count++;
+}
+
+DeviceInfo DeviceRegistry::find(const DeviceBus bus, const uint32_t serial, const int timeoutMs) {
+	assert_throw(bus >= 0 && bus < BUSES);
+	Bus& b = buses[bus];
+	const Clock::time_point deadline = Clock::now() + chrono::milliseconds(timeoutMs);
+	unique_lock<mutex> lock(b.mtx);
+	while (true){
+		if (!b.enumerated){
+			enumerate(b);
+		}
+		map<uint32_t, DeviceInfo>::const_iterator it = b.devices.find(serial);
+		if (it != b.devices.end()){
+			return it->second;
+		}
+
+		if (Clock::now() >= deadline){
+			stringstream ss;
+			ss << "device " << serial << " not found within " << timeoutMs << " ms";
+			throw runtime_error(ss.str());
+		}
+
+		// wait out the refresh interval, other cameras can use the cache meanwhile
+		const Clock::time_point refresh = min(b.enumeratedAt + chrono::milliseconds(REFRESH_MS), deadline);
+		lock.unlock();
+		this_thread::sleep_until(refresh);
+		lock.lock();
+		if (b.enumeratedAt < refresh){
+			enumerate(b);
+		}
+	}
+}
+
+void DeviceRegistry::invalidate(const uint32_t serial) {
+	for (int bus = 0; bus < BUSES; bus++){
+		Bus& b = buses[bus];
+		lock_guard<mutex> lock(b.mtx);
+		b.devices.erase(serial);
+	}
+}
+
+uint64_t DeviceRegistry::enumerations(const DeviceBus bus) const {
+	assert_throw(bus >= 0 && bus < BUSES);
+	const Bus& b = buses[bus];
+	lock_guard<mutex> lock(b.mtx);
+	return b.count;
+}
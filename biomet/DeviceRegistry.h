@@ -0,0 +1,114 @@
+#include "stdafx.h"
+
+#ifndef DEVICEREGISTRY_H_
+#define DEVICEREGISTRY_H_
+
+#include <opencv2/core/core.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+
+/*
+camera buses with their own discovery
+*/
+typedef enum
+{
+	BUS_PG = 0, // FlyCapture2, GigE and 1394
+	BUS_XC = 1, // XCamera GigE Vision
+	BUSES
+} DeviceBus;
+
+/*
+what a camera constructor needs to connect to a device
+*/
+struct DeviceInfo{
+	DeviceInfo() :
+		serial(0) {
+		guid[0] = guid[1] = guid[2] = guid[3] = 0;
+	}
+	uint32_t serial;
+	std::string address; // XC connection url
+	uint32_t guid[4];    // PG PGRGuid value
+};
+
+/*
+lists the devices on one bus, implemented on top of the camera SDKs or
+simulated for offline runs
+*/
+class DeviceEnumerator {
+public:
+	virtual ~DeviceEnumerator() {
+	}
+	virtual std::vector<DeviceInfo>
+		enumerate() = 0;
+};
+
+/*
+serial to device mappings of every bus, enumerated once and shared by all camera
+constructors instead of each camera rediscovering the network. a serial that
+is missing from the cache makes find() re-enumerate its bus, at most every
+REFRESH_MS and for no longer than the caller's timeout, so a camera that is
+still booting is picked up without hammering the bus
+lookups of different buses run in parallel, lookups of the same bus wait for
+its enumeration and then hit the cache
+*/
+class DeviceRegistry {
+public:
+	typedef std::chrono::steady_clock Clock;
+	DeviceRegistry();
+	/*
+	the process-wide registry the hardware cameras use, buses are added by the
+	camera implementations on first use
+	*/
+	static DeviceRegistry&
+		instance();
+	/*
+	serves bus through enumerator from now on, dropping what was cached for it
+	*/
+	void
+		setEnumerator(const DeviceBus bus, const cv::Ptr<DeviceEnumerator>& enumerator);
+	bool
+		hasEnumerator(const DeviceBus bus) const;
+	/*
+	the device with serial on bus, throws runtime_error once timeoutMs have passed
+	without it showing up
+	*/
+	DeviceInfo
+		find(const DeviceBus bus, const uint32_t serial, const int timeoutMs = 2000);
+	/*
+	forgets the device with serial on every bus, for a camera that failed to
+	connect at the cached address. the next find() for it enumerates again,
+	no sooner than REFRESH_MS after the last enumeration of its bus
+	*/
+	void
+		invalidate(const uint32_t serial);
+	/*
+	times bus has been enumerated
+	*/
+	uint64_t
+		enumerations(const DeviceBus bus) const;
+private:
+	static const int REFRESH_MS = 200;
+	struct Bus{
+		Bus() :
+			enumerated(false), count(0) {
+		}
+		cv::Ptr<DeviceEnumerator> enumerator;
+		std::map<uint32_t, DeviceInfo> devices;
+		bool enumerated;
+		Clock::time_point enumeratedAt;
+		uint64_t count;
+		mutable std::mutex mtx;
+	};
+	DeviceRegistry(const DeviceRegistry&);
+	DeviceRegistry& operator=(const DeviceRegistry&);
+	void
+		enumerate(Bus& b);
+
+	Bus buses[BUSES];
+};
+
+#endif /* DEVICEREGISTRY_H_ */
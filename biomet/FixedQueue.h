@@ -0,0 +1,70 @@
+#include "stdafx.h"
+
+#ifndef FIXEDQUEUE_H_
+#define FIXEDQUEUE_H_
+
+#include "TriggeredCam.h"
+#include <vector>
+#include <utility>
+
+/*
+first in first out queue on a ring of slots allocated once
+items are moved in and out and a slot is reset once its item left, so frames
+and sets queued here hold no references after they are popped. a queue that
+keeps cycling never touches the heap, unlike std::deque which allocates a new
+block every few frames. not synchronized, the owner locks
+*/
+template<typename T>
+class FixedQueue {
+public:
+	FixedQueue(const size_t capacity) :
+		items(capacity), head(0), count(0) {
+		assert_throw(capacity > 0);
+	}
+	size_t size() const{
+		return count;
+	}
+	size_t capacity() const{
+		return items.size();
+	}
+	bool empty() const{
+		return count == 0;
+	}
+	bool full() const{
+		return count == items.size();
+	}
+	/*
+	throws when full, make room with drop() first
+	*/
+	void push(T&& item){
+		assert_throw(!full());
+		items[(head + count) % items.size()] = std::move(item);
+		count++;
+	}
+	/*
+	false when empty
+	*/
+	bool pop(T& item){
+		if (count == 0){
+			return false;
+		}
+		item = std::move(items[head]);
+		items[head] = T();
+		head = (head + 1) % items.size();
+		count--;
+		return true;
+	}
+	/*
+	discards the oldest item, false when empty
+	*/
+	bool drop(){
+		T item;
+		return pop(item);
+	}
+private:
+	std::vector<T> items;
+	size_t head;
+	size_t count;
+};
+
+#endif /* FIXEDQUEUE_H_ */
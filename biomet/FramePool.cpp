@@ -0,0 +1,80 @@
+#include "stdafx.h"
+
+#include "FramePool.h"
+
+using namespace std;
+using namespace cv;
+
+FramePool::FramePool(const size_t capacity) :
+	cap(capacity), next(0), nAllocs(0), nOverflows(0) {
+	buffers.reserve(cap);
+}
+
+/*
+a pooled buffer is free when the pool holds the only reference to it
+the count is read with an atomic add of 0, other threads drop their references
+with atomic decrements while the pool looks. once it reads 1 no one else can
+reach the buffer, only the pool can hand it out again
+*/
+bool FramePool::isFree(const Mat& m) {
+#if CV_MAJOR_VERSION >= 3
+	return m.u != NULL && CV_XADD(&m.u->refcount, 0) == 1;
+#else
+	return m.refcount != NULL && CV_XADD(m.refcount, 0) == 1;
+#endif
+}
+
+bool FramePool::matches(const Mat& m, const int rows, const int cols, const int type) {
+	return m.rows == rows && m.cols == cols && m.type() == type;
+}
+
+Mat FramePool::acquire(const int rows, const int cols, const int type) {
+	lock_guard<mutex> lock(mtx);
+
+	size_t spare = buffers.size();
+	for (size_t n = 0; n < buffers.size(); n++) {
+		const size_t i = (next + n) % buffers.size();
+		if (!isFree(buffers[i])) {
+			continue;
+		}
+		if (matches(buffers[i], rows, cols, type)) {
+			next = (i + 1) % buffers.size();
+			return buffers[i];
+		}
+		spare = spare < buffers.size() ? spare : i;
+	}
+
+	if (buffers.size() < cap) {
+		nAllocs++;
+		buffers.push_back(Mat(rows, cols, type));
+		return buffers.back();
+	}
+
+	// geometry changed, a free buffer of the old one makes room for the new
+	// one. borrowed buffers stay valid until their owners release them
+	if (spare < buffers.size()) {
+		nAllocs++;
+		buffers[spare] = Mat(rows, cols, type);
+		next = (spare + 1) % buffers.size();
+		return buffers[spare];
+	}
+
+	// every buffer is borrowed, hand out an unpooled frame rather than stall the camera
+	nAllocs++;
+	nOverflows++;
+	return Mat(rows, cols, type);
+}
+
+size_t FramePool::capacity() const {
+	return cap;
+}
+
+uint64_t FramePool::allocations() const {
+	lock_guard<mutex> lock(mtx);
+	return nAllocs;
+}
+
+uint64_t FramePool::overflows() const {
+	lock_guard<mutex> lock(mtx);
+	return nOverflows;
+}
@@ -0,0 +1,45 @@
+#include "stdafx.h"
+
+#ifndef FRAMEPOOL_H_
+#define FRAMEPOOL_H_
+
+#include <opencv2/core/core.hpp>
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+
+/*
+fixed-capacity pool of recycled frame buffers
+acquire() hands out a cv::Mat that shares one of the pooled buffers, the buffer
+becomes available again once the last Mat referencing it is released, on any
+thread. buffers of different geometries share the capacity, a free buffer of
+another geometry is only replaced once the pool is full
+*/
+class FramePool {
+public:
+	FramePool(const size_t capacity = 8);
+	cv::Mat
+		acquire(const int rows, const int cols, const int type);
+	size_t
+		capacity() const;
+	// number of buffers allocated over the lifetime of the pool
+	uint64_t
+		allocations() const;
+	// number of acquire() calls that found every pooled buffer in use and
+	// handed out an unpooled one
+	uint64_t
+		overflows() const;
+private:
+	static bool
+		isFree(const cv::Mat& m);
+	static bool
+		matches(const cv::Mat& m, const int rows, const int cols, const int type);
+	mutable std::mutex mtx;
+	std::vector<cv::Mat> buffers;
+	const size_t cap;
+	size_t next;
+	uint64_t nAllocs;
+	uint64_t nOverflows;
+};
+
+#endif /* FRAMEPOOL_H_ */
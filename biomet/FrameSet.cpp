@@ -0,0 +1,177 @@
+#include "stdafx.h"
+
+#include "FrameSet.h"
+#include "TriggeredCam.h"
+#include <new>
+
+using namespace std;
+
+FrameSet::FrameSet() :
+	pool(NULL), slots(NULL), n(0), refs(0) {
+}
+
+size_t FrameSet::size() const {
+	return n;
+}
+
+TriggeredFrame& FrameSet::operator[](const size_t i) {
+	return slots[i].f;
+}
+
+const TriggeredFrame& FrameSet::operator[](const size_t i) const {
+	return slots[i].f;
+}
+
+FrameSetPtr::FrameSetPtr() :
+	set(NULL) {
+}
+
+FrameSetPtr::FrameSetPtr(FrameSet *set) :
+	set(set) {
+	set->refs.fetch_add(1, memory_order_relaxed);
+}
+
+FrameSetPtr::FrameSetPtr(const FrameSetPtr& other) :
+	set(other.set) {
+	if (set != NULL){
+		set->refs.fetch_add(1, memory_order_relaxed);
+	}
+}
+
+FrameSetPtr::FrameSetPtr(FrameSetPtr&& other) :
+	set(other.set) {
+	other.set = NULL;
+}
+
+FrameSetPtr::~FrameSetPtr() {
+	release();
+}
+
+FrameSetPtr& FrameSetPtr::operator=(FrameSetPtr other) {
+	swap(set, other.set);
+	return *this;
+}
+
+FrameSet& FrameSetPtr::operator*() const {
+	return *set;
+}
+
+FrameSet *FrameSetPtr::operator->() const {
+	return set;
+}
+
+bool FrameSetPtr::empty() const {
+	return set == NULL;
+}
+
+void FrameSetPtr::release() {
+	if (set == NULL){
+		return;
+	}
+	FrameSet *s = set;
+	set = NULL;
+	if (s->refs.fetch_sub(1, memory_order_acq_rel) != 1){
+		return;
+	}
+	if (s->pool != NULL){
+		s->pool->recycle(s);
+	}
+	else{
+		FrameSetPool::destroy(s);
+	}
+}
+
+FrameSetPool::FrameSetPool(const size_t cams, const size_t capacity) :
+	n(cams), block(NULL), nAllocs(0), nOverflows(0) {
+	assert_throw(cams > 0 && capacity > 0);
+	block = SlotAllocator().allocate(capacity * n);
+	for (size_t i = 0; i < capacity * n; i++){
+		new (block + i) FrameSet::Slot();
+	}
+	sets.reserve(capacity);
+	idle.reserve(capacity);
+	for (size_t i = 0; i < capacity; i++){
+		FrameSet *set = new FrameSet();
+		set->pool = this;
+		set->slots = block + i * n;
+		set->n = n;
+		sets.push_back(set);
+		idle.push_back(set);
+	}
+	nAllocs = capacity;
+}
+
+/*
+sets handed out must be released before, pooled ones point into the block
+*/
+FrameSetPool::~FrameSetPool() {
+	for (size_t i = 0; i < sets.size(); i++){
+		delete sets[i];
+	}
+	for (size_t i = 0; i < sets.size() * n; i++){
+		block[i].~Slot();
+	}
+	SlotAllocator().deallocate(block, sets.size() * n);
+}
+
+FrameSet *FrameSetPool::allocate(const size_t cams) {
+	FrameSet *set = new FrameSet();
+	set->slots = SlotAllocator().allocate(cams);
+	for (size_t i = 0; i < cams; i++){
+		new (set->slots + i) FrameSet::Slot();
+	}
+	set->n = cams;
+	return set;
+}
+
+void FrameSetPool::destroy(FrameSet *set) {
+	for (size_t i = 0; i < set->n; i++){
+		set->slots[i].~Slot();
+	}
+	SlotAllocator().deallocate(set->slots, set->n);
+	delete set;
+}
+
+FrameSetPtr FrameSetPool::acquire() {
+	{
+		lock_guard<mutex> lock(mtx);
+		if (!idle.empty()){
+			FrameSet *set = idle.back();
+			idle.pop_back();
+			return FrameSetPtr(set);
+		}
+		nAllocs++;
+		nOverflows++;
+	}
+	// every set is held, an unpooled one rather than stall the synchronizer
+	return FrameSetPtr(allocate(n));
+}
+
+/*
+clears the frames outside the lock, their buffers go back to their own pools
+*/
+void FrameSetPool::recycle(FrameSet *set) {
+	for (size_t i = 0; i < set->n; i++){
+		set->slots[i].f = TriggeredFrame();
+	}
+	lock_guard<mutex> lock(mtx);
+	idle.push_back(set);
+}
+
+size_t FrameSetPool::cams() const {
+	return n;
+}
+
+size_t FrameSetPool::capacity() const {
+	return sets.size();
+}
+
+uint64_t FrameSetPool::allocations() const {
+	lock_guard<mutex> lock(mtx);
+	return nAllocs;
+}
+
+uint64_t FrameSetPool::overflows() const {
+	lock_guard<mutex> lock(mtx);
+	return nOverflows;
+}
@@ -0,0 +1,123 @@
+#include "stdafx.h"
+
+#ifndef FRAMESET_H_
+#define FRAMESET_H_
+
+#include "TriggeredFrame.h"
+#include <tbb/cache_aligned_allocator.h>
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+class FrameSetPool;
+class FrameSetPtr;
+
+/*
+the frames of one trigger, one per camera in a fixed camera order
+sets only come from a FrameSetPool and are held through FrameSetPtr
+*/
+class FrameSet {
+public:
+	size_t
+		size() const;
+	TriggeredFrame&
+		operator[](const size_t i);
+	const TriggeredFrame&
+		operator[](const size_t i) const;
+private:
+	friend class FrameSetPool;
+	friend class FrameSetPtr;
+	/*
+	a camera's frame on cache lines of its own, threads filling in different
+	cameras of a set don't write to the same line
+	*/
+	struct alignas(64) Slot{
+		TriggeredFrame f;
+	};
+	FrameSet();
+	FrameSet(const FrameSet&);
+	FrameSet& operator=(const FrameSet&);
+
+	FrameSetPool *pool; // NULL for a set made while every pooled one was in use
+	Slot *slots;
+	size_t n;
+	std::atomic<int> refs;
+};
+
+/*
+counted reference to a pooled set, copying it is an atomic increment instead
+of copying every camera's frame. the last reference to go clears the frames,
+so their buffers go back to their pools, and returns the set to its pool
+*/
+class FrameSetPtr {
+public:
+	FrameSetPtr();
+	FrameSetPtr(const FrameSetPtr& other);
+	FrameSetPtr(FrameSetPtr&& other);
+	~FrameSetPtr();
+	FrameSetPtr&
+		operator=(FrameSetPtr other);
+	FrameSet&
+		operator*() const;
+	FrameSet *
+		operator->() const;
+	bool
+		empty() const;
+	void
+		release();
+private:
+	friend class FrameSetPool;
+	explicit FrameSetPtr(FrameSet *set);
+
+	FrameSet *set;
+};
+
+/*
+fixed-capacity pool of frame sets for a runtime number of cameras
+the frames of all sets are allocated up front in one cache aligned block, a
+set is acquired once per trigger and recycled when its last reference is
+released. like FramePool, an exhausted pool hands out an unpooled set rather
+than stall the caller
+*/
+class FrameSetPool {
+public:
+	FrameSetPool(const size_t cams, const size_t capacity = 16);
+	~FrameSetPool();
+	/*
+	a set of empty frames
+	*/
+	FrameSetPtr
+		acquire();
+	size_t
+		cams() const;
+	size_t
+		capacity() const;
+	// number of sets allocated over the lifetime of the pool
+	uint64_t
+		allocations() const;
+	// number of acquire() calls that found every pooled set in use
+	uint64_t
+		overflows() const;
+private:
+	friend class FrameSetPtr;
+	typedef tbb::cache_aligned_allocator<FrameSet::Slot> SlotAllocator;
+	FrameSetPool(const FrameSetPool&);
+	FrameSetPool& operator=(const FrameSetPool&);
+	static FrameSet *
+		allocate(const size_t cams);
+	static void
+		destroy(FrameSet *set);
+	void
+		recycle(FrameSet *set);
+
+	const size_t n;
+	FrameSet::Slot *block;         // capacity * n frames, set i owns [i * n, (i + 1) * n)
+	std::vector<FrameSet *> sets;
+	std::vector<FrameSet *> idle;  // reserved for every set, never grows
+	uint64_t nAllocs;
+	uint64_t nOverflows;
+	mutable std::mutex mtx;
+};
+
+#endif /* FRAMESET_H_ */
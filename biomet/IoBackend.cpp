@@ -0,0 +1,279 @@
+#include "stdafx.h"
+
+#include "IoBackend.h"
+#include "TriggeredCam.h"
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <new>
+#if defined(_MSC_VER) || defined(__MINGW32__) || defined(__MINGW64__)
+#include <malloc.h>
+#elif defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+#if defined(HAVE_LIBURING)
+#include <liburing.h>
+#endif
+
+using namespace std;
+
+uint8_t *alignedAlloc(const size_t bytes){
+	void *p = NULL;
+#if defined(_MSC_VER) || defined(__MINGW32__) || defined(__MINGW64__)
+	p = _aligned_malloc(bytes, IO_ALIGN);
+#else
+	if (posix_memalign(&p, IO_ALIGN, bytes) != 0){
+		p = NULL;
+	}
+#endif
+	if (p == NULL){
+		throw bad_alloc();
+	}
+	return static_cast<uint8_t *>(p);
+}
+
+void alignedFree(uint8_t *p){
+#if defined(_MSC_VER) || defined(__MINGW32__) || defined(__MINGW64__)
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+const char *ioBackendName(const IoBackendType type){
+	switch (type){
+	case IO_STDIO:
+		return "stdio";
+	case IO_DIRECT:
+		return "direct";
+	case IO_URING:
+		return "io_uring";
+	default:
+		return "unknown";
+	}
+}
+
+/*
+portable buffered writes, completes every write before returning
+*/
+class StdioBackend : public IoBackend {
+public:
+	StdioBackend(const string& path) :
+		path(path), position(0) {
+		if ((file = fopen(path.c_str(), "wb")) == NULL){
+			throw runtime_error("could not open " + path + " for writing");
+		}
+	}
+	virtual ~StdioBackend(){
+		if (file != NULL){
+			fclose(file);
+		}
+	}
+	virtual void submit(const uint8_t *buf, const size_t bytes, const uint64_t offset){
+		if (offset != position){
+			// only the final header patch seeks, which always goes back to 0
+			assert_throw(offset == 0);
+			if (fseek(file, 0, SEEK_SET) != 0){
+				throw runtime_error("seek in " + path + " failed");
+			}
+		}
+		if (fwrite(buf, 1, bytes, file) != bytes){
+			throw runtime_error("write to " + path + " failed");
+		}
+		position = offset + bytes;
+	}
+	virtual void wait(const size_t inflight){
+	}
+	virtual void close(){
+		if (file != NULL){
+			const int r = fclose(file);
+			file = NULL;
+			if (r != 0){
+				throw runtime_error("close of " + path + " failed");
+			}
+		}
+	}
+	virtual IoBackendType type() const{
+		return IO_STDIO;
+	}
+private:
+	const string path;
+	FILE *file;
+	uint64_t position;
+};
+
+#if defined(__linux__)
+/*
+synchronous pwrite on an O_DIRECT descriptor, no page cache copy
+submit() returns once the write is on the device and wait() has nothing left
+to wait for, so the writer thread stalls on every chunk instead of filling the
+next one meanwhile
+*/
+class DirectBackend : public IoBackend {
+public:
+	DirectBackend(const string& path) :
+		path(path) {
+		if ((fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644)) < 0){
+			throw runtime_error("could not open " + path + " with O_DIRECT: " + strerror(errno));
+		}
+		probe();
+	}
+	virtual ~DirectBackend(){
+		if (fd >= 0){
+			::close(fd);
+		}
+	}
+	virtual void submit(const uint8_t *buf, const size_t bytes, const uint64_t offset){
+		size_t done = 0;
+		while (done < bytes){
+			const ssize_t n = pwrite(fd, buf + done, bytes - done, off_t(offset + done));
+			if (n < 0 && errno == EINTR){
+				continue;
+			}
+			if (n <= 0){
+				throw runtime_error("write to " + path + " failed: " + strerror(errno));
+			}
+			done += size_t(n);
+		}
+	}
+	virtual void wait(const size_t inflight){
+	}
+	virtual void close(){
+		if (fd >= 0){
+			const int r = ::close(fd);
+			fd = -1;
+			if (r != 0){
+				throw runtime_error("close of " + path + " failed: " + strerror(errno));
+			}
+		}
+	}
+	virtual IoBackendType type() const{
+		return IO_DIRECT;
+	}
+protected:
+	/*
+	some filesystems accept O_DIRECT at open and only refuse the writes, or
+	need a larger alignment than IO_ALIGN. one aligned block written and
+	truncated away finds out before the sequence depends on it
+	*/
+	void probe(){
+		uint8_t *block = alignedAlloc(IO_ALIGN);
+		memset(block, 0, IO_ALIGN);
+		ssize_t n;
+		do{
+			n = pwrite(fd, block, IO_ALIGN, 0);
+		} while (n < 0 && errno == EINTR);
+		const int err = errno;
+		alignedFree(block);
+		if (n != ssize_t(IO_ALIGN) || ftruncate(fd, 0) != 0){
+			const string reason = n < 0 ? strerror(err) : "short write";
+			::close(fd);
+			fd = -1;
+			throw runtime_error("O_DIRECT write to " + path + " failed: " + reason);
+		}
+	}
+
+	const string path;
+	int fd;
+};
+#endif
+
+#if defined(__linux__) && defined(HAVE_LIBURING)
+/*
+asynchronous O_DIRECT writes through io_uring, the caller keeps filling the
+next buffer while earlier ones are in flight
+*/
+class UringBackend : public DirectBackend {
+public:
+	UringBackend(const string& path) :
+		DirectBackend(path), pending(0) {
+		const int r = io_uring_queue_init(QUEUE_DEPTH, &ring, 0);
+		if (r < 0){
+			throw runtime_error("io_uring_queue_init failed: " + string(strerror(-r)));
+		}
+	}
+	virtual ~UringBackend(){
+		try{
+			wait(0);
+		}
+		catch (const exception& e){
+			cerr << e.what() << endl;
+		}
+		io_uring_queue_exit(&ring);
+	}
+	virtual void submit(const uint8_t *buf, const size_t bytes, const uint64_t offset){
+		if (pending >= QUEUE_DEPTH){
+			wait(QUEUE_DEPTH - 1);
+		}
+		struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+		assert_throw(sqe != NULL);
+		io_uring_prep_write(sqe, fd, buf, unsigned(bytes), offset);
+		io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(uintptr_t(bytes)));
+		const int r = io_uring_submit(&ring);
+		if (r < 0){
+			throw runtime_error("io_uring_submit failed: " + string(strerror(-r)));
+		}
+		pending++;
+	}
+	virtual void wait(const size_t inflight){
+		while (pending > inflight){
+			struct io_uring_cqe *cqe;
+			const int r = io_uring_wait_cqe(&ring, &cqe);
+			if (r < 0){
+				throw runtime_error("io_uring_wait_cqe failed: " + string(strerror(-r)));
+			}
+			const int res = cqe->res;
+			const size_t bytes = size_t(uintptr_t(io_uring_cqe_get_data(cqe)));
+			io_uring_cqe_seen(&ring, cqe);
+			pending--;
+			if (res < 0 || size_t(res) != bytes){
+				throw runtime_error("write to " + path + " failed: " + (res < 0 ? strerror(-res) : "short write"));
+			}
+		}
+	}
+	virtual void close(){
+		wait(0);
+		DirectBackend::close();
+	}
+	virtual IoBackendType type() const{
+		return IO_URING;
+	}
+private:
+	static const unsigned QUEUE_DEPTH = 8;
+	struct io_uring ring;
+	size_t pending;
+};
+#endif
+
+IoBackend *IoBackend::create(const string& path, const IoBackendType type){
+	try{
+		switch (type){
+#if defined(__linux__)
+		case IO_DIRECT:
+			return new DirectBackend(path);
+#endif
+#if defined(__linux__) && defined(HAVE_LIBURING)
+		case IO_URING:
+			return new UringBackend(path);
+#endif
+		case IO_STDIO:
+			return new StdioBackend(path);
+		default:
+			cerr << ioBackendName(type) << " backend not available in this build, using stdio" << endl;
+			break;
+		}
+	}
+	catch (const runtime_error& e){
+		// e.g. O_DIRECT on a filesystem that does not support it
+		if (type == IO_STDIO){
+			throw;
+		}
+		cerr << e.what() << ", using stdio" << endl;
+	}
+	return new StdioBackend(path);
+}
@@ -0,0 +1,57 @@
+#include "stdafx.h"
+
+#ifndef IOBACKEND_H_
+#define IOBACKEND_H_
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+
+/*
+how sequence files reach the disk
+IO_DIRECT and IO_URING bypass the page cache (O_DIRECT) and are Linux only,
+IO_URING is only available when built with HAVE_LIBURING. an unavailable
+backend, or a file that refuses an aligned test write at open, falls back to
+IO_STDIO. only IO_URING overlaps writes with the caller, IO_STDIO and
+IO_DIRECT complete each write in submit() and wait() returns at once
+*/
+typedef enum
+{
+	IO_STDIO = 0,
+	IO_DIRECT = 1,
+	IO_URING = 2
+} IoBackendType;
+
+/*
+sink for aligned writes at explicit offsets
+buffers, sizes and offsets must be multiples of IO_ALIGN
+*/
+class IoBackend {
+public:
+	virtual ~IoBackend() {
+	}
+	/*
+	queues a write, buf must stay untouched until wait() says it completed
+	*/
+	virtual void
+		submit(const uint8_t *buf, const size_t bytes, const uint64_t offset) = 0;
+	/*
+	blocks until no more than `inflight` writes are pending
+	*/
+	virtual void
+		wait(const size_t inflight) = 0;
+	virtual void
+		close() = 0;
+	virtual IoBackendType
+		type() const = 0;
+	static IoBackend *
+		create(const std::string& path, const IoBackendType type);
+};
+
+#define IO_ALIGN (4096)
+
+uint8_t *alignedAlloc(const size_t bytes);
+void alignedFree(uint8_t *p);
+const char *ioBackendName(const IoBackendType type);
+
+#endif /* IOBACKEND_H_ */
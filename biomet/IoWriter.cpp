@@ -0,0 +1,205 @@
+#include "stdafx.h"
+
+#include "IoWriter.h"
+#include <boost/filesystem.hpp>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+using namespace cv;
+
+IoWriter::IoWriter(const string& baseDir, const StageConfig& config,
+	const IoBackendType backend, const SequenceCodec codec, const size_t chunkBytes) :
+	name("writer"), baseDir(baseDir), config(config), backend(backend), codec(codec), chunkBytes(chunkBytes), metrics(NULL) {
+	assert_throw(config.concurrency > 0);
+	assert_throw(config.capacity >= config.concurrency);
+	perWorker = config.capacity / config.concurrency;
+	for (size_t i = 0; i < config.concurrency; i++){
+		Worker *w = new Worker(perWorker);
+		w->latencies.resize(LATENCY_SAMPLES);
+		w->nLatencies = 0;
+		w->bytes = 0;
+		w->counters.queued = 0;
+		w->counters.dropped = 0;
+		w->counters.processed = 0;
+		w->counters.failed = 0;
+		w->counters.depth = 0;
+		w->counters.maxDepth = 0;
+		w->stopping = false;
+		workers.push_back(w);
+	}
+	for (size_t i = 0; i < workers.size(); i++){
+		workers[i]->thread = thread(&IoWriter::run, this, ref(*workers[i]));
+	}
+}
+
+IoWriter::~IoWriter() {
+	close();
+	for (size_t i = 0; i < workers.size(); i++){
+		delete workers[i];
+	}
+}
+
+void IoWriter::put(const TriggeredFrame& f) {
+	Worker& w = *workers[f.serial % workers.size()];
+	{
+		unique_lock<mutex> lock(w.mtx);
+		assert_throw(!w.stopping);
+		if (w.queue.size() >= perWorker){
+			if (config.policy == BLOCK){
+				w.notFull.wait(lock, [&]{ return w.queue.size() < perWorker; });
+			}
+			else{
+				w.queue.drop();
+				w.counters.dropped++;
+			}
+		}
+		Item item;
+		item.f = f;
+		item.queued = Clock::now();
+		w.queue.push(move(item));
+		w.counters.queued++;
+		w.counters.maxDepth = max(w.counters.maxDepth, w.queue.size());
+	}
+	w.notEmpty.notify_one();
+}
+
+void IoWriter::setMetrics(Metrics *metrics) {
+	this->metrics = metrics;
+}
+
+void IoWriter::close() {
+	for (size_t i = 0; i < workers.size(); i++){
+		{
+			lock_guard<mutex> lock(workers[i]->mtx);
+			workers[i]->stopping = true;
+		}
+		workers[i]->notEmpty.notify_all();
+	}
+	for (size_t i = 0; i < workers.size(); i++){
+		if (workers[i]->thread.joinable()){
+			workers[i]->thread.join();
+		}
+	}
+}
+
+SequenceWriter& IoWriter::sequence(Worker& w, const TriggeredFrame& f) {
+	Ptr<SequenceWriter>& s = w.sequences[f.serial];
+	if (s.empty()){
+		boost::filesystem::path seqPath(baseDir);
+		seqPath /= std::to_string(f.serial) + ".seq";
+		const SequenceCodec c = codec == SEQ_CODEC_THERMAL && f.frame.type() == CV_16UC1 ? codec : SEQ_CODEC_RAW;
+		s = new SequenceWriter(seqPath.string(), f.serial, f.frame.rows, f.frame.cols,
+			f.frame.type(), chunkBytes, backend, c, f.bayer);
+	}
+	return *s;
+}
+
+/*
+exposure time of a frame in microseconds since the epoch, its host clock
+capture stamp moved over to the wall clock. frames without one are stamped
+at their trigger, or failing that now
+*/
+static int64_t captureTime(const TriggeredFrame& f){
+	const int64_t wall = chrono::duration_cast<chrono::microseconds>(
+		chrono::system_clock::now().time_since_epoch()).count();
+	const int64_t host = f.captured != 0 ? f.captured : f.stamps[STAMP_TRIGGER];
+	if (host == 0){
+		return wall;
+	}
+	return wall - (TriggeredFrame::now() - host) / 1000;
+}
+
+void IoWriter::run(Worker& w) {
+	while (true){
+		Item item;
+		{
+			unique_lock<mutex> lock(w.mtx);
+			w.notEmpty.wait(lock, [&]{ return !w.queue.empty() || w.stopping; });
+			if (!w.queue.pop(item)){
+				break;
+			}
+		}
+		w.notFull.notify_one();
+
+		bool saved = false;
+		uint64_t stored = 0;
+		try{
+			SequenceWriter& seq = sequence(w, item.f);
+			stored = seq.append(item.f.frame_no, captureTime(item.f), item.f.frame, item.f.captured, item.f.deviceStamp);
+			saved = true;
+			if (metrics != NULL){
+				item.f.stamps[STAMP_WRITE] = TriggeredFrame::now();
+				metrics->record(STAMP_WRITE, item.f);
+			}
+		}
+		catch (const exception& e){
+			cerr << __FILE__ << "[" << __LINE__ << "] " << e.what() << endl;
+		}
+
+		const double us = chrono::duration<double, micro>(Clock::now() - item.queued).count();
+		lock_guard<mutex> lock(w.mtx);
+		w.latencies[w.nLatencies++ % LATENCY_SAMPLES] = us;
+		// a frame that didn't make it into its sequence is lost, not saved
+		if (saved){
+			w.bytes += stored;
+			w.counters.processed++;
+		}
+		else{
+			w.counters.failed++;
+		}
+	}
+
+	for (map<uint32_t, Ptr<SequenceWriter> >::iterator it = w.sequences.begin(); it != w.sequences.end(); it++){
+		if (it->second.empty()){
+			continue; // never opened
+		}
+		try{
+			it->second->close();
+		}
+		catch (const exception& e){
+			cerr << __FILE__ << "[" << __LINE__ << "] " << e.what() << endl;
+		}
+	}
+	w.sequences.clear();
+}
+
+StageStats IoWriter::stats() const {
+	StageStats r;
+	r.queued = 0;
+	r.dropped = 0;
+	r.processed = 0;
+	r.failed = 0;
+	r.depth = 0;
+	r.maxDepth = 0;
+	for (size_t i = 0; i < workers.size(); i++){
+		lock_guard<mutex> lock(workers[i]->mtx);
+		r.queued += workers[i]->counters.queued;
+		r.dropped += workers[i]->counters.dropped;
+		r.processed += workers[i]->counters.processed;
+		r.failed += workers[i]->counters.failed;
+		r.depth += workers[i]->queue.size();
+		r.maxDepth += workers[i]->counters.maxDepth;
+	}
+	return r;
+}
+
+uint64_t IoWriter::bytesWritten() const {
+	uint64_t r = 0;
+	for (size_t i = 0; i < workers.size(); i++){
+		lock_guard<mutex> lock(workers[i]->mtx);
+		r += workers[i]->bytes;
+	}
+	return r;
+}
+
+vector<double> IoWriter::latencies() const {
+	vector<double> r;
+	for (size_t i = 0; i < workers.size(); i++){
+		lock_guard<mutex> lock(workers[i]->mtx);
+		const size_t n = min(workers[i]->nLatencies, size_t(LATENCY_SAMPLES));
+		r.insert(r.end(), workers[i]->latencies.begin(), workers[i]->latencies.begin() + n);
+	}
+	return r;
+}
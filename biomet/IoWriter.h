@@ -0,0 +1,99 @@
+#include "stdafx.h"
+
+#ifndef IOWRITER_H_
+#define IOWRITER_H_
+
+#include "TriggeredFrame.h"
+#include "SequenceFile.h"
+#include "Stage.h"
+#include "Metrics.h"
+#include "FixedQueue.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+/*
+dedicated disk writer
+frames are queued to I/O threads of their own, each camera is pinned to one
+thread which appends to that camera's sequence file, so blocking writes never
+occupy the graph's worker threads. config.concurrency is the number of I/O
+threads, config.capacity the frames that may wait across all of them
+frames the codec supports are encoded on the I/O threads, others are stored raw
+*/
+class IoWriter {
+public:
+	typedef std::chrono::steady_clock Clock;
+	IoWriter(const std::string& baseDir, const StageConfig& config,
+		const IoBackendType backend = IO_STDIO, const SequenceCodec codec = SEQ_CODEC_RAW,
+		const size_t chunkBytes = 8 << 20);
+	~IoWriter();
+	void
+		put(const TriggeredFrame& f);
+	/*
+	records the write stage of every appended frame, set before the first put()
+	*/
+	void
+		setMetrics(Metrics *metrics);
+	/*
+	writes everything still queued and closes the sequence files
+	*/
+	void
+		close();
+	StageStats
+		stats() const;
+	/*
+	bytes of the appended frames as stored, encoded payloads and their records,
+	like SequenceWriter::bytesWritten() without the headers and indexes
+	*/
+	uint64_t
+		bytesWritten() const;
+	/*
+	put() to append latencies in microseconds of the most recent frames
+	*/
+	std::vector<double>
+		latencies() const;
+	const std::string name;
+private:
+	struct Item{
+		TriggeredFrame f;
+		Clock::time_point queued;
+	};
+	struct Worker{
+		Worker(const size_t capacity) :
+			queue(capacity) {
+		}
+		FixedQueue<Item> queue;
+		std::map<uint32_t, cv::Ptr<SequenceWriter> > sequences;
+		std::vector<double> latencies; // ring of LATENCY_SAMPLES
+		size_t nLatencies;
+		uint64_t bytes;
+		StageStats counters;
+		bool stopping;
+		std::thread thread;
+		mutable std::mutex mtx;
+		std::condition_variable notEmpty, notFull;
+	};
+	IoWriter(const IoWriter&);
+	IoWriter& operator=(const IoWriter&);
+	void
+		run(Worker& w);
+	SequenceWriter&
+		sequence(Worker& w, const TriggeredFrame& f);
+
+	static const size_t LATENCY_SAMPLES = 4096;
+	const std::string baseDir;
+	const StageConfig config;
+	const IoBackendType backend;
+	const SequenceCodec codec;
+	const size_t chunkBytes;
+	Metrics *metrics;
+	size_t perWorker;
+	std::vector<Worker *> workers;
+};
+
+#endif /* IOWRITER_H_ */
@@ -0,0 +1,250 @@
+#include "stdafx.h"
+
+#include "Metrics.h"
+#include "TriggeredCam.h"
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+static atomic<uint64_t> nextMetricsId(1);
+
+/*
+the stamp a stage's latency is measured from
+*/
+static FrameStamp previous(const FrameStamp stamp){
+	switch (stamp){
+	case STAMP_READ:
+		return STAMP_TRIGGER;
+	case STAMP_DISPATCH:
+		return STAMP_READ;
+	default:
+		return STAMP_DISPATCH;
+	}
+}
+
+Metrics::Histogram::Histogram() {
+	for (int i = 0; i < HIST_BUCKETS; i++){
+		buckets[i].store(0, memory_order_relaxed);
+	}
+	sum.store(0, memory_order_relaxed);
+	max.store(0, memory_order_relaxed);
+}
+
+Metrics::Metrics(const vector<uint32_t>& serials) :
+	serials(serials), id(nextMetricsId++) {
+	assert_throw(!serials.empty());
+}
+
+Metrics::~Metrics() {
+	for (map<thread::id, Shard *>::iterator it = shards.begin(); it != shards.end(); it++){
+		delete it->second;
+	}
+}
+
+/*
+the calling thread's shard, created on its first record()
+*/
+Metrics::Shard& Metrics::shard() {
+	thread_local uint64_t cachedId = 0;
+	thread_local Shard *cached = NULL;
+	if (cachedId != id){
+		lock_guard<mutex> lock(mtx);
+		Shard *&s = shards[this_thread::get_id()];
+		if (s == NULL){
+			s = new Shard(serials.size() * (STAMPS - 1));
+		}
+		cached = s;
+		cachedId = id;
+	}
+	return *cached;
+}
+
+size_t Metrics::indexOf(const uint32_t serial) const {
+	return find(serials.begin(), serials.end(), serial) - serials.begin();
+}
+
+int Metrics::bucketOf(const uint64_t ns) {
+	if (ns < uint64_t(HIST_SUB)){
+		return int(ns);
+	}
+	// shift ns down to HIST_SUB_BITS + 1 significant bits
+	uint64_t v = ns;
+	int shift = 0;
+	for (int s = 32; s > 0; s >>= 1){
+		if ((v >> s) >= uint64_t(HIST_SUB)){
+			v >>= s;
+			shift += s;
+		}
+	}
+	return min(HIST_BUCKETS - 1, (shift + 1) * HIST_SUB + int(v) - HIST_SUB);
+}
+
+/*
+midpoint of a bucket's range
+*/
+uint64_t Metrics::bucketValue(const int bucket) {
+	if (bucket < HIST_SUB){
+		return uint64_t(bucket);
+	}
+	const int shift = bucket / HIST_SUB - 1;
+	return (uint64_t(HIST_SUB + bucket % HIST_SUB) << shift) + ((uint64_t(1) << shift) - 1) / 2;
+}
+
+void Metrics::record(const FrameStamp stamp, const TriggeredFrame& f) {
+	record(stamp, f, f.stamps[stamp]);
+}
+
+void Metrics::record(const FrameStamp stamp, const TriggeredFrame& f, const int64_t at) {
+	const int64_t from = f.stamps[previous(stamp)];
+	if (from == 0 || at == 0){
+		return;
+	}
+	record(stamp, f.serial, at - from);
+}
+
+void Metrics::record(const FrameStamp stamp, const uint32_t serial, const int64_t ns) {
+	assert_throw(stamp > STAMP_TRIGGER && stamp < STAMPS);
+	const size_t cam = indexOf(serial);
+	if (cam == serials.size()){
+		return;
+	}
+	const uint64_t v = uint64_t(max<int64_t>(ns, 0));
+	// single writer per shard, plain relaxed stores are enough
+	Histogram& h = shard().hists[(stamp - 1) * serials.size() + cam];
+	atomic<uint64_t>& b = h.buckets[bucketOf(v)];
+	b.store(b.load(memory_order_relaxed) + 1, memory_order_relaxed);
+	h.sum.store(h.sum.load(memory_order_relaxed) + v, memory_order_relaxed);
+	if (v > h.max.load(memory_order_relaxed)){
+		h.max.store(v, memory_order_relaxed);
+	}
+}
+
+Metrics::Summary Metrics::summary(const FrameStamp stamp, const uint32_t serial) const {
+	const size_t cam = indexOf(serial);
+	return summarize(stamp, cam, cam == serials.size() ? cam : cam + 1);
+}
+
+Metrics::Summary Metrics::summary(const FrameStamp stamp) const {
+	return summarize(stamp, 0, serials.size());
+}
+
+/*
+merges the shards' histograms of cameras [first, last)
+*/
+Metrics::Summary Metrics::summarize(const FrameStamp stamp, const size_t first, const size_t last) const {
+	assert_throw(stamp > STAMP_TRIGGER && stamp < STAMPS);
+	Summary r;
+	r.count = 0;
+	r.sum = 0;
+	r.p50 = r.p99 = r.max = 0;
+
+	vector<uint64_t> buckets(HIST_BUCKETS, 0);
+	uint64_t sum = 0, mx = 0;
+	{
+		lock_guard<mutex> lock(mtx);
+		for (map<thread::id, Shard *>::const_iterator it = shards.begin(); it != shards.end(); it++){
+			for (size_t cam = first; cam < last; cam++){
+				const Histogram& h = it->second->hists[(stamp - 1) * serials.size() + cam];
+				for (int i = 0; i < HIST_BUCKETS; i++){
+					buckets[i] += h.buckets[i].load(memory_order_relaxed);
+				}
+				sum += h.sum.load(memory_order_relaxed);
+				mx = max(mx, h.max.load(memory_order_relaxed));
+			}
+		}
+	}
+	for (int i = 0; i < HIST_BUCKETS; i++){
+		r.count += buckets[i];
+	}
+	if (r.count == 0){
+		return r;
+	}
+
+	const double q[] = { .5, .99 };
+	double *p[] = { &r.p50, &r.p99 };
+	for (int k = 0; k < 2; k++){
+		const uint64_t rank = max<uint64_t>(1, uint64_t(ceil(q[k] * r.count)));
+		uint64_t seen = 0;
+		for (int i = 0; i < HIST_BUCKETS; i++){
+			seen += buckets[i];
+			if (seen >= rank){
+				*p[k] = min(bucketValue(i), mx) * 1e-9;
+				break;
+			}
+		}
+	}
+	r.sum = sum * 1e-9;
+	r.max = mx * 1e-9;
+	return r;
+}
+
+const char *Metrics::stageName(const FrameStamp stamp) {
+	switch (stamp){
+	case STAMP_TRIGGER:
+		return "trigger";
+	case STAMP_READ:
+		return "read";
+	case STAMP_DISPATCH:
+		return "dispatch";
+	case STAMP_WRITE:
+		return "write";
+	case STAMP_RENDER:
+		return "render";
+	default:
+		return "unknown";
+	}
+}
+
+void Metrics::dump(ostream& os) const {
+	stringstream ss;
+	ss << left << setw(10) << "stage" << setw(12) << "serial" << right << setw(10) << "count"
+		<< setw(10) << "p50 ms" << setw(10) << "p99 ms" << setw(10) << "max ms" << endl;
+	for (int stamp = STAMP_READ; stamp < STAMPS; stamp++){
+		for (size_t i = 0; i < serials.size(); i++){
+			const Summary s = summary(FrameStamp(stamp), serials[i]);
+			if (s.count == 0){
+				continue;
+			}
+			ss << left << setw(10) << stageName(FrameStamp(stamp)) << setw(12) << serials[i] << right
+				<< setw(10) << s.count << fixed << setprecision(3)
+				<< setw(10) << s.p50 * 1e3 << setw(10) << s.p99 * 1e3 << setw(10) << s.max * 1e3 << endl;
+		}
+	}
+	os << ss.str();
+}
+
+void Metrics::writePrometheus(const string& path) const {
+	const string tmp = path + ".tmp";
+	{
+		ofstream os(tmp.c_str());
+		if (!os){
+			throw runtime_error("could not open " + tmp + " for writing");
+		}
+		os << "# HELP camcap_stage_latency_seconds time a frame spent in a stage since the stage before it" << endl
+			<< "# TYPE camcap_stage_latency_seconds summary" << endl;
+		stringstream maxes;
+		maxes << "# HELP camcap_stage_latency_max_seconds longest time a frame spent in a stage" << endl
+			<< "# TYPE camcap_stage_latency_max_seconds gauge" << endl;
+		for (int stamp = STAMP_READ; stamp < STAMPS; stamp++){
+			for (size_t i = 0; i < serials.size(); i++){
+				const Summary s = summary(FrameStamp(stamp), serials[i]);
+				stringstream labels;
+				labels << "stage=\"" << stageName(FrameStamp(stamp)) << "\",serial=\"" << serials[i] << "\"";
+				os << "camcap_stage_latency_seconds{" << labels.str() << ",quantile=\"0.5\"} " << s.p50 << endl
+					<< "camcap_stage_latency_seconds{" << labels.str() << ",quantile=\"0.99\"} " << s.p99 << endl
+					<< "camcap_stage_latency_seconds_sum{" << labels.str() << "} " << s.sum << endl
+					<< "camcap_stage_latency_seconds_count{" << labels.str() << "} " << s.count << endl;
+				maxes << "camcap_stage_latency_max_seconds{" << labels.str() << "} " << s.max << endl;
+			}
+		}
+		os << maxes.str();
+		if (!os){
+			throw runtime_error("write to " + tmp + " failed");
+		}
+	}
+	boost::filesystem::rename(tmp, path);
+}
@@ -0,0 +1,108 @@
+#include "stdafx.h"
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include "TriggeredFrame.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+/*
+per stage and per camera latency histograms
+a stage's latency is the time between a frame's stamp for that stage and the
+stamp it follows: read after trigger, dispatch after read, write and render
+after dispatch. every recording thread owns a shard of histograms that only it
+writes, so record() takes no lock and the hot path stays at a few relaxed
+atomic operations. readers merge the shards
+
+histograms are log-linear like HDR histograms, every power of two nanoseconds
+is split into HIST_SUB buckets, so quantiles are within 1/HIST_SUB of the
+true value
+*/
+class Metrics {
+public:
+	struct Summary{
+		uint64_t count;
+		double sum, p50, p99, max; // seconds
+	};
+	Metrics(const std::vector<uint32_t>& serials);
+	~Metrics();
+	/*
+	records f.stamps[stamp] against the stamp it follows, frames missing either
+	stamp or from unknown cameras are ignored
+	*/
+	void
+		record(const FrameStamp stamp, const TriggeredFrame& f);
+	/*
+	same with `at` in place of f.stamps[stamp], for stages that only see frames
+	as const
+	*/
+	void
+		record(const FrameStamp stamp, const TriggeredFrame& f, const int64_t at);
+	void
+		record(const FrameStamp stamp, const uint32_t serial, const int64_t ns);
+	Summary
+		summary(const FrameStamp stamp, const uint32_t serial) const;
+	/*
+	the same over all cameras
+	*/
+	Summary
+		summary(const FrameStamp stamp) const;
+	/*
+	table of count, p50, p99 and max per stage and camera
+	*/
+	void
+		dump(std::ostream& os) const;
+	/*
+	the same in the Prometheus text format, replaced atomically so a scraper or
+	node_exporter's textfile collector never reads a partial file
+	*/
+	void
+		writePrometheus(const std::string& path) const;
+	static const char *
+		stageName(const FrameStamp stamp);
+private:
+	static const int HIST_SUB_BITS = 4;
+	static const int HIST_SUB = 1 << HIST_SUB_BITS;
+	static const int HIST_BUCKETS = 40 * HIST_SUB; // values below 2^43 ns, over two hours
+	struct Histogram{
+		Histogram();
+		std::atomic<uint64_t> buckets[HIST_BUCKETS];
+		std::atomic<uint64_t> sum;
+		std::atomic<uint64_t> max;
+	};
+	struct Shard{
+		Shard(const size_t n) :
+			hists(new Histogram[n]) {
+		}
+		~Shard() {
+			delete[] hists;
+		}
+		Histogram *hists; // (stamp - 1) * cameras + camera
+	};
+	Metrics(const Metrics&);
+	Metrics& operator=(const Metrics&);
+	Shard&
+		shard();
+	size_t
+		indexOf(const uint32_t serial) const;
+	Summary
+		summarize(const FrameStamp stamp, const size_t first, const size_t last) const;
+	static int
+		bucketOf(const uint64_t ns);
+	static uint64_t
+		bucketValue(const int bucket);
+
+	const std::vector<uint32_t> serials;
+	const uint64_t id; // tells thread caches of different instances apart
+	std::map<std::thread::id, Shard *> shards;
+	mutable std::mutex mtx; // guards shards, never taken by record() once a thread has its shard
+};
+
+#endif /* METRICS_H_ */
@@ -0,0 +1,296 @@
+#include "stdafx.h"
+
+#include "Normalize.h"
+#include "TriggeredCam.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <climits>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define NORMALIZE_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NORMALIZE_SSE2
+#endif
+
+using namespace std;
+using namespace cv;
+
+/*
+source index and the weights of both taps for every destination coordinate,
+mapped like cv::resize INTER_LINEAR
+*/
+static void linearTaps(const int dsize, const int ssize, vector<int>& ofs, vector<float>& alpha){
+	// inverted the way resize inverts its scale, so the taps agree to the last bit
+	const double scale = 1. / (double(dsize) / ssize);
+	ofs.resize(dsize);
+	alpha.resize(2 * size_t(dsize));
+	for (int d = 0; d < dsize; d++){
+		float f = float((d + 0.5) * scale - 0.5);
+		int s = int(floor(f));
+		f -= s;
+		if (s < 0){
+			s = 0;
+			f = 0;
+		}
+		if (s >= ssize - 1){
+			s = ssize - 1;
+			f = 0;
+		}
+		ofs[d] = s;
+		alpha[2 * d] = 1.f - f;
+		alpha[2 * d + 1] = f;
+	}
+}
+
+/*
+the same weights in the 11 bit fixed point cv::resize blends 8 bit frames with
+*/
+static void fixedTaps(const vector<float>& alpha, vector<short>& coef){
+	coef.resize(alpha.size());
+	for (size_t i = 0; i < alpha.size(); i++){
+		coef[i] = saturate_cast<short>(alpha[i] * 2048);
+	}
+}
+
+/*
+horizontal taps of one source row, float weights for 16 bit frames and fixed
+point ones for 8 bit
+*/
+template<typename T, typename WT, typename AT>
+static void hresize(const T *src, WT *dst, const int swidth, const int dwidth, const int cn,
+	const vector<int>& xofs, const vector<AT>& xalpha){
+	for (int dx = 0; dx < dwidth; dx++){
+		const int s0 = xofs[dx] * cn;
+		const int s1 = min(xofs[dx] + 1, swidth - 1) * cn;
+		const AT a0 = xalpha[2 * dx], a1 = xalpha[2 * dx + 1];
+		for (int c = 0; c < cn; c++){
+			dst[dx * cn + c] = src[s0 + c] * a0 + src[s1 + c] * a1;
+		}
+	}
+}
+
+/*
+vertical blend of two horizontally resized rows, rounded to ushort
+also tracks the row's min and max
+*/
+static void vresize(const float *r0, const float *r1, const float *beta, ushort *dst, const int n,
+	float& mn, float& mx){
+	const float b0 = beta[0], b1 = beta[1];
+	int i = 0;
+#if defined(NORMALIZE_AVX2)
+	__m256 vb0 = _mm256_set1_ps(b0), vb1 = _mm256_set1_ps(b1);
+	__m256 vmn = _mm256_set1_ps(mn), vmx = _mm256_set1_ps(mx);
+	for (; i <= n - 8; i += 8){
+		const __m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(r0 + i), vb0),
+			_mm256_mul_ps(_mm256_loadu_ps(r1 + i), vb1));
+		vmn = _mm256_min_ps(vmn, v);
+		vmx = _mm256_max_ps(vmx, v);
+		const __m256i iv = _mm256_cvtps_epi32(v);
+		const __m128i p = _mm_packus_epi32(_mm256_castsi256_si128(iv), _mm256_extracti128_si256(iv, 1));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), p);
+	}
+	float tmn[8], tmx[8];
+	_mm256_storeu_ps(tmn, vmn);
+	_mm256_storeu_ps(tmx, vmx);
+	for (int k = 0; k < 8; k++){
+		mn = min(mn, tmn[k]);
+		mx = max(mx, tmx[k]);
+	}
+#elif defined(NORMALIZE_SSE2)
+	const __m128 vb0 = _mm_set1_ps(b0), vb1 = _mm_set1_ps(b1);
+	const __m128i bias32 = _mm_set1_epi32(32768);
+	const __m128i bias16 = _mm_set1_epi16(short(0x8000));
+	__m128 vmn = _mm_set1_ps(mn), vmx = _mm_set1_ps(mx);
+	for (; i <= n - 8; i += 8){
+		const __m128 v0 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(r0 + i), vb0), _mm_mul_ps(_mm_loadu_ps(r1 + i), vb1));
+		const __m128 v1 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(r0 + i + 4), vb0), _mm_mul_ps(_mm_loadu_ps(r1 + i + 4), vb1));
+		vmn = _mm_min_ps(vmn, _mm_min_ps(v0, v1));
+		vmx = _mm_max_ps(vmx, _mm_max_ps(v0, v1));
+		// SSE2 has no unsigned 32->16 pack, shift into signed range and back
+		const __m128i i0 = _mm_sub_epi32(_mm_cvtps_epi32(v0), bias32);
+		const __m128i i1 = _mm_sub_epi32(_mm_cvtps_epi32(v1), bias32);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_xor_si128(_mm_packs_epi32(i0, i1), bias16));
+	}
+	float tmn[4], tmx[4];
+	_mm_storeu_ps(tmn, vmn);
+	_mm_storeu_ps(tmx, vmx);
+	for (int k = 0; k < 4; k++){
+		mn = min(mn, tmn[k]);
+		mx = max(mx, tmx[k]);
+	}
+#endif
+	for (; i < n; i++){
+		const float v = r0[i] * b0 + r1[i] * b1;
+		mn = min(mn, v);
+		mx = max(mx, v);
+		dst[i] = saturate_cast<ushort>(v);
+	}
+}
+
+/*
+vertical blend of two fixed point rows of an 8 bit frame, also tracks the row's
+min and max. the rows drop to 16 bit before the multiply and the products keep
+their high halves, the way cv::resize's SIMD path rounds them
+*/
+static void vresize(const int *r0, const int *r1, const short *beta, ushort *dst, const int n,
+	float& mn, float& mx){
+	const short b0 = beta[0], b1 = beta[1];
+	int lo = INT_MAX, hi = INT_MIN;
+	int i = 0;
+#if defined(NORMALIZE_AVX2) || defined(NORMALIZE_SSE2)
+	const __m128i vb0 = _mm_set1_epi16(b0), vb1 = _mm_set1_epi16(b1), delta = _mm_set1_epi16(2);
+	__m128i vmn = _mm_set1_epi16(SHRT_MAX), vmx = _mm_set1_epi16(SHRT_MIN);
+	for (; i <= n - 8; i += 8){
+		const __m128i x0 = _mm_packs_epi32(_mm_srai_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(r0 + i)), 4),
+			_mm_srai_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(r0 + i + 4)), 4));
+		const __m128i x1 = _mm_packs_epi32(_mm_srai_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(r1 + i)), 4),
+			_mm_srai_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(r1 + i + 4)), 4));
+		const __m128i v = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mulhi_epi16(x0, vb0), _mm_mulhi_epi16(x1, vb1)),
+			delta), 2);
+		vmn = _mm_min_epi16(vmn, v);
+		vmx = _mm_max_epi16(vmx, v);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), v);
+	}
+	short tmn[8], tmx[8];
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(tmn), vmn);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(tmx), vmx);
+	for (int k = 0; k < 8; k++){
+		lo = min(lo, int(tmn[k]));
+		hi = max(hi, int(tmx[k]));
+	}
+#endif
+	for (; i < n; i++){
+		const int v = ((((r0[i] >> 4) * b0) >> 16) + (((r1[i] >> 4) * b1) >> 16) + 2) >> 2;
+		lo = min(lo, v);
+		hi = max(hi, v);
+		dst[i] = saturate_cast<uchar>(v);
+	}
+	mn = min(mn, float(lo));
+	mx = max(mx, float(hi));
+}
+
+/*
+linear stretch to 8 bit with saturation
+*/
+static void stretch(const ushort *src, uchar *dst, const int n, const float alpha, const float beta){
+	int i = 0;
+#if defined(NORMALIZE_AVX2)
+	const __m256 va = _mm256_set1_ps(alpha), vb = _mm256_set1_ps(beta);
+	for (; i <= n - 16; i += 16){
+		const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+		const __m256 f0 = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(s)));
+		const __m256 f1 = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(s, 1)));
+		const __m256i i0 = _mm256_cvtps_epi32(_mm256_add_ps(_mm256_mul_ps(f0, va), vb));
+		const __m256i i1 = _mm256_cvtps_epi32(_mm256_add_ps(_mm256_mul_ps(f1, va), vb));
+		// packs works per 128 bit lane, restore element order before narrowing again
+		const __m256i p = _mm256_permute4x64_epi64(_mm256_packs_epi32(i0, i1), 0xD8);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+			_mm_packus_epi16(_mm256_castsi256_si128(p), _mm256_extracti128_si256(p, 1)));
+	}
+#elif defined(NORMALIZE_SSE2)
+	const __m128 va = _mm_set1_ps(alpha), vb = _mm_set1_ps(beta);
+	const __m128i zero = _mm_setzero_si128();
+	for (; i <= n - 8; i += 8){
+		const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+		const __m128 f0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(s, zero));
+		const __m128 f1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(s, zero));
+		const __m128i i0 = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(f0, va), vb));
+		const __m128i i1 = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(f1, va), vb));
+		const __m128i p = _mm_packs_epi32(i0, i1);
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(dst + i), _mm_packus_epi16(p, p));
+	}
+#endif
+	for (; i < n; i++){
+		dst[i] = saturate_cast<uchar>(src[i] * alpha + beta);
+	}
+}
+
+/*
+working buffers of one thread, they keep their capacity from frame to frame
+so a steady stream of previews doesn't allocate
+*/
+struct PreviewScratch{
+	vector<int> xofs, yofs;
+	vector<float> xalpha, yalpha;
+	vector<short> xcoef, ycoef;
+	vector<ushort> small;
+	vector<float> rowbuf;
+	vector<int> fixbuf;
+	vector<uchar> gray;
+};
+
+template<typename T, typename WT, typename AT>
+static void normalizePreview_(const Mat& src, Mat& dst, const Size& size, PreviewScratch& scratch,
+	const vector<AT>& xalpha, const vector<AT>& yalpha, vector<WT>& rowbuf){
+	const int cn = src.channels();
+	const int dw = size.width, dh = size.height, n = dw * cn;
+	const vector<int>& xofs = scratch.xofs, &yofs = scratch.yofs;
+
+	// pass 1: downsample into a 16 bit preview, tracking min and max
+	vector<ushort>& small = scratch.small;
+	small.resize(size_t(dh) * n);
+	rowbuf.resize(2 * size_t(n));
+	WT *rows[2] = { &rowbuf[0], &rowbuf[n] };
+	int rowIdx[2] = { -1, -1 };
+	float mn = FLT_MAX, mx = -FLT_MAX;
+	for (int dy = 0; dy < dh; dy++){
+		const int sy[2] = { yofs[dy], min(yofs[dy] + 1, src.rows - 1) };
+		if (rowIdx[0] != sy[0] && rowIdx[1] == sy[0]){
+			// window slid down by one source row, reuse it
+			swap(rows[0], rows[1]);
+			swap(rowIdx[0], rowIdx[1]);
+		}
+		for (int k = 0; k < 2; k++){
+			if (rowIdx[k] != sy[k]){
+				hresize(src.ptr<T>(sy[k]), rows[k], src.cols, dw, cn, xofs, xalpha);
+				rowIdx[k] = sy[k];
+			}
+		}
+		vresize(rows[0], rows[1], &yalpha[2 * size_t(dy)], &small[size_t(dy) * n], n, mn, mx);
+	}
+
+	// pass 2: stretch and expand to 3 channels
+	const double minVal = cvRound(mn), maxVal = cvRound(mx);
+	const float alpha = maxVal > minVal ? float(255. / (maxVal - minVal)) : 0.f;
+	const float beta = maxVal > minVal ? float(-255. * minVal / (maxVal - minVal)) : 0.f;
+	dst.create(size, CV_8UC3);
+	vector<uchar>& gray = scratch.gray;
+	gray.resize(cn == 1 ? dw : 0);
+	for (int dy = 0; dy < dh; dy++){
+		const ushort *s = &small[size_t(dy) * n];
+		uchar *d = dst.ptr<uchar>(dy);
+		if (cn == 3){
+			stretch(s, d, n, alpha, beta);
+		}
+		else{
+			stretch(s, &gray[0], dw, alpha, beta);
+			for (int x = 0; x < dw; x++){
+				d[3 * x] = d[3 * x + 1] = d[3 * x + 2] = gray[x];
+			}
+		}
+	}
+}
+
+void normalizePreview(const Mat& src, Mat& dst, const Size& size){
+	assert_throw(src.channels() == 1 || src.channels() == 3);
+	assert_throw(size.width > 0 && size.height > 0);
+	static thread_local PreviewScratch scratch;
+	linearTaps(size.width, src.cols, scratch.xofs, scratch.xalpha);
+	linearTaps(size.height, src.rows, scratch.yofs, scratch.yalpha);
+	switch (src.depth()){
+	case CV_8U:
+		// cv::resize blends 8 bit frames in fixed point, so does the preview
+		fixedTaps(scratch.xalpha, scratch.xcoef);
+		fixedTaps(scratch.yalpha, scratch.ycoef);
+		normalizePreview_<uchar>(src, dst, size, scratch, scratch.xcoef, scratch.ycoef, scratch.fixbuf);
+		break;
+	case CV_16U:
+		normalizePreview_<ushort>(src, dst, size, scratch, scratch.xalpha, scratch.yalpha, scratch.rowbuf);
+		break;
+	default:
+		throw runtime_error("only 8 or 16 bit unsigned frames supported");
+	}
+}
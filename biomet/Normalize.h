@@ -0,0 +1,23 @@
+#include "stdafx.h"
+
+#ifndef NORMALIZE_H_
+#define NORMALIZE_H_
+
+#include <opencv2/core/core.hpp>
+
+/*
+fused preview kernel for the display path
+bilinearly downsamples src to `size` (same sampling and rounding as
+cv::resize INTER_LINEAR, fixed point for 8 bit frames and float for 16 bit),
+expands gray to 3 channels and stretches [min, max] of the downsampled frame to
+[0, 255], in one pass over the source rows and one over the preview
+
+src is CV_8UC1, CV_8UC3, CV_16UC1 or CV_16UC3, dst becomes CV_8UC3 of `size`.
+the inner loops use AVX2 or SSE2 when the compiler targets them and scalar code
+otherwise, results match the resize/cvtColor/minMaxLoc/convertTo chain within
+1 LSB even on low contrast frames, where the stretch magnifies every rounding
+difference of the downsample (IPP's 16 bit resize rounds differently)
+*/
+void normalizePreview(const cv::Mat& src, cv::Mat& dst, const cv::Size& size);
+
+#endif /* NORMALIZE_H_ */
@@ -0,0 +1,381 @@
+#include "stdafx.h"
+
+#include "Pipeline.h"
+#include "Normalize.h"
+#include "Debayer.h"
+#include <opencv2/highgui/highgui.hpp>
+#include <boost/filesystem.hpp>
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+
+using namespace std;
+using namespace cv;
+
+PipelineConfig::PipelineConfig() :
+	fps(16), framecount(-1),
+	writer(2, 64, BLOCK), debayer(2, 8, DROP_OLDEST), normalizer(2, 8, DROP_OLDEST), renderer(1, 2, DROP_OLDEST),
+	ioBackend(IO_DIRECT), ioCodec(SEQ_CODEC_THERMAL), sync(SYNC_TIMESTAMP), syncToleranceMs(0), partialSets(true),
+	mosaic(960, 720), displayFps(10), window("stream"), previewSlots(4),
+	metricsDumpReports(10), supervision(), trigger() {
+}
+
+static vector<uint32_t> serialsOf(const vector<Ptr<TriggeredCam> >& cams){
+	assert_throw(!cams.empty());
+	vector<uint32_t> serials;
+	for (size_t i = 0; i < cams.size(); i++){
+		serials.push_back(cams[i]->serial);
+	}
+	return serials;
+}
+
+/*
+near square grid, wider than high
+*/
+static int gridColsFor(const size_t cams){
+	return int(ceil(sqrt(double(cams))));
+}
+
+static int gridRowsFor(const size_t cams){
+	return int(ceil(double(cams) / gridColsFor(cams)));
+}
+
+/*
+largest size of the frame's aspect that fits into the tile
+*/
+static Size fitted(const Size& frame, const Size& tile){
+	const double scale = min(double(tile.width) / frame.width, double(tile.height) / frame.height);
+	return Size(max(1, min(tile.width, int(round(frame.width * scale)))),
+		max(1, min(tile.height, int(round(frame.height * scale)))));
+}
+
+static chrono::steady_clock::duration syncTolerance(const PipelineConfig& config, const double fps){
+	const double ms = config.syncToleranceMs > 0 ? config.syncToleranceMs : 250. / fps;
+	return chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double, milli>(ms));
+}
+
+/*
+prints queue counters of a stage
+*/
+static void printStage(ostream& os, const string& name, const StageStats& st){
+	stringstream ss;
+	ss << name << " queued: " << st.queued << " dropped: " << st.dropped
+		<< " processed: " << st.processed << " failed: " << st.failed << " depth: " << st.depth << "/" << st.maxDepth << endl;
+	os << ss.str();
+}
+
+Pipeline::Pipeline(const vector<Ptr<TriggeredCam> >& cams, const string& basePath,
+	const PipelineConfig& config, const vector<CamOpener>& openers) :
+	config(config),
+	metricsPath((boost::filesystem::path(basePath) / "metrics.prom").string()),
+	serials(serialsOf(cams)),
+	gridCols(gridColsFor(serials.size())), gridRows(gridRowsFor(serials.size())),
+	tile(config.mosaic.width / gridCols, config.mosaic.height / gridRows),
+	displayStride(stride(config.fps)), displayed(0), displaySkipped(0),
+	stageMetrics(serials),
+	previews(config.previewRing.empty() ? NULL
+		: new PreviewPublisher(config.previewRing, serials, tile, config.previewSlots)),
+	writer(basePath, config.writer, config.ioBackend, config.ioCodec),
+	synchronizer(serials, 8, chrono::milliseconds(500), config.sync, syncTolerance(config, config.fps), config.partialSets),
+	renderer(g, "renderer", config.renderer, [this](const FrameSetPtr& fs){ render(*fs); }),
+	normalizer(g, "normalizer", config.normalizer, [this](const TriggeredFrame& f){ normalize(f); }),
+	debayerStage(g, "debayer", config.debayer, [this](const TriggeredFrame& f){ debayer(f); }),
+	engine(cams, config.fps, config.framecount, 4, openers, config.supervision, config.trigger),
+	stopped(false), reported(0), reports(0) {
+	assert_throw(tile.width > 0 && tile.height > 0);
+	// fed from graph bodies, which must not wait for room
+	assert_throw(config.normalizer.policy == DROP_OLDEST && config.renderer.policy == DROP_OLDEST);
+	writer.setMetrics(&stageMetrics);
+	// as many buffers as frames can be held at once: demosaiced ones queued and
+	// running in the normalizer, previews in every pooled set and being made
+	for (size_t i = 0; i < serials.size(); i++){
+		bgrPools.push_back(unique_ptr<FramePool>(new FramePool(config.normalizer.capacity
+			+ config.normalizer.concurrency + config.debayer.concurrency)));
+		previewPools.push_back(unique_ptr<FramePool>(new FramePool(synchronizer.setPool().capacity()
+			+ config.normalizer.concurrency)));
+	}
+}
+
+Pipeline::~Pipeline() {
+	try{
+		stop();
+	}
+	catch (const exception& e){
+		cerr << __FILE__ << "[" << __LINE__ << "] " << e.what() << endl;
+	}
+}
+
+void Pipeline::start(const uint64_t flags) {
+	engine.setFlags(flags);
+	reportedAt = Clock::now();
+	engine.start([this](const TriggeredFrame& f){ dispatch(f); });
+}
+
+void Pipeline::setFlags(const uint64_t flags) {
+	engine.setFlags(flags);
+}
+
+/*
+every how many ticks a frame goes down the display branch, by frame number so
+that all cameras pick the same ticks and sets stay complete
+*/
+int Pipeline::stride(const double fps) const {
+	if (config.displayFps <= 0 || config.displayFps >= fps){
+		return 1;
+	}
+	return max(1, int(round(fps / config.displayFps)));
+}
+
+void Pipeline::setFps(const double fps) {
+	displayStride = stride(fps);
+	engine.setFps(fps);
+	synchronizer.setTolerance(syncTolerance(config, fps));
+}
+
+bool Pipeline::done() const {
+	return engine.done();
+}
+
+void Pipeline::stop() {
+	if (stopped){
+		return;
+	}
+	stopped = true;
+	engine.stop();
+	g.wait_for_all();
+	writer.close();
+	stageMetrics.writePrometheus(metricsPath);
+}
+
+uint64_t Pipeline::frames() const {
+	return engine.frames();
+}
+
+/*
+dispatches triggered frames to stages for further processing based on flags
+runs on the acquisition pump, so a blocking stage pushes back on the camera rings
+*/
+void Pipeline::dispatch(const TriggeredFrame& f) {
+	try{
+		stageMetrics.record(STAMP_READ, f);
+		stageMetrics.record(STAMP_DISPATCH, f);
+		if (f.flags & FRAME_SAVE){
+			writer.put(f);
+		}
+		if ((f.flags & FRAME_DISPLAY) && f.frame_no % displayStride != 0){
+			// skipped before any demosaicing or normalization
+			displaySkipped++;
+		}
+		else if (f.flags & FRAME_DISPLAY){
+			displayed++;
+			if (f.bayer != BAYER_NONE){
+				debayerStage.put(f);
+			}
+			else{
+				normalizer.put(f);
+			}
+		}
+	}
+	catch (const exception& e){
+		cerr << __FILE__ << "[" << __LINE__ << "] " << e.what() << endl;
+		throw;
+	}
+}
+
+/*
+demosaics raw frames for display, each frame is split across the worker pool
+*/
+void Pipeline::debayer(const TriggeredFrame& f) {
+	try{
+		TriggeredFrame fbgr = f;
+		Mat bgr = bgrPools[synchronizer.indexOf(f.serial)]->acquire(f.frame.rows, f.frame.cols, CV_8UC3);
+		demosaic(f.frame, f.bayer, bgr);
+		fbgr.frame = bgr;
+		fbgr.bayer = BAYER_NONE;
+		normalizer.put(fbgr);
+	}
+	catch (const exception& e){
+		cerr << __FILE__ << "[" << __LINE__ << "] " << e.what() << endl;
+		throw;
+	}
+}
+
+/*
+normalizes triggered frames for rendering and groups them by frame number
+*/
+void Pipeline::normalize(const TriggeredFrame& f) {
+	try{
+		TriggeredFrame fnorm = f;
+		const Size size = fitted(f.frame.size(), tile);
+		Mat preview = previewPools[synchronizer.indexOf(f.serial)]->acquire(size.height, size.width, CV_8UC3);
+		normalizePreview(f.frame, preview, size);
+		fnorm.frame = preview;
+		if (previews){
+			previews->publish(fnorm);
+		}
+		synchronizer.put(fnorm, [this](const FrameSetPtr& fs){
+			renderer.put(fs);
+		});
+	}
+	catch (const exception& e){
+		cerr << __FILE__ << "[" << __LINE__ << "] " << e.what() << endl;
+		throw;
+	}
+}
+
+/*
+rendering of triggered frames with same frame number, tiled on a near square grid
+sized to the window, each preview centered in its tile. cameras missing from a
+partial set show as a grey tile. without a window the mosaic isn't built,
+viewers of the preview ring tile for themselves
+*/
+void Pipeline::render(const FrameSet& fs) {
+	try{
+		if (config.window.empty()){
+			const int64_t rendered = TriggeredFrame::now();
+			for (size_t i = 0; i < fs.size(); i++){
+				stageMetrics.record(STAMP_RENDER, fs[i], rendered);
+			}
+			return;
+		}
+		size_t ref = 0;
+		while (ref < fs.size() && fs[ref].frame.empty()){
+			ref++;
+		}
+		assert_throw(ref < fs.size() && fs.size() == serials.size());
+		// reused, only the borders of tiles that previews don't fill are cleared
+		mosaic.create(gridRows * tile.height, gridCols * tile.width, CV_8UC3);
+		for (size_t i = 0; i < fs.size(); i++){
+			const int r = int(i) / gridCols, c = int(i) % gridCols;
+			Mat cell = mosaic(Rect(c * tile.width, r * tile.height, tile.width, tile.height));
+			const Mat& preview = fs[i].frame;
+			if (preview.empty()){
+				cell.setTo(Scalar::all(64));
+				continue;
+			}
+			if (preview.size() != tile){
+				cell.setTo(Scalar::all(0));
+			}
+			preview.copyTo(cell(Rect((tile.width - preview.cols) / 2, (tile.height - preview.rows) / 2,
+				preview.cols, preview.rows)));
+		}
+
+		imshow(config.window, mosaic);
+		stringstream ss;
+		ss << "RENDER: " << fs[ref].frame_no << endl;
+		cerr << ss.str();
+		const int64_t rendered = TriggeredFrame::now();
+		for (size_t i = 0; i < fs.size(); i++){
+			stageMetrics.record(STAMP_RENDER, fs[i], rendered);
+		}
+	}
+	catch (const exception& e){
+		cerr << __FILE__ << "[" << __LINE__ << "] " << e.what() << endl;
+		throw;
+	}
+}
+
+void Pipeline::printStages(ostream& os) const {
+	const vector<pair<string, StageStats> > stages = stageStats();
+	for (size_t i = 0; i < stages.size(); i++){
+		printStage(os, stages[i].first, stages[i].second);
+	}
+}
+
+void Pipeline::report(ostream& os) {
+	const Clock::time_point now = Clock::now();
+	const uint64_t n = engine.frames();
+	const double s = chrono::duration<double>(now - reportedAt).count();
+	stringstream ss;
+	ss << n / serials.size() << " fps: " << (n - reported) / double(serials.size()) / s << endl;
+	os << ss.str();
+	printStages(os);
+	if (++reports % config.metricsDumpReports == 0){
+		stageMetrics.dump(os);
+	}
+	try{
+		stageMetrics.writePrometheus(metricsPath);
+	}
+	catch (const exception& e){
+		cerr << __FILE__ << "[" << __LINE__ << "] " << e.what() << endl;
+	}
+	reported = n;
+	reportedAt = now;
+}
+
+void Pipeline::summary(ostream& os) const {
+	const vector<AcquisitionEngine::CamStats> stats = engine.stats();
+	stringstream ss;
+	for (size_t i = 0; i < stats.size(); i++){
+		ss << stats[i].serial << " read: " << stats[i].read << " failed: " << stats[i].failed
+			<< " skipped: " << stats[i].skipped << " dropped: " << stats[i].dropped
+			<< " unpooled: " << stats[i].unpooled << endl;
+		const CamSupervisor::Stats& h = stats[i].health;
+		if (h.disconnects > 0){
+			ss << stats[i].serial << (h.up ? " up" : " down") << " disconnects: " << h.disconnects
+				<< " reconnects: " << h.reconnects << "/" << h.attempts << " down: " << fixed << setprecision(1)
+				<< h.downSeconds << " s availability: " << setprecision(4) << h.availability << endl;
+			ss.unsetf(ios::floatfield);
+		}
+		const TriggerScheduler::Stats& t = stats[i].timing;
+		ss << stats[i].serial << " trigger late p50: " << t.percentileUs(.5) << " us p99: " << t.percentileUs(.99)
+			<< " us max: " << fixed << setprecision(0) << t.maxUs << " us missed: " << t.missed << "/" << t.fired << endl;
+		ss.unsetf(ios::floatfield);
+	}
+	ss << "display: " << displayed << " frames, " << displaySkipped << " skipped for the display rate" << endl;
+	ss << "unpooled buffers and sets: " << overflows() << endl;
+	os << ss.str();
+	printStages(os);
+	const FrameSynchronizer::Stats sync = synchronizer.stats();
+	ss.str("");
+	ss << "sets completed: " << sync.completed << " partial: " << sync.partial
+		<< " expired: " << sync.expired << " late: " << sync.late << endl;
+	const vector<uint64_t> misses = synchronizer.misses();
+	for (size_t i = 0; i < misses.size(); i++){
+		ss << serials[i] << " missing from sets: " << misses[i] << endl;
+	}
+	const vector<FrameSynchronizer::PairSkew> skew = synchronizer.skew();
+	for (size_t i = 0; i < skew.size(); i++){
+		ss << "skew " << skew[i].first << "-" << skew[i].second << " mean: " << fixed << setprecision(3)
+			<< skew[i].mean * 1e3 << " ms max: " << skew[i].maxAbs * 1e3 << " ms over " << skew[i].count << " sets" << endl;
+	}
+	os << ss.str();
+	stageMetrics.dump(os);
+}
+
+vector<AcquisitionEngine::CamStats> Pipeline::camStats() const {
+	return engine.stats();
+}
+
+FrameSynchronizer::Stats Pipeline::syncStats() const {
+	return synchronizer.stats();
+}
+
+vector<pair<string, StageStats> > Pipeline::stageStats() const {
+	vector<pair<string, StageStats> > r;
+	r.push_back(make_pair(writer.name, writer.stats()));
+	r.push_back(make_pair(debayerStage.name, debayerStage.stats()));
+	r.push_back(make_pair(normalizer.name, normalizer.stats()));
+	r.push_back(make_pair(renderer.name, renderer.stats()));
+	return r;
+}
+
+const Metrics& Pipeline::metrics() const {
+	return stageMetrics;
+}
+
+uint64_t Pipeline::allocations() const {
+	uint64_t n = synchronizer.setPool().allocations();
+	for (size_t i = 0; i < serials.size(); i++){
+		n += bgrPools[i]->allocations() + previewPools[i]->allocations();
+	}
+	return n;
+}
+
+uint64_t Pipeline::overflows() const {
+	uint64_t n = synchronizer.setPool().overflows();
+	for (size_t i = 0; i < serials.size(); i++){
+		n += bgrPools[i]->overflows() + previewPools[i]->overflows();
+	}
+	return n;
+}
@@ -0,0 +1,171 @@
+#include "stdafx.h"
+
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include "TriggeredCam.h"
+#include "TriggeredFrame.h"
+#include "Acquisition.h"
+#include "Synchronizer.h"
+#include "FrameSet.h"
+#include "FramePool.h"
+#include "Stage.h"
+#include "IoWriter.h"
+#include "Metrics.h"
+#include "PreviewRing.h"
+#include <tbb/flow_graph.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <chrono>
+#include <memory>
+#include <atomic>
+
+/*
+what happens to an acquired frame, any combination
+*/
+typedef enum
+{
+	FRAME_DISPLAY = 2ULL,
+	FRAME_SAVE = 4ULL
+} FrameFlags;
+
+struct PipelineConfig{
+	PipelineConfig();
+	double fps;
+	int framecount; // < 0 runs until stop()
+	// saving pushes back on acquisition, display keeps only the newest frames
+	StageConfig writer; // concurrency is the number of I/O threads
+	StageConfig debayer;
+	StageConfig normalizer; // fed from debayer bodies, DROP_OLDEST only
+	StageConfig renderer;   // fed from normalizer bodies, DROP_OLDEST only
+	IoBackendType ioBackend;
+	SequenceCodec ioCodec;
+	SyncMode sync;          // how frames are matched into mosaics
+	double syncToleranceMs; // SYNC_TIMESTAMP window, 0 is a quarter of the frame period
+	bool partialSets;       // mosaics missing a camera are shown with a placeholder tile instead of dropped
+	cv::Size mosaic;        // the mosaic's window, split into a tile per camera
+	double displayFps;      // rate of the display branch, frames in between skip it, 0 displays every frame
+	std::string window;     // imshow window of the mosaic, empty only stamps the sets as rendered
+	std::string previewRing; // shared memory the previews are published to for viewers, empty for none
+	int previewSlots;        // of every camera's ring
+	int metricsDumpReports; // report() prints the latency table every this many calls
+	SupervisorConfig supervision; // when cameras given with openers are reconnected
+	TriggerConfig trigger;        // how precisely triggers are timed
+};
+
+/*
+the capture graph for a set of cameras
+acquisition -> dispatch -> writer                            (FRAME_SAVE)
+                        -> [debayer] -> normalizer -> synchronizer -> renderer (FRAME_DISPLAY)
+                                                   -> preview ring (previewRing set)
+frames travel as references to pooled buffers: raw frames from the cameras'
+pools, demosaiced frames and previews from per camera pools of the pipeline,
+sets from the synchronizer's pool. once every pool is warm the graph captures
+without allocating per frame
+sequences and metrics.prom are written to basePath
+with an opener per camera a camera that stops answering is reopened while the
+others keep running, the pipeline should then hold the only references to cams
+*/
+class Pipeline {
+public:
+	Pipeline(const std::vector<cv::Ptr<TriggeredCam> >& cams, const std::string& basePath,
+		const PipelineConfig& config = PipelineConfig(),
+		const std::vector<CamOpener>& openers = std::vector<CamOpener>());
+	~Pipeline();
+	void
+		start(const uint64_t flags);
+	void
+		setFlags(const uint64_t flags);
+	/*
+	changes the trigger rate while capturing, along with the sync window when
+	that follows the frame period and the display stride
+	*/
+	void
+		setFps(const double fps);
+	bool
+		done() const;
+	/*
+	stops acquisition, lets every stage drain and closes the sequence files
+	*/
+	void
+		stop();
+	/*
+	frames acquired across all cameras
+	*/
+	uint64_t
+		frames() const;
+	/*
+	rate since the last call and stage counters, the latency table every
+	config.metricsDumpReports calls, and rewrites metrics.prom
+	*/
+	void
+		report(std::ostream& os);
+	/*
+	final camera, availability, trigger timing, stage, synchronizer, skew and
+	latency counters
+	*/
+	void
+		summary(std::ostream& os) const;
+	std::vector<AcquisitionEngine::CamStats>
+		camStats() const;
+	FrameSynchronizer::Stats
+		syncStats() const;
+	std::vector<std::pair<std::string, StageStats> >
+		stageStats() const;
+	const Metrics&
+		metrics() const;
+	/*
+	buffers and sets the display branch allocated so far, stays put once its
+	pools are warm unless a stage holds on to more than they were sized for
+	*/
+	uint64_t
+		allocations() const;
+	/*
+	of those, the ones handed out unpooled because every pooled one was held
+	*/
+	uint64_t
+		overflows() const;
+private:
+	typedef std::chrono::steady_clock Clock;
+	Pipeline(const Pipeline&);
+	Pipeline& operator=(const Pipeline&);
+	void
+		dispatch(const TriggeredFrame& f);
+	void
+		debayer(const TriggeredFrame& f);
+	void
+		normalize(const TriggeredFrame& f);
+	void
+		render(const FrameSet& fs);
+	void
+		printStages(std::ostream& os) const;
+	int
+		stride(const double fps) const;
+
+	const PipelineConfig config;
+	const std::string metricsPath;
+	std::vector<uint32_t> serials;
+	const int gridCols, gridRows;
+	const cv::Size tile; // a camera's cell of the mosaic, previews are fitted into it
+	std::atomic<int> displayStride; // ticks between frames sent down the display branch
+	std::atomic<uint64_t> displayed, displaySkipped;
+	cv::Mat mosaic; // renderer only
+	std::vector<std::unique_ptr<FramePool> > bgrPools, previewPools; // per camera, by synchronizer index
+	Metrics stageMetrics;
+	std::unique_ptr<PreviewPublisher> previews;
+	tbb::flow::graph g;
+	IoWriter writer;
+	FrameSynchronizer synchronizer;
+	BoundedStage<FrameSetPtr> renderer;
+	BoundedStage<TriggeredFrame> normalizer;
+	BoundedStage<TriggeredFrame> debayerStage;
+	AcquisitionEngine engine;
+	bool stopped;
+	uint64_t reported;
+	int reports;
+	Clock::time_point reportedAt;
+};
+
+#endif /* PIPELINE_H_ */
@@ -0,0 +1,165 @@
+#include "stdafx.h"
+
+#include "PreviewRing.h"
+#include "TriggeredCam.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+using namespace cv;
+using namespace PreviewRingLayout;
+namespace bip = boost::interprocess;
+
+static size_t aligned(const size_t n){
+	return (n + ALIGN - 1) / ALIGN * ALIGN;
+}
+
+static size_t camsOffset(){
+	return aligned(sizeof(Header));
+}
+
+static size_t slotsOffset(const size_t cams){
+	return camsOffset() + cams * aligned(sizeof(CamHeader));
+}
+
+PreviewPublisher::PreviewPublisher(const string& name, const vector<uint32_t>& serials, const Size& preview,
+	const int slots) :
+	name(name), serials(serials) {
+	assert_throw(!name.empty() && !serials.empty() && slots > 1);
+	assert_throw(preview.width > 0 && preview.height > 0);
+	// left behind by a capture that died
+	bip::shared_memory_object::remove(name.c_str());
+	shm = bip::shared_memory_object(bip::create_only, name.c_str(), bip::read_write);
+	const uint64_t slotBytes = aligned(sizeof(SlotHeader)) + aligned(size_t(preview.area()) * 3);
+	const size_t size = slotsOffset(serials.size()) + serials.size() * slots * slotBytes;
+	shm.truncate(bip::offset_t(size));
+	region = bip::mapped_region(shm, bip::read_write);
+
+	char *base = static_cast<char *>(region.get_address());
+	memset(base, 0, size);
+	Header *header = reinterpret_cast<Header *>(base);
+	header->magic = MAGIC;
+	header->version = VERSION;
+	header->cams = uint32_t(serials.size());
+	header->slots = uint32_t(slots);
+	header->rows = preview.height;
+	header->cols = preview.width;
+	header->type = CV_8UC3;
+	header->slotBytes = slotBytes;
+	header->closed = 0;
+	for (size_t i = 0; i < serials.size(); i++){
+		CamHeader *cam = reinterpret_cast<CamHeader *>(base + camsOffset() + i * aligned(sizeof(CamHeader)));
+		cam->serial = serials[i];
+		cam->published = 0;
+		writers.push_back(unique_ptr<mutex>(new mutex()));
+	}
+}
+
+PreviewPublisher::~PreviewPublisher() {
+	reinterpret_cast<Header *>(region.get_address())->closed.store(1, memory_order_release);
+	// open mappings stay valid, viewers see closed and let go
+	bip::shared_memory_object::remove(name.c_str());
+}
+
+void PreviewPublisher::publish(const TriggeredFrame& f) {
+	const vector<uint32_t>::const_iterator it = find(serials.begin(), serials.end(), f.serial);
+	assert_throw(it != serials.end());
+	const size_t i = it - serials.begin();
+	char *base = static_cast<char *>(region.get_address());
+	const Header *header = reinterpret_cast<const Header *>(base);
+	assert_throw(f.frame.rows <= header->rows && f.frame.cols <= header->cols && f.frame.type() == header->type);
+	CamHeader *cam = reinterpret_cast<CamHeader *>(base + camsOffset() + i * aligned(sizeof(CamHeader)));
+
+	lock_guard<mutex> lock(*writers[i]);
+	const uint64_t n = cam->published.load(memory_order_relaxed);
+	char *s = base + slotsOffset(header->cams) + (i * header->slots + n % header->slots) * header->slotBytes;
+	SlotHeader *slot = reinterpret_cast<SlotHeader *>(s);
+	const uint32_t seq = slot->seq.load(memory_order_relaxed);
+	slot->seq.store(seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	slot->frame_no = f.frame_no;
+	slot->rows = f.frame.rows;
+	slot->cols = f.frame.cols;
+	slot->captured = f.captured;
+	Mat pixels(slot->rows, slot->cols, header->type, s + aligned(sizeof(SlotHeader)));
+	f.frame.copyTo(pixels);
+	slot->seq.store(seq + 2, memory_order_release);
+	cam->published.store(n + 1, memory_order_release);
+}
+
+PreviewReader::PreviewReader(const string& name) :
+	shm(bip::open_only, name.c_str(), bip::read_only),
+	region(shm, bip::read_only),
+	header(static_cast<const Header *>(region.get_address())) {
+	if (region.get_size() < sizeof(Header) || header->magic != MAGIC || header->version != VERSION){
+		throw runtime_error(name + " is not a preview ring of this version");
+	}
+	assert_throw(region.get_size() >= slotsOffset(header->cams) + header->cams * header->slots * header->slotBytes);
+}
+
+size_t PreviewReader::cams() const {
+	return header->cams;
+}
+
+static const CamHeader *camHeader(const Header *header, const size_t cam){
+	assert_throw(cam < header->cams);
+	return reinterpret_cast<const CamHeader *>(reinterpret_cast<const char *>(header) + camsOffset()
+		+ cam * aligned(sizeof(CamHeader)));
+}
+
+uint32_t PreviewReader::serial(const size_t cam) const {
+	return camHeader(header, cam)->serial;
+}
+
+uint64_t PreviewReader::published(const size_t cam) const {
+	return camHeader(header, cam)->published.load(memory_order_acquire);
+}
+
+const SlotHeader *PreviewReader::slot(const size_t cam, const uint64_t index) const {
+	return reinterpret_cast<const SlotHeader *>(reinterpret_cast<const char *>(header) + slotsOffset(header->cams)
+		+ (cam * header->slots + index) * header->slotBytes);
+}
+
+bool PreviewReader::latest(const size_t cam, Mat& view, uint64_t& token, int& frame_no) const {
+	while (true){
+		const uint64_t n = published(cam);
+		if (n == 0){
+			return false;
+		}
+		const uint64_t index = (n - 1) % header->slots;
+		const SlotHeader *s = slot(cam, index);
+		const uint32_t seq = s->seq.load(memory_order_acquire);
+		if (seq & 1){
+			// lapped while the capture writes it again, the next one is newer anyway
+			continue;
+		}
+		frame_no = s->frame_no;
+		view = Mat(min(s->rows, header->rows), min(s->cols, header->cols), header->type,
+			const_cast<char *>(reinterpret_cast<const char *>(s)) + aligned(sizeof(SlotHeader)));
+		token = index << 32 | seq;
+		if (check(cam, token)){
+			return true;
+		}
+	}
+}
+
+bool PreviewReader::check(const size_t cam, const uint64_t token) const {
+	atomic_thread_fence(memory_order_acquire);
+	return slot(cam, token >> 32)->seq.load(memory_order_relaxed) == uint32_t(token);
+}
+
+bool PreviewReader::copy(const size_t cam, Mat& frame, int& frame_no) const {
+	Mat view;
+	uint64_t token;
+	do{
+		if (!latest(cam, view, token, frame_no)){
+			return false;
+		}
+		view.copyTo(frame);
+	} while (!check(cam, token));
+	return true;
+}
+
+bool PreviewReader::closed() const {
+	return header->closed.load(memory_order_acquire) != 0;
+}
@@ -0,0 +1,126 @@
+#include "stdafx.h"
+
+#ifndef PREVIEWRING_H_
+#define PREVIEWRING_H_
+
+#include "TriggeredFrame.h"
+#include <opencv2/core/core.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <atomic>
+
+/*
+preview frames of every camera in a named shared memory segment, for viewers
+in other processes. each camera has a ring of slots guarded by a seqlock: the
+slot's sequence is odd while the capture writes it and moves on by two once
+the frame is in, so a reader that sees the same even sequence before and after
+looking at a slot knows it wasn't overwritten meanwhile. viewers map the
+segment read-only, they can't take a lock, write or otherwise hold up the
+capture, only fall behind and skip frames
+
+layout: Header, a CamHeader per camera, then cams * slots slots of a
+SlotHeader followed by up to rows * cols of type, every part on a cache line
+*/
+namespace PreviewRingLayout{
+	static const uint32_t MAGIC = 0x56455250; // "PREV"
+	static const uint32_t VERSION = 2;
+	static const size_t ALIGN = 64;
+	struct Header{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t cams, slots;
+		int32_t rows, cols, type; // the largest frame a slot holds
+		uint64_t slotBytes;  // SlotHeader and pixels, aligned
+		std::atomic<uint32_t> closed; // the capture is gone, viewers should reopen
+	};
+	struct CamHeader{
+		uint32_t serial;
+		std::atomic<uint64_t> published; // frames published, the newest is in slot (published - 1) % slots
+	};
+	struct SlotHeader{
+		std::atomic<uint32_t> seq;
+		int32_t frame_no;
+		int32_t rows, cols; // of the frame in the slot, previews keep their camera's aspect
+		int64_t captured; // ns on the capture host's monotonic clock
+	};
+}
+
+/*
+the capture's side, creates the segment and replaces a stale one of the same name
+*/
+class PreviewPublisher {
+public:
+	/*
+	frames are CV_8UC3 previews of at most preview, see normalizePreview
+	*/
+	PreviewPublisher(const std::string& name, const std::vector<uint32_t>& serials, const cv::Size& preview,
+		const int slots = 4);
+	~PreviewPublisher();
+	/*
+	copies a preview frame of one of the cameras into its next slot, never waits on a viewer
+	*/
+	void
+		publish(const TriggeredFrame& f);
+private:
+	PreviewPublisher(const PreviewPublisher&);
+	PreviewPublisher& operator=(const PreviewPublisher&);
+
+	const std::string name;
+	std::vector<uint32_t> serials;
+	boost::interprocess::shared_memory_object shm;
+	boost::interprocess::mapped_region region;
+	std::vector<std::unique_ptr<std::mutex> > writers; // a camera's frames can be normalized concurrently
+};
+
+/*
+a viewer's read-only mapping of the segment
+*/
+class PreviewReader {
+public:
+	/*
+	throws while no capture publishes under name
+	*/
+	PreviewReader(const std::string& name);
+	size_t
+		cams() const;
+	uint32_t
+		serial(const size_t cam) const;
+	/*
+	frames published for cam so far
+	*/
+	uint64_t
+		published(const size_t cam) const;
+	/*
+	the newest frame of cam, without copying: view points into the segment and
+	stays good until check(cam, token) says otherwise, so look at the frame
+	first and check afterwards. false when nothing was published yet
+	*/
+	bool
+		latest(const size_t cam, cv::Mat& view, uint64_t& token, int& frame_no) const;
+	/*
+	true when the frame handed out with token wasn't touched since
+	*/
+	bool
+		check(const size_t cam, const uint64_t token) const;
+	/*
+	copies the newest frame of cam, retrying torn reads, false when nothing was published
+	*/
+	bool
+		copy(const size_t cam, cv::Mat& frame, int& frame_no) const;
+	bool
+		closed() const;
+private:
+	const PreviewRingLayout::SlotHeader *
+		slot(const size_t cam, const uint64_t n) const;
+
+	boost::interprocess::shared_memory_object shm;
+	boost::interprocess::mapped_region region;
+	const PreviewRingLayout::Header *header;
+};
+
+#endif /* PREVIEWRING_H_ */
@@ -0,0 +1,350 @@
+#include "stdafx.h"
+
+#include "RigConfig.h"
+#include "SimulatedCam.h"
+#include "Calibration.h"
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/optional.hpp>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <set>
+#include <map>
+
+using namespace std;
+using namespace cv;
+using boost::property_tree::ptree;
+
+/*
+collects every problem of a rig file instead of stopping at the first one
+*/
+class RigErrors {
+public:
+	void
+		add(const string& where, const string& what) {
+		errors.push_back(where + ": " + what);
+	}
+	void
+		check(const bool ok, const string& where, const string& what) {
+		if (!ok){
+			add(where, what);
+		}
+	}
+	/*
+	keys of node that aren't in known, most likely typos
+	*/
+	void
+		unknown(const ptree& node, const string& where, const set<string>& known) {
+		for (ptree::const_iterator it = node.begin(); it != node.end(); it++){
+			if (!known.count(it->first)){
+				add(where + it->first, "unknown key");
+			}
+		}
+	}
+	/*
+	value of key in node, fallback when it is missing or malformed
+	*/
+	template <class T>
+	T
+		get(const ptree& node, const string& where, const string& key, const T& fallback,
+		const bool required = false) {
+		const boost::optional<const ptree&> child = node.get_child_optional(ptree::path_type(key, '/'));
+		if (!child){
+			check(!required, where + key, "missing");
+			return fallback;
+		}
+		const boost::optional<T> v = child->get_value_optional<T>();
+		if (!v || !child->empty()){
+			add(where + key, "malformed value '" + child->data() + "'");
+			return fallback;
+		}
+		return *v;
+	}
+	template <class E>
+	E
+		named(const ptree& node, const string& where, const string& key, const E fallback,
+		const map<string, E>& names) {
+		if (!node.get_child_optional(ptree::path_type(key, '/'))){
+			return fallback;
+		}
+		const string name = get<string>(node, where, key, "");
+		const typename map<string, E>::const_iterator it = names.find(name);
+		if (it == names.end()){
+			string expected;
+			for (typename map<string, E>::const_iterator n = names.begin(); n != names.end(); n++){
+				expected += (expected.empty() ? "" : ", ") + n->first;
+			}
+			add(where + key, "'" + name + "' is none of " + expected);
+			return fallback;
+		}
+		return it->second;
+	}
+	void
+		raise() const {
+		if (errors.empty()){
+			return;
+		}
+		stringstream ss;
+		ss << errors.size() << " error(s)";
+		for (size_t i = 0; i < errors.size(); i++){
+			ss << endl << "  " << errors[i];
+		}
+		throw runtime_error(ss.str());
+	}
+private:
+	vector<string> errors;
+};
+
+static CamSpec parseCam(const ptree& node, const string& where, RigErrors& errors){
+	static const map<string, CamType> types = {
+		{ "pg", CAM_PG }, { "pg1394", CAM_PG1394 }, { "xc", CAM_XC }, { "sim", CAM_SIM } };
+	errors.unknown(node, where, { "type", "serial", "raw", "broadcast", "shutterMs", "roi", "binning",
+		"decimation", "packetSize", "packetDelay" });
+	CamSpec cam;
+	errors.check(node.get_child_optional("type").is_initialized(), where + "type", "missing");
+	cam.type = errors.named(node, where, "type", CAM_SIM, types);
+	const int64_t serial = errors.get<int64_t>(node, where, "serial", 0, true);
+	errors.check(serial >= 0 && serial <= UINT32_MAX, where + "serial", "out of range");
+	cam.serial = uint32_t(serial);
+	cam.raw = errors.get<bool>(node, where, "raw", true);
+	cam.broadcast = errors.get<bool>(node, where, "broadcast", false);
+	errors.check(cam.type == CAM_PG1394 || !node.get_child_optional("broadcast"), where + "broadcast",
+		"only 1394 cameras share a trigger bus");
+
+	cam.settings = cam.type == CAM_XC ? CamSettings() : CamSettings(1280, 960);
+	cam.settings.shutterMs = errors.get<double>(node, where, "shutterMs", cam.settings.shutterMs);
+	errors.check(cam.settings.shutterMs > 0, where + "shutterMs", "must be > 0");
+	if (node.get_child_optional("roi")){
+		const ptree& roi = node.get_child("roi");
+		errors.unknown(roi, where + "roi/", { "width", "height", "x", "y" });
+		cam.settings.width = errors.get<int>(roi, where + "roi/", "width", 0);
+		cam.settings.height = errors.get<int>(roi, where + "roi/", "height", 0);
+		errors.check(cam.settings.width >= 0 && cam.settings.height >= 0, where + "roi", "must be >= 0");
+		cam.settings.offsetX = errors.get<int>(roi, where + "roi/", "x", cam.settings.offsetX);
+		cam.settings.offsetY = errors.get<int>(roi, where + "roi/", "y", cam.settings.offsetY);
+	}
+	// what each camera can bin on board
+	const int maxBinning = cam.type == CAM_PG ? 4 : cam.type == CAM_XC ? 1 : 2;
+	cam.settings.binning = errors.get<int>(node, where, "binning", cam.settings.binning);
+	errors.check(cam.settings.binning == 1 || cam.settings.binning == 2 || cam.settings.binning == 4,
+		where + "binning", "must be 1, 2 or 4");
+	errors.check(cam.settings.binning <= maxBinning, where + "binning",
+		"at most " + std::to_string(maxBinning) + " on this camera type");
+	cam.settings.decimation = errors.get<int>(node, where, "decimation", cam.settings.decimation);
+	errors.check(cam.settings.decimation > 0, where + "decimation", "must be > 0");
+	const int packetSize = errors.get<int>(node, where, "packetSize", cam.settings.packetSize);
+	// jumbo frames top out around 16 kB, below the 576 bytes of the smallest IP datagram nothing streams
+	errors.check(packetSize == 0 || (packetSize >= 576 && packetSize <= 16000), where + "packetSize",
+		"must be 576 to 16000, or 0 to keep the camera's");
+	errors.check(packetSize == 0 || cam.type != CAM_PG1394, where + "packetSize", "only GigE cameras stream packets");
+	cam.settings.packetSize = uint32_t(max(packetSize, 0));
+	const int64_t delay = errors.get<int64_t>(node, where, "packetDelay", cam.settings.packetDelay);
+	errors.check(delay >= 0 && delay <= UINT32_MAX, where + "packetDelay", "out of range");
+	cam.settings.packetDelay = uint32_t(delay);
+	return cam;
+}
+
+RigConfig parseRig(const ptree& tree) {
+	static const map<string, IoBackendType> backends = {
+		{ "stdio", IO_STDIO }, { "direct", IO_DIRECT }, { "uring", IO_URING } };
+	static const map<string, SequenceCodec> codecs = {
+		{ "raw", SEQ_CODEC_RAW }, { "thermal", SEQ_CODEC_THERMAL } };
+	static const map<string, SyncMode> modes = {
+		{ "frame_no", SYNC_FRAME_NO }, { "timestamp", SYNC_TIMESTAMP } };
+	RigErrors errors;
+	RigConfig rig;
+	PipelineConfig& p = rig.pipeline;
+	errors.unknown(tree, "", { "fps", "framecount", "window", "preview", "io", "sync", "reconnect", "trigger", "calibration",
+		"cameras" });
+	rig.calibration = errors.get<string>(tree, "", "calibration", "calibration.json");
+	p.fps = errors.get<double>(tree, "", "fps", p.fps);
+	errors.check(p.fps > 0, "fps", "must be > 0");
+	p.framecount = errors.get<int>(tree, "", "framecount", p.framecount);
+	errors.check(p.framecount != 0, "framecount", "must be > 0, or < 0 to run until stopped");
+	p.window = errors.get<string>(tree, "", "window", p.window);
+	if (tree.get_child_optional("preview")){
+		const ptree& preview = tree.get_child("preview");
+		errors.unknown(preview, "preview/", { "width", "height", "fps", "ring", "slots" });
+		p.mosaic.width = errors.get<int>(preview, "preview/", "width", p.mosaic.width);
+		p.mosaic.height = errors.get<int>(preview, "preview/", "height", p.mosaic.height);
+		errors.check(p.mosaic.width > 0 && p.mosaic.height > 0, "preview", "must be > 0");
+		p.displayFps = errors.get<double>(preview, "preview/", "fps", p.displayFps);
+		errors.check(p.displayFps >= 0, "preview/fps", "must be >= 0");
+		p.previewRing = errors.get<string>(preview, "preview/", "ring", p.previewRing);
+		p.previewSlots = errors.get<int>(preview, "preview/", "slots", p.previewSlots);
+		errors.check(p.previewSlots > 1, "preview/slots", "must be > 1");
+	}
+	if (tree.get_child_optional("io")){
+		const ptree& io = tree.get_child("io");
+		errors.unknown(io, "io/", { "backend", "codec" });
+		p.ioBackend = errors.named(io, "io/", "backend", p.ioBackend, backends);
+		p.ioCodec = errors.named(io, "io/", "codec", p.ioCodec, codecs);
+	}
+	if (tree.get_child_optional("sync")){
+		const ptree& sync = tree.get_child("sync");
+		errors.unknown(sync, "sync/", { "mode", "toleranceMs", "partialSets" });
+		p.sync = errors.named(sync, "sync/", "mode", p.sync, modes);
+		p.syncToleranceMs = errors.get<double>(sync, "sync/", "toleranceMs", p.syncToleranceMs);
+		errors.check(p.syncToleranceMs >= 0, "sync/toleranceMs", "must be >= 0");
+		p.partialSets = errors.get<bool>(sync, "sync/", "partialSets", p.partialSets);
+	}
+	if (tree.get_child_optional("reconnect")){
+		const ptree& rc = tree.get_child("reconnect");
+		SupervisorConfig& s = p.supervision;
+		errors.unknown(rc, "reconnect/", { "failures", "backoffMs", "maxBackoffMs" });
+		s.failuresToReconnect = errors.get<int>(rc, "reconnect/", "failures", s.failuresToReconnect);
+		errors.check(s.failuresToReconnect > 0, "reconnect/failures", "must be > 0");
+		s.backoffMs = errors.get<double>(rc, "reconnect/", "backoffMs", s.backoffMs);
+		s.maxBackoffMs = errors.get<double>(rc, "reconnect/", "maxBackoffMs", s.maxBackoffMs);
+		errors.check(s.backoffMs > 0 && s.maxBackoffMs >= s.backoffMs, "reconnect/backoffMs",
+			"must be > 0 and <= maxBackoffMs");
+	}
+
+	if (tree.get_child_optional("trigger")){
+		const ptree& tr = tree.get_child("trigger");
+		TriggerConfig& t = p.trigger;
+		errors.unknown(tr, "trigger/", { "spinUs", "missUs", "realtime" });
+		t.spinUs = errors.get<double>(tr, "trigger/", "spinUs", t.spinUs);
+		errors.check(t.spinUs >= 0, "trigger/spinUs", "must be >= 0");
+		t.missUs = errors.get<double>(tr, "trigger/", "missUs", t.missUs);
+		errors.check(t.missUs > 0, "trigger/missUs", "must be > 0");
+		t.realtime = errors.get<bool>(tr, "trigger/", "realtime", t.realtime);
+	}
+
+	const boost::optional<const ptree&> cams = tree.get_child_optional("cameras");
+	errors.check(cams && !cams->empty(), "cameras", "at least one camera is needed");
+	if (cams){
+		set<uint32_t> serials;
+		int i = 0;
+		for (ptree::const_iterator it = cams->begin(); it != cams->end(); it++, i++){
+			const string where = "cameras[" + std::to_string(i) + "]/";
+			errors.check(it->first.empty(), "cameras", "must be an array");
+			const CamSpec cam = parseCam(it->second, where, errors);
+			errors.check(serials.insert(cam.serial).second, where + "serial",
+				std::to_string(cam.serial) + " is listed twice");
+			rig.cams.push_back(cam);
+		}
+	}
+	errors.raise();
+	return rig;
+}
+
+static string readText(const string& path){
+	ifstream is(path.c_str(), ios::binary);
+	if (!is){
+		throw runtime_error("can't open " + path);
+	}
+	return string(istreambuf_iterator<char>(is), istreambuf_iterator<char>());
+}
+
+static ptree parseJson(const string& text, const string& path){
+	ptree tree;
+	try{
+		stringstream ss(text);
+		boost::property_tree::read_json(ss, tree);
+	}
+	catch (const boost::property_tree::json_parser_error& e){
+		stringstream ss;
+		ss << path << "[" << e.line() << "] " << e.message();
+		throw runtime_error(ss.str());
+	}
+	return tree;
+}
+
+RigConfig loadRig(const string& path) {
+	RigConfig rig;
+	try{
+		rig = parseRig(parseJson(readText(path), path));
+	}
+	catch (const runtime_error& e){
+		throw runtime_error(path + ": " + e.what());
+	}
+	// the calibration sits beside the rig, its packet settings win over the rig's
+	const boost::filesystem::path calibration = boost::filesystem::absolute(rig.calibration,
+		boost::filesystem::absolute(path).parent_path());
+	rig.calibration = calibration.string();
+	if (boost::filesystem::exists(calibration)){
+		const vector<PacketSettings> settings = loadCalibration(rig.calibration);
+		for (size_t i = 0; i < rig.cams.size(); i++){
+			for (size_t j = 0; j < settings.size(); j++){
+				if (settings[j].serial == rig.cams[i].serial && rig.cams[i].type != CAM_PG1394){
+					rig.cams[i].settings.packetSize = settings[j].packetSize;
+					rig.cams[i].settings.packetDelay = settings[j].packetDelay;
+				}
+			}
+		}
+	}
+	return rig;
+}
+
+CamOpener camOpener(const CamSpec& cam) {
+	const uint32_t s = cam.serial;
+	const CamSettings settings = cam.settings;
+	const bool raw = cam.raw;
+	switch (cam.type){
+	case CAM_PG:
+		return [=]{ return new PGTriggeredCam(s, raw, settings); };
+	case CAM_PG1394:{
+		const bool broadcast = cam.broadcast;
+		return [=]{ return new PG1394TriggeredCam(s, broadcast, raw, settings); };
+	}
+	case CAM_XC:
+		return [=]{ return new XCTriggeredCam(s, settings); };
+	default:{
+		SimulatedTriggeredCam::Config config;
+		// the simulated sensor is read out before binning
+		config.rows = settings.height > 0 ? settings.height * settings.binning : config.rows;
+		config.cols = settings.width > 0 ? settings.width * settings.binning : config.cols;
+		config.bayer = raw ? BAYER_RGGB : BAYER_NONE;
+		config.binning = settings.binning;
+		config.decimation = settings.decimation;
+		config.packetSize = settings.packetSize > 0 ? settings.packetSize : config.packetSize;
+		config.packetDelay = settings.packetDelay;
+		return [=]{ return new SimulatedTriggeredCam(s, config); };
+	}
+	}
+}
+
+RigWatcher::RigWatcher(const string& path) :
+	path(path), text(readText(path)), tree(parseJson(text, path)) {
+}
+
+bool RigWatcher::poll(double& fps, ostream& log) {
+	string now;
+	try{
+		now = readText(path);
+	}
+	catch (const runtime_error&){
+		// editors replace the file, it can be missing for a moment
+		return false;
+	}
+	if (now == text){
+		return false;
+	}
+	text = now;
+	ptree next;
+	RigConfig rig;
+	try{
+		next = parseJson(text, path);
+		rig = parseRig(next);
+	}
+	catch (const runtime_error& e){
+		log << path << " not reloaded: " << e.what() << endl;
+		return false;
+	}
+	ptree structural = next, current = tree;
+	structural.erase("fps");
+	current.erase("fps");
+	if (structural != current){
+		log << path << ": only fps is reloaded, restart to apply the other changes" << endl;
+	}
+	const double old = tree.get<double>("fps", PipelineConfig().fps);
+	tree = next;
+	if (rig.pipeline.fps == old){
+		return false;
+	}
+	log << path << ": fps " << old << " -> " << rig.pipeline.fps << endl;
+	fps = rig.pipeline.fps;
+	return true;
+}
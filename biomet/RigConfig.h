@@ -0,0 +1,98 @@
+#include "stdafx.h"
+
+#ifndef RIGCONFIG_H_
+#define RIGCONFIG_H_
+
+#include "TriggeredCam.h"
+#include "Pipeline.h"
+#include "Startup.h"
+#include <boost/property_tree/ptree.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <ostream>
+
+typedef enum
+{
+	CAM_PG = 0,     // GigE point grey
+	CAM_PG1394 = 1, // 1394 point grey
+	CAM_XC = 2,     // GigE xenics
+	CAM_SIM = 3     // SimulatedTriggeredCam, for trying a layout without the rig
+} CamType;
+
+struct CamSpec{
+	CamType type;
+	uint32_t serial;
+	bool raw;       // PG cameras hand out raw mosaics, demosaiced for display or by convert
+	bool broadcast; // the 1394 camera that fires the software trigger for its bus
+	CamSettings settings;
+};
+
+/*
+camcap's rig layout and capture parameters, loaded from a JSON file
+
+{
+	"fps": 16,
+	"framecount": -1,
+	"window": "stream",
+	"preview": { "width": 960, "height": 720, "fps": 10, "ring": "camcap_preview", "slots": 4 },
+	"io": { "backend": "direct", "codec": "thermal" },
+	"sync": { "mode": "timestamp", "toleranceMs": 0, "partialSets": true },
+	"reconnect": { "failures": 3, "backoffMs": 500, "maxBackoffMs": 30000 },
+	"trigger": { "spinUs": 2000, "missUs": 1000, "realtime": false },
+	"calibration": "calibration.json",
+	"cameras": [
+		{ "type": "pg1394", "serial": 13020556, "broadcast": true, "raw": true,
+		  "shutterMs": 10, "roi": { "width": 1280, "height": 960 } },
+		{ "type": "pg", "serial": 12010990, "roi": { "width": 640, "height": 480, "x": 0, "y": 0 },
+		  "binning": 2, "decimation": 1 },
+		{ "type": "xc", "serial": 5003, "packetSize": 9000, "packetDelay": 1000 }
+	]
+}
+
+everything but cameras is optional and defaults to PipelineConfig, a camera's
+settings default to CamSettings with a centered 1280x960 roi on PG cameras and
+the whole sensor on XC cameras. the roi is of the binned sensor, binning is up
+to 4 on GigE PG, 2 on 1394 PG (format7 mode 1) and unavailable on XC. packet
+size and delay of GigE cameras found in the calibration file override the
+rig's. the preview size is that of the mosaic, split into the cameras' tiles,
+and its fps the rate of the display, 0 for every frame
+*/
+struct RigConfig{
+	std::vector<CamSpec> cams;
+	PipelineConfig pipeline;
+	std::string calibration; // packet settings of `camcap calibrate`, resolved against the rig file's directory
+};
+
+/*
+parses and validates a rig file, every problem found is reported together in
+a single runtime_error. loadRig also applies the calibration
+*/
+RigConfig
+	loadRig(const std::string& path);
+RigConfig
+	parseRig(const boost::property_tree::ptree& tree);
+CamOpener
+	camOpener(const CamSpec& cam);
+
+/*
+follows edits to a rig file while capturing. only parameters that can change
+without reopening a camera are taken over, for now the frame rate, anything
+else is reported and waits for a restart
+*/
+class RigWatcher {
+public:
+	RigWatcher(const std::string& path);
+	/*
+	rereads the file, true when it now holds a different valid frame rate
+	invalid files and edits that need a restart are written to log once
+	*/
+	bool
+		poll(double& fps, std::ostream& log);
+private:
+	const std::string path;
+	std::string text; // last seen
+	boost::property_tree::ptree tree; // last accepted
+};
+
+#endif /* RIGCONFIG_H_ */
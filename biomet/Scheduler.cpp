@@ -0,0 +1,97 @@
+#include "stdafx.h"
+
+#include "Scheduler.h"
+#include "TriggeredCam.h"
+#include <thread>
+#include <algorithm>
+#include <cmath>
+#ifdef _WIN32
+#include <windows.h>
+#include <mmsystem.h>
+#pragma comment(lib, "winmm.lib")
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+const double TriggerScheduler::BIN_US[BINS] = { 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 0 };
+
+double TriggerScheduler::Stats::percentileUs(const double p) const {
+	const uint64_t rank = uint64_t(ceil(p * fired));
+	uint64_t seen = 0;
+	for (int i = 0; i < BINS - 1; i++){
+		seen += histogram[i];
+		if (seen >= rank && seen > 0){
+			return min(BIN_US[i], maxUs);
+		}
+	}
+	return maxUs;
+}
+
+TriggerScheduler::TriggerScheduler(const TriggerConfig& config) :
+	spin(chrono::duration_cast<Clock::duration>(chrono::duration<double, micro>(config.spinUs))),
+	miss(chrono::duration_cast<Clock::duration>(chrono::duration<double, micro>(config.missUs))),
+	fired(0), missed(0), totalNs(0), maxNs(0) {
+	assert_throw(config.spinUs >= 0 && config.missUs > 0);
+	for (int i = 0; i < BINS; i++){
+		histogram[i] = 0;
+	}
+#ifdef _WIN32
+	// 1 ms sleeps instead of the 15.6 ms default, the spin covers the rest
+	timeBeginPeriod(1);
+#endif
+}
+
+TriggerScheduler::~TriggerScheduler() {
+#ifdef _WIN32
+	timeEndPeriod(1);
+#endif
+}
+
+void TriggerScheduler::waitUntil(const Clock::time_point& deadline) {
+	if (spin > Clock::duration::zero()){
+		this_thread::sleep_until(deadline - spin);
+		while (Clock::now() < deadline){
+			this_thread::yield();
+		}
+	}
+	else{
+		this_thread::sleep_until(deadline);
+	}
+	const Clock::duration late = max(Clock::duration::zero(), Clock::now() - deadline);
+	const int64_t ns = chrono::duration_cast<chrono::nanoseconds>(late).count();
+	int bin = 0;
+	while (bin < BINS - 1 && ns > BIN_US[bin] * 1e3){
+		bin++;
+	}
+	histogram[bin]++;
+	fired++;
+	missed += late > miss ? 1 : 0;
+	totalNs += ns;
+	// only the grab thread writes
+	maxNs = max(int64_t(maxNs), ns);
+}
+
+TriggerScheduler::Stats TriggerScheduler::stats() const {
+	Stats s;
+	s.fired = fired;
+	s.missed = missed;
+	for (int i = 0; i < BINS; i++){
+		s.histogram[i] = histogram[i];
+	}
+	s.meanUs = s.fired > 0 ? totalNs / 1e3 / s.fired : 0;
+	s.maxUs = maxNs / 1e3;
+	return s;
+}
+
+bool TriggerScheduler::setRealtimePriority() {
+#ifdef _WIN32
+	return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+#else
+	sched_param param;
+	param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+	return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+#endif
+}
@@ -0,0 +1,68 @@
+#include "stdafx.h"
+
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+#include <stdint.h>
+#include <chrono>
+#include <atomic>
+
+struct TriggerConfig{
+	TriggerConfig() :
+		spinUs(2000), missUs(1000), realtime(false) {
+	}
+	double spinUs; // the last stretch before a deadline is spun instead of slept, 0 only sleeps
+	double missUs; // a trigger fired later than this missed its deadline
+	bool realtime; // grab threads ask for real-time priority, falls back to normal priority when refused
+};
+
+/*
+waits for trigger deadlines of one grab thread
+sleep_until wakes up to a scheduler quantum late, a millisecond or more on
+Windows even with timeBeginPeriod(1), so it only sleeps until spinUs before
+the deadline and spins the rest on the monotonic clock. how late every
+trigger fired goes into a histogram, deadlines are absolute so a late trigger
+doesn't push back the ones after it
+*/
+class TriggerScheduler {
+public:
+	typedef std::chrono::steady_clock Clock;
+	static const int BINS = 12;
+	static const double BIN_US[BINS]; // upper edges of the lateness bins, the last one is open
+	struct Stats{
+		uint64_t fired;
+		uint64_t missed; // fired more than missUs late
+		uint64_t histogram[BINS];
+		double meanUs, maxUs;
+		/*
+		upper edge of the bin holding the p quantile, at most maxUs
+		*/
+		double
+			percentileUs(const double p) const;
+	};
+	TriggerScheduler(const TriggerConfig& config = TriggerConfig());
+	~TriggerScheduler();
+	/*
+	returns at deadline, or at once when it has passed, and records how late
+	*/
+	void
+		waitUntil(const Clock::time_point& deadline);
+	Stats
+		stats() const;
+	/*
+	real-time priority for the calling thread, false when the OS refuses it
+	*/
+	static bool
+		setRealtimePriority();
+private:
+	TriggerScheduler(const TriggerScheduler&);
+	TriggerScheduler& operator=(const TriggerScheduler&);
+
+	const Clock::duration spin;
+	const Clock::duration miss;
+	std::atomic<uint64_t> fired, missed;
+	std::atomic<uint64_t> histogram[BINS];
+	std::atomic<int64_t> totalNs, maxNs;
+};
+
+#endif /* SCHEDULER_H_ */
@@ -0,0 +1,274 @@
+#include "stdafx.h"
+
+#include "SequenceFile.h"
+#include "TriggeredCam.h"
+#include "ThermalCodec.h"
+#include <opencv2/highgui/highgui.hpp>
+#include <boost/filesystem.hpp>
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+
+static_assert(sizeof(SequenceHeader) == SEQ_ALIGN, "SequenceHeader must fill one aligned block");
+static_assert(sizeof(SequenceRecord) == 64, "SequenceRecord must be 64 bytes");
+static_assert(sizeof(SequenceIndexEntry) == 32, "SequenceIndexEntry must be 32 bytes");
+static_assert(SEQ_ALIGN % IO_ALIGN == 0, "sequence blocks must satisfy the backend alignment");
+
+SequenceWriter::SequenceWriter(const string& path, const uint32_t serial,
+	const int rows, const int cols, const int type, const size_t chunkBytes,
+	const IoBackendType backend, const SequenceCodec codec, const BayerPattern bayer) :
+	path(path), maxPayload(codec == SEQ_CODEC_THERMAL ?
+	thermalMaxEncodedSize(rows, cols) : uint64_t(rows) * cols * CV_ELEM_SIZE(type)),
+	chunk(NULL), current(0),
+	chunkBytes(size_t(max<uint64_t>(seqAlign(chunkBytes), seqAlign(sizeof(SequenceRecord) + maxPayload)))),
+	chunkUsed(0), offset(0) {
+	assert_throw(codec == SEQ_CODEC_RAW || (codec == SEQ_CODEC_THERMAL && type == CV_16UC1));
+	assert_throw(bayer == BAYER_NONE || type == CV_8UC1);
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SEQ_MAGIC, sizeof(header.magic));
+	header.version = SEQ_VERSION;
+	header.serial = serial;
+	header.rows = rows;
+	header.cols = cols;
+	header.type = type;
+	header.codec = codec;
+	header.bayer = bayer;
+	header.frameBytes = uint64_t(rows) * cols * CV_ELEM_SIZE(type);
+	header.created = int64_t(time(0));
+
+	for (size_t i = 0; i < CHUNKS; i++){
+		chunks[i] = alignedAlloc(this->chunkBytes);
+	}
+	chunk = chunks[current];
+	index.reserve(INDEX_RESERVE);
+	file = IoBackend::create(path, backend);
+	memcpy(chunk, &header, sizeof(header));
+	chunkUsed = sizeof(header);
+}
+
+SequenceWriter::~SequenceWriter() {
+	try{
+		close();
+	}
+	catch (const exception& e){
+		cerr << e.what() << endl;
+	}
+	for (size_t i = 0; i < CHUNKS; i++){
+		if (chunks[i] != NULL){
+			alignedFree(chunks[i]);
+		}
+	}
+}
+
+uint64_t SequenceWriter::append(const int64_t frame_no, const int64_t timestamp, const Mat& frame,
+	const int64_t captured, const int64_t deviceStamp) {
+	assert_throw(frame.rows == header.rows && frame.cols == header.cols && frame.type() == header.type);
+	lock_guard<mutex> lock(mtx);
+	assert_throw(!file.empty());
+
+	if (chunkUsed + seqAlign(sizeof(SequenceRecord) + maxPayload) > chunkBytes){
+		flush();
+	}
+
+	// payload first, the record needs its size
+	uint8_t *rec = chunk + chunkUsed;
+	uint8_t *payload = rec + sizeof(SequenceRecord);
+	uint64_t payloadBytes = header.frameBytes;
+	if (header.codec == SEQ_CODEC_THERMAL){
+		payloadBytes = thermalEncode(frame, payload);
+	}
+	else{
+		const size_t rowBytes = frame.cols * frame.elemSize();
+		for (int y = 0; y < frame.rows; y++){
+			memcpy(payload + y * rowBytes, frame.ptr(y), rowBytes);
+		}
+	}
+	const uint64_t recordBytes = seqAlign(sizeof(SequenceRecord) + payloadBytes);
+	memset(payload + payloadBytes, 0, size_t(recordBytes - sizeof(SequenceRecord) - payloadBytes));
+
+	SequenceRecord record;
+	memset(&record, 0, sizeof(record));
+	record.magic = SEQ_RECORD_MAGIC;
+	record.frame_no = frame_no;
+	record.timestamp = timestamp;
+	record.size = payloadBytes;
+	record.captured = captured;
+	record.deviceStamp = deviceStamp;
+	memcpy(rec, &record, sizeof(record));
+
+	SequenceIndexEntry e;
+	e.frame_no = frame_no;
+	e.timestamp = timestamp;
+	e.offset = offset + chunkUsed + sizeof(record);
+	e.size = payloadBytes;
+	index.push_back(e);
+
+	chunkUsed += size_t(recordBytes);
+	return recordBytes;
+}
+
+/*
+hands the filled buffer to the backend and switches to the other one once its
+previous write has completed
+chunkUsed is always a multiple of SEQ_ALIGN, so every write is aligned
+*/
+void SequenceWriter::flush() {
+	if (chunkUsed == 0){
+		return;
+	}
+	file->submit(chunk, chunkUsed, offset);
+	offset += chunkUsed;
+	chunkUsed = 0;
+	current = (current + 1) % CHUNKS;
+	chunk = chunks[current];
+	file->wait(CHUNKS - 1);
+}
+
+void SequenceWriter::close() {
+	lock_guard<mutex> lock(mtx);
+	if (file.empty()){
+		return;
+	}
+	flush();
+
+	// index, staged through the chunk in aligned pieces
+	header.indexOffset = offset;
+	header.frameCount = index.size();
+	const uint8_t *src = reinterpret_cast<const uint8_t *>(index.data());
+	size_t remaining = index.size() * sizeof(SequenceIndexEntry);
+	while (remaining > 0){
+		const size_t n = min(remaining, chunkBytes);
+		memcpy(chunk, src, n);
+		memset(chunk + n, 0, size_t(seqAlign(n) - n));
+		chunkUsed = size_t(seqAlign(n));
+		flush();
+		src += n;
+		remaining -= n;
+	}
+
+	// patch header now that the index location is known
+	file->wait(0);
+	memcpy(chunk, &header, sizeof(header));
+	file->submit(chunk, sizeof(header), 0);
+	file->wait(0);
+	file->close();
+	file.release();
+}
+
+uint64_t SequenceWriter::bytesWritten() const {
+	return offset;
+}
+
+SequenceReader::SequenceReader(const string& path) :
+	file(path) {
+	if (file.size() < sizeof(SequenceHeader)){
+		throw runtime_error(path + " is not a sequence file");
+	}
+	memcpy(&hdr, file.data(), sizeof(hdr));
+	if (memcmp(hdr.magic, SEQ_MAGIC, sizeof(hdr.magic)) != 0 || hdr.version > SEQ_VERSION ||
+		hdr.codec > SEQ_CODEC_THERMAL){
+		throw runtime_error(path + " is not a supported sequence file");
+	}
+
+	if (hdr.indexOffset == 0){
+		// writer never closed the file
+		rebuildIndex();
+	}
+	else{
+		assert_throw(hdr.indexOffset + hdr.frameCount * sizeof(SequenceIndexEntry) <= file.size());
+		const SequenceIndexEntry *begin =
+			reinterpret_cast<const SequenceIndexEntry *>(file.data() + hdr.indexOffset);
+		index.assign(begin, begin + hdr.frameCount);
+	}
+}
+
+void SequenceReader::rebuildIndex() {
+	uint64_t pos = sizeof(SequenceHeader);
+	while (pos + sizeof(SequenceRecord) <= file.size()){
+		SequenceRecord record;
+		memcpy(&record, file.data() + pos, sizeof(record));
+		if (record.magic != SEQ_RECORD_MAGIC || pos + sizeof(record) + record.size > file.size()){
+			break;
+		}
+		SequenceIndexEntry e;
+		e.frame_no = record.frame_no;
+		e.timestamp = record.timestamp;
+		e.offset = pos + sizeof(record);
+		e.size = record.size;
+		index.push_back(e);
+		pos += seqAlign(sizeof(record) + record.size);
+	}
+	hdr.frameCount = index.size();
+}
+
+const SequenceHeader& SequenceReader::header() const {
+	return hdr;
+}
+
+size_t SequenceReader::size() const {
+	return index.size();
+}
+
+const SequenceIndexEntry& SequenceReader::entry(const size_t i) const {
+	assert_throw(i < index.size());
+	return index[i];
+}
+
+SequenceRecord SequenceReader::record(const size_t i) const {
+	assert_throw(i < index.size());
+	SequenceRecord r;
+	memcpy(&r, file.data() + index[i].offset - sizeof(r), sizeof(r));
+	return r;
+}
+
+Mat SequenceReader::frame(const size_t i) const {
+	const SequenceIndexEntry& e = entry(i);
+	if (hdr.codec == SEQ_CODEC_THERMAL){
+		Mat m;
+		thermalDecode(reinterpret_cast<const uint8_t *>(file.data() + e.offset), size_t(e.size), m);
+		assert_throw(m.rows == hdr.rows && m.cols == hdr.cols);
+		return m;
+	}
+	assert_throw(e.size == hdr.frameBytes);
+	return Mat(hdr.rows, hdr.cols, hdr.type, const_cast<char *>(file.data() + e.offset));
+}
+
+size_t convertSequence(const string& seqPath, const string& outDir) {
+	SequenceReader reader(seqPath);
+	boost::filesystem::create_directories(outDir);
+
+	const BayerPattern bayer = BayerPattern(reader.header().bayer);
+	string ext;
+	switch (bayer == BAYER_NONE ? CV_MAT_CN(reader.header().type) : 3){
+	case 1:
+		ext = ".pgm";
+		break;
+	case 3:
+		ext = ".ppm";
+		break;
+	default:
+		throw runtime_error("only 1 or 3 channel images supported");
+	}
+
+	Mat bgr;
+	for (size_t i = 0; i < reader.size(); i++){
+		boost::filesystem::path framePath(outDir);
+		stringstream ss;
+		ss << setw(9) << setfill('0') << reader.entry(i).frame_no << ext;
+		framePath /= ss.str();
+		Mat frame = reader.frame(i);
+		if (bayer != BAYER_NONE){
+			demosaic(frame, bayer, bgr);
+			frame = bgr;
+		}
+		if (!imwrite(framePath.string(), frame)){
+			throw runtime_error("could not write " + framePath.string());
+		}
+	}
+	return reader.size();
+}
@@ -0,0 +1,165 @@
+#include "stdafx.h"
+
+#ifndef SEQUENCEFILE_H_
+#define SEQUENCEFILE_H_
+
+#include "IoBackend.h"
+#include "Debayer.h"
+#include <opencv2/core/core.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+
+/*
+append-only per-camera frame sequence
+
+layout, every block aligned to SEQ_ALIGN bytes:
+  SequenceHeader                  patched with the index location on close
+  record 0 .. n-1                 SequenceRecord followed by the payload, the raw
+                                  frame or, for SEQ_CODEC_THERMAL, its encoding
+  SequenceIndexEntry[frameCount]  written on close
+
+a file that was never closed has no index, the reader rebuilds it by walking
+the records
+*/
+#define SEQ_MAGIC "CAMCAPSQ"
+#define SEQ_VERSION (2)
+#define SEQ_ALIGN (4096)
+#define SEQ_RECORD_MAGIC (0x51455352) // "RSEQ"
+
+/*
+payload coding, version 1 files are always raw
+*/
+enum SequenceCodec{
+	SEQ_CODEC_RAW = 0,
+	SEQ_CODEC_THERMAL = 1 // ThermalCodec, CV_16UC1 only
+};
+
+struct SequenceHeader{
+	char magic[8];
+	uint32_t version;
+	uint32_t serial;
+	int32_t rows;
+	int32_t cols;
+	int32_t type;         // OpenCV type of the frames
+	uint32_t codec;       // SequenceCodec
+	uint64_t frameBytes;  // raw size of a frame
+	uint64_t indexOffset; // 0 while the file is open
+	uint64_t frameCount;
+	int64_t created;      // seconds since the epoch
+	uint32_t bayer;       // BayerPattern of raw CV_8UC1 frames
+	uint32_t reserved1;
+	uint8_t reserved[4024];
+};
+
+struct SequenceRecord{
+	uint32_t magic;
+	uint32_t flags;
+	int64_t frame_no;
+	int64_t timestamp;    // exposure, microseconds since the epoch
+	uint64_t size;        // payload bytes following this record
+	int64_t captured;     // exposure on the host's monotonic clock in ns, shared by the cameras of a run
+	int64_t deviceStamp;  // camera clock in ns, 0 for cameras without one
+	uint8_t reserved[16];
+};
+
+struct SequenceIndexEntry{
+	int64_t frame_no;
+	int64_t timestamp;
+	uint64_t offset;      // of the payload from the start of the file
+	uint64_t size;
+};
+
+/*
+writes a sequence through large aligned staging buffers so the disk only sees
+big sequential writes. two buffers alternate, so with IO_URING one is filled
+while the other is being written. the synchronous backends write a full buffer
+before the next frame is copied in
+*/
+class SequenceWriter {
+public:
+	SequenceWriter(const std::string& path, const uint32_t serial, const int rows,
+		const int cols, const int type, const size_t chunkBytes = 8 << 20,
+		const IoBackendType backend = IO_STDIO, const SequenceCodec codec = SEQ_CODEC_RAW,
+		const BayerPattern bayer = BAYER_NONE);
+	~SequenceWriter();
+	/*
+	captured and deviceStamp as on the TriggeredFrame, files written before
+	they were recorded read back 0 for both. returns the bytes the frame takes
+	in the file, its record, encoded payload and padding
+	*/
+	uint64_t
+		append(const int64_t frame_no, const int64_t timestamp, const cv::Mat& frame,
+		const int64_t captured = 0, const int64_t deviceStamp = 0);
+	void
+		close();
+	uint64_t
+		bytesWritten() const;
+private:
+	SequenceWriter(const SequenceWriter&);
+	SequenceWriter& operator=(const SequenceWriter&);
+	void
+		flush();
+
+	static const size_t CHUNKS = 2;
+	static const size_t INDEX_RESERVE = 1 << 16; // entries, about an hour at 16 fps before the index first grows
+	const std::string path;
+	SequenceHeader header;
+	const uint64_t maxPayload; // largest payload a frame may need
+	cv::Ptr<IoBackend> file;
+	uint8_t *chunks[CHUNKS];
+	uint8_t *chunk;  // the buffer being filled
+	size_t current;
+	const size_t chunkBytes;
+	size_t chunkUsed;
+	uint64_t offset; // file offset of chunk[0]
+	std::vector<SequenceIndexEntry> index;
+	std::mutex mtx;
+};
+
+/*
+memory-maps a sequence for random access
+raw frames returned by frame() point into the mapping, they are read-only and
+only valid while the reader is alive. encoded frames are decoded into a new Mat
+*/
+class SequenceReader {
+public:
+	SequenceReader(const std::string& path);
+	const SequenceHeader&
+		header() const;
+	size_t
+		size() const;
+	const SequenceIndexEntry&
+		entry(const size_t i) const;
+	/*
+	the record in front of frame i, with the stamps the index doesn't keep
+	*/
+	SequenceRecord
+		record(const size_t i) const;
+	cv::Mat
+		frame(const size_t i) const;
+private:
+	void
+		rebuildIndex();
+
+	boost::iostreams::mapped_file_source file;
+	SequenceHeader hdr;
+	std::vector<SequenceIndexEntry> index;
+};
+
+/*
+rounds n up to a multiple of SEQ_ALIGN
+*/
+inline uint64_t seqAlign(const uint64_t n){
+	return (n + SEQ_ALIGN - 1) / SEQ_ALIGN * SEQ_ALIGN;
+}
+
+/*
+converts a sequence back to one PGM/PPM per frame in outDir, raw mosaics are
+demosaiced, returns the number of frames written
+*/
+size_t convertSequence(const std::string& seqPath, const std::string& outDir);
+
+#endif /* SEQUENCEFILE_H_ */
@@ -0,0 +1,284 @@
+#include "stdafx.h"
+
+#include "SimulatedCam.h"
+#include "SequenceFile.h"
+#include <opencv2/highgui/highgui.hpp>
+#include <boost/filesystem.hpp>
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include <cstdint>
+
+using namespace std;
+using namespace cv;
+
+SimulatedTriggeredCam::Config::Config() :
+	rows(960), cols(1280), type(CV_8UC1), bayer(BAYER_RGGB),
+	latencyMs(20), jitterMs(2), pollMs(0), failureRate(0), staleRate(0), deviceClock(true),
+	startupMs(0), binning(1), decimation(1), linkMBps(0), packetSize(9000), packetDelay(1000),
+	registry(NULL), bus(BUS_PG) {
+}
+
+SimulatedTriggeredCam::SimulatedTriggeredCam(const uint32_t serial, const Config& config) :
+	TriggeredCam(serial), config(config), next(0), previous(SIZE_MAX), previousStamp(0),
+	clockOffset((int64_t(serial) + 1) * 1000000000000LL), triggered(false),
+	rng(serial), latency(config.latencyMs, config.jitterMs), failure(0., 1.) {
+	assert_throw(config.latencyMs >= 0 && config.jitterMs >= 0 && config.pollMs >= 0);
+	assert_throw(config.failureRate >= 0 && config.failureRate <= 1);
+	assert_throw(config.staleRate >= 0 && config.staleRate <= 1);
+	assert_throw(config.startupMs >= 0);
+	assert_throw(config.binning > 0 && config.decimation > 0 && config.linkMBps >= 0);
+	decimation = config.decimation;
+	const Clock::time_point ready = Clock::now() +
+		chrono::microseconds(int64_t(config.startupMs * 1000));
+	if (config.registry != NULL){
+		try{
+			config.registry->find(config.bus, serial);
+		}
+		catch (const runtime_error& e){
+			throw TriggeredCamError(serial, e.what());
+		}
+		phase("enumerate");
+	}
+	this_thread::sleep_for(chrono::microseconds(int64_t(config.startupMs * 250)));
+	if (config.outage && !config.outage->plugged()){
+		if (config.registry != NULL){
+			config.registry->invalidate(serial);
+		}
+		throw TriggeredCamError(serial, "simulated camera not found");
+	}
+	phase("connect");
+	if (!config.replay.empty()){
+		replay(config.replay);
+	}
+	else{
+		synthesize();
+	}
+	if (config.link){
+		config.link->attach(serial, config.packetSize, config.packetDelay,
+			sources[0].total() * sources[0].elemSize());
+	}
+	phase("configure");
+	waitReady([&]{ return Clock::now() >= ready; }, READY_TIMEOUT_MS, "capturing");
+	phase("capture");
+}
+
+/*
+a gradient drifting by a few pixels per frame, smooth like a real scene
+*/
+void SimulatedTriggeredCam::synthesize() {
+	assert_throw(CV_MAT_DEPTH(config.type) == CV_8U || CV_MAT_DEPTH(config.type) == CV_16U);
+	assert_throw(config.bayer == BAYER_NONE || config.type == CV_8UC1);
+	for (size_t k = 0; k < SYNTHETIC_FRAMES; k++){
+		Mat m(config.rows / config.binning, config.cols / config.binning, config.type);
+		const int channels = m.channels();
+		for (int y = 0; y < m.rows; y++){
+			if (m.depth() == CV_8U){
+				uchar *p = m.ptr<uchar>(y);
+				for (int x = 0; x < m.cols * channels; x++){
+					p[x] = uchar((x / channels + y + int(k) * 4 + (x % channels) * 64) & 0xff);
+				}
+			}
+			else{
+				uint16_t *p = m.ptr<uint16_t>(y);
+				for (int x = 0; x < m.cols * channels; x++){
+					p[x] = uint16_t(4096 + ((x / channels) * 4 + y * 2 + int(k) * 16) % 8192);
+				}
+			}
+		}
+		sources.push_back(m);
+	}
+	bayer = config.bayer;
+}
+
+SimulatedTriggeredCam::~SimulatedTriggeredCam() {
+	if (config.link){
+		config.link->detach(serial);
+	}
+}
+
+/*
+loads up to REPLAY_FRAMES frames of this camera from a recording
+*/
+void SimulatedTriggeredCam::replay(const string& root) {
+	const boost::filesystem::path seqPath = boost::filesystem::path(root) / (std::to_string(serial) + ".seq");
+	const boost::filesystem::path imgDir = boost::filesystem::path(root) / std::to_string(serial);
+	if (boost::filesystem::exists(seqPath)){
+		SequenceReader reader(seqPath.string());
+		for (size_t i = 0; i < reader.size() && sources.size() < REPLAY_FRAMES; i++){
+			// raw frames point into the mapping, which goes away with the reader
+			sources.push_back(reader.frame(i).clone());
+		}
+		bayer = BayerPattern(reader.header().bayer);
+	}
+	else if (boost::filesystem::is_directory(imgDir)){
+		vector<boost::filesystem::path> files;
+		for (boost::filesystem::directory_iterator it(imgDir); it != boost::filesystem::directory_iterator(); it++){
+			if (boost::filesystem::is_regular_file(it->path())){
+				files.push_back(it->path());
+			}
+		}
+		sort(files.begin(), files.end());
+		for (size_t i = 0; i < files.size() && sources.size() < REPLAY_FRAMES; i++){
+			const Mat m = imread(files[i].string(), IMREAD_UNCHANGED);
+			if (!m.empty()){
+				sources.push_back(m);
+			}
+		}
+		bayer = BAYER_NONE;
+	}
+	if (sources.empty()){
+		throw TriggeredCamError(serial, "no frames to replay in " + root);
+	}
+	for (size_t i = 1; i < sources.size(); i++){
+		assert_throw(sources[i].size() == sources[0].size() && sources[i].type() == sources[0].type());
+	}
+}
+
+void SimulatedTriggeredCam::trigger() {
+	DBG(cerr << "trigger " << serial << endl);
+	triggeredAt = Clock::now();
+	triggered = true;
+}
+
+Mat SimulatedTriggeredCam::read(const chrono::milliseconds& timeout) {
+	DBG(cerr << "read " << serial << endl);
+	if (!triggered){
+		throw TriggeredCamError(serial, "read() without trigger()");
+	}
+	triggered = false;
+	// the frame is on the wire after the exposure
+	const size_t bytes = sources[next].total() * sources[next].elemSize();
+	double transferMs = config.linkMBps > 0 ? bytes / (config.linkMBps * 1e3) : 0;
+	const bool whole = !config.link || config.link->transfer(serial, bytes, failure(rng), transferMs);
+	const double ms = max(0., latency(rng)) + transferMs;
+	const Clock::time_point ready = triggeredAt + chrono::microseconds(int64_t(ms * 1000));
+	const Clock::time_point deadline = Clock::now() + timeout;
+	if (config.pollMs > 0){
+		while (Clock::now() < ready && Clock::now() < deadline){
+			this_thread::sleep_for(chrono::microseconds(int64_t(config.pollMs * 1000)));
+		}
+	}
+	else{
+		this_thread::sleep_until(min(ready, deadline));
+	}
+	if (Clock::now() < ready){
+		throw TriggeredCamError(serial, "timed out waiting for the frame");
+	}
+	if (config.outage && !config.outage->plugged()){
+		throw TriggeredCamError(serial, "simulated camera unplugged");
+	}
+	if (!whole){
+		throw TriggeredCamError(serial, "simulated incomplete frame");
+	}
+	if (config.failureRate > 0 && failure(rng) < config.failureRate){
+		throw TriggeredCamError(serial, "simulated read failure");
+	}
+
+	if (previous != SIZE_MAX && config.staleRate > 0 && failure(rng) < config.staleRate){
+		// the frame of this trigger was dropped, the previous buffer comes again
+		Mat m = pool.acquire(sources[previous].rows, sources[previous].cols, sources[previous].type());
+		sources[previous].copyTo(m);
+		timestamp = previousStamp;
+		return decimated(m);
+	}
+
+	const Mat& src = sources[next];
+	Mat m = pool.acquire(src.rows, src.cols, src.type());
+	src.copyTo(m);
+	// exposure starts shortly after the trigger
+	timestamp = config.deviceClock ? chrono::duration_cast<chrono::nanoseconds>(
+		triggeredAt.time_since_epoch()).count() + clockOffset + 100000 : 0;
+	previous = next;
+	previousStamp = timestamp;
+	next = (next + 1) % sources.size();
+	return decimated(m);
+}
+
+size_t SimulatedTriggeredCam::frames() const {
+	return sources.size();
+}
+
+SimulatedOutage::SimulatedOutage() :
+	until(Clock::now()) {
+}
+
+void SimulatedOutage::unplug(const double forMs) {
+	lock_guard<mutex> lock(mtx);
+	until = Clock::now() + chrono::microseconds(int64_t(forMs * 1000));
+}
+
+bool SimulatedOutage::plugged() const {
+	lock_guard<mutex> lock(mtx);
+	return Clock::now() >= until;
+}
+
+const double SimulatedLink::LINE_RATE = 125e6;
+
+SimulatedLink::SimulatedLink(const double capacityMBps, const double bufferKB, const uint32_t mtu) :
+	capacity(capacityMBps * 1e6), buffer(bufferKB * 1024), mtu(mtu) {
+	assert_throw(capacity > 0 && buffer >= 0);
+}
+
+void SimulatedLink::attach(const uint32_t serial, const uint32_t packetSize, const uint32_t packetDelay,
+	const size_t frameBytes) {
+	assert_throw(packetSize > 0);
+	Port p;
+	p.rate = packetSize / ((packetSize + OVERHEAD) / LINE_RATE + packetDelay * TICK_NS * 1e-9);
+	p.bytes = frameBytes;
+	p.packetSize = packetSize;
+	lock_guard<mutex> lock(mtx);
+	ports[serial] = p;
+}
+
+void SimulatedLink::detach(const uint32_t serial) {
+	lock_guard<mutex> lock(mtx);
+	ports.erase(serial);
+}
+
+bool SimulatedLink::transfer(const uint32_t serial, const size_t bytes, const double draw, double& ms) {
+	lock_guard<mutex> lock(mtx);
+	const map<uint32_t, Port>::iterator it = ports.find(serial);
+	assert_throw(it != ports.end());
+	it->second.bytes = bytes;
+	double total = 0, sent = 0;
+	for (map<uint32_t, Port>::const_iterator p = ports.begin(); p != ports.end(); p++){
+		total += p->second.rate;
+		sent += p->second.bytes;
+	}
+	// oversubscribed, every burst slows down to its share of the uplink
+	const double share = min(1., capacity / total);
+	ms = bytes / (it->second.rate * share) * 1e3;
+	if (it->second.packetSize > mtu){
+		return false;
+	}
+	const double excess = sent * (1 - share);
+	const double loss = excess > buffer ? min(1., (excess - buffer) / max(buffer, 1.)) : 0;
+	return draw >= loss;
+}
+
+SimulatedEnumerator::SimulatedEnumerator(const double enumerateMs) :
+	enumerateMs(enumerateMs), n(0) {
+}
+
+void SimulatedEnumerator::add(const uint32_t serial) {
+	DeviceInfo d;
+	d.serial = serial;
+	d.address = "sim://" + std::to_string(serial);
+	d.guid[0] = serial;
+	lock_guard<mutex> lock(mtx);
+	devices.push_back(d);
+}
+
+vector<DeviceInfo> SimulatedEnumerator::enumerate() {
+	lock_guard<mutex> scan(scanMtx);
+	this_thread::sleep_for(chrono::microseconds(int64_t(enumerateMs * 1000)));
+	lock_guard<mutex> lock(mtx);
+	n++;
+	return devices;
+}
+
+uint64_t SimulatedEnumerator::scans() const {
+	lock_guard<mutex> lock(mtx);
+	return n;
+}
@@ -0,0 +1,164 @@
+#include "stdafx.h"
+
+#ifndef SIMULATEDCAM_H_
+#define SIMULATEDCAM_H_
+
+#include "TriggeredCam.h"
+#include "DeviceRegistry.h"
+#include <opencv2/core/core.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <map>
+
+/*
+cable of a simulated camera, pulled for a while. shared by every instance
+opened for the same serial, so a reconnect sees the camera still missing
+*/
+class SimulatedOutage {
+public:
+	SimulatedOutage();
+	/*
+	unplugs the camera for forMs, starting now
+	*/
+	void
+		unplug(const double forMs);
+	bool
+		plugged() const;
+private:
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point until;
+	mutable std::mutex mtx;
+};
+
+/*
+GigE uplink shared by simulated cameras that are triggered together
+every attached camera bursts its frame at the same time, at a rate set by its
+packet size and inter-packet delay on a 1 GbE port. when the bursts add up to
+more than the uplink carries the excess queues in the switch buffer, and what
+doesn't fit is lost, taking whole frames with it. packets above the mtu never
+arrive. the delay is in ticks of 8 ns like on the cameras
+*/
+class SimulatedLink {
+public:
+	SimulatedLink(const double capacityMBps = 118, const double bufferKB = 512, const uint32_t mtu = 9000);
+	void
+		attach(const uint32_t serial, const uint32_t packetSize, const uint32_t packetDelay, const size_t frameBytes);
+	void
+		detach(const uint32_t serial);
+	/*
+	time a frame of bytes takes to arrive, false when it arrives incomplete
+	draw is uniform in [0, 1)
+	*/
+	bool
+		transfer(const uint32_t serial, const size_t bytes, const double draw, double& ms);
+private:
+	struct Port{
+		double rate;  // payload bytes/s of the camera's burst
+		size_t bytes; // of its last frame
+		uint32_t packetSize;
+	};
+	static const int OVERHEAD = 62;   // ethernet, IP, UDP and GVSP headers per packet
+	static const int TICK_NS = 8;
+	static const double LINE_RATE;   // 1 GbE, bytes/s
+	const double capacity; // payload bytes/s
+	const double buffer;   // bytes
+	const uint32_t mtu;
+	std::map<uint32_t, Port> ports;
+	std::mutex mtx;
+};
+
+/*
+hardware-free triggered camera for benchmarks and tests
+read() returns the frame of the last trigger() once the simulated exposure and
+transfer latency has passed, or fails like a dropped packet would. it either
+blocks until the frame is due, or polls for it every pollMs like a
+non-blocking SDK grab would. frames are
+synthetic, or replayed from a recording: <replay>/<serial>.seq as written by
+IoWriter or a <replay>/<serial>/ directory of images, cycled endlessly
+*/
+class SimulatedTriggeredCam : public TriggeredCam {
+public:
+	struct Config{
+		Config();
+		int rows, cols, type; // of synthetic frames before binning, replayed frames keep their own
+		BayerPattern bayer;   // mosaic layout of synthetic CV_8UC1 frames
+		double latencyMs;     // mean time from trigger() until the frame is ready
+		double jitterMs;      // standard deviation of the latency
+		double pollMs;        // > 0 polls for the frame in steps of this instead of blocking
+		double failureRate;   // probability of read() throwing TriggeredCamError
+		double staleRate;     // probability of read() handing out the previous buffer again, as under DROP_FRAMES
+		bool deviceClock;     // frames carry timestamps of a camera clock with an offset of its own
+		double startupMs;     // time the constructor takes to connect, configure and start
+		int binning;          // rows and cols are divided by it before the frame is sent
+		int decimation;       // as CamSettings::decimation, on the host after the transfer
+		double linkMBps;      // bandwidth frames are transferred at on top of the latency, 0 is unlimited
+		std::shared_ptr<SimulatedLink> link; // shared uplink in place of linkMBps, NULL for none
+		uint32_t packetSize, packetDelay;    // on the link
+		DeviceRegistry *registry; // the serial is looked up on bus first, NULL skips discovery
+		DeviceBus bus;
+		std::string replay;   // recording root, empty for synthetic frames
+		std::shared_ptr<SimulatedOutage> outage; // while unplugged reads fail and opening throws, NULL never unplugs
+	};
+	SimulatedTriggeredCam(const uint32_t serial, const Config& config = Config());
+	virtual
+		~SimulatedTriggeredCam();
+	virtual void
+		trigger();
+	using TriggeredCam::read;
+	virtual cv::Mat
+		read(const std::chrono::milliseconds& timeout);
+	/*
+	distinct frames read() cycles through
+	*/
+	size_t
+		frames() const;
+private:
+	typedef std::chrono::steady_clock Clock;
+	static const size_t SYNTHETIC_FRAMES = 8;
+	static const size_t REPLAY_FRAMES = 64; // replayed frames are held in memory
+	void
+		synthesize();
+	void
+		replay(const std::string& root);
+
+	const Config config;
+	std::vector<cv::Mat> sources;
+	size_t next;
+	size_t previous;        // source of the last frame read, SIZE_MAX before the first
+	int64_t previousStamp;
+	const int64_t clockOffset; // camera clock minus host clock, ns
+	bool triggered;
+	Clock::time_point triggeredAt;
+	std::mt19937 rng;
+	std::normal_distribution<double> latency;
+	std::uniform_real_distribution<double> failure;
+};
+
+/*
+simulated bus discovery, a scan takes enumerateMs and scans of the same bus
+run one at a time like on a real network. devices can be added while cameras
+are being opened to model ones that boot late
+*/
+class SimulatedEnumerator : public DeviceEnumerator {
+public:
+	SimulatedEnumerator(const double enumerateMs = 0);
+	void
+		add(const uint32_t serial);
+	virtual std::vector<DeviceInfo>
+		enumerate();
+	uint64_t
+		scans() const;
+private:
+	const double enumerateMs;
+	std::vector<DeviceInfo> devices;
+	uint64_t n;
+	mutable std::mutex mtx;
+	std::mutex scanMtx;
+};
+
+#endif /* SIMULATEDCAM_H_ */
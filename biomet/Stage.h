@@ -0,0 +1,160 @@
+#include "stdafx.h"
+
+#ifndef STAGE_H_
+#define STAGE_H_
+
+#include "TriggeredCam.h"
+#include "FixedQueue.h"
+#include <tbb/flow_graph.h>
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+/*
+what a full stage does with a new item
+only threads outside any stage's body wait under BLOCK, like the acquisition
+pump. a body that waited for room would hold the worker the full stage may
+need to drain, so put() from inside a body drops the oldest item instead
+*/
+typedef enum
+{
+	BLOCK = 0,      // wait for room, pushing back on the caller
+	DROP_OLDEST = 1 // evict the oldest queued item
+} OverflowPolicy;
+
+struct StageConfig{
+	size_t concurrency; // bodies running at once
+	size_t capacity;    // items waiting to run
+	OverflowPolicy policy;
+	StageConfig(const size_t concurrency = 1, const size_t capacity = 8,
+		const OverflowPolicy policy = DROP_OLDEST) :
+		concurrency(concurrency), capacity(capacity), policy(policy) {
+	}
+};
+
+struct StageStats{
+	uint64_t queued;    // items accepted by put()
+	uint64_t dropped;   // items evicted before running
+	uint64_t processed; // items the body finished with
+	uint64_t failed;    // items the body threw on
+	size_t depth;       // items waiting right now
+	size_t maxDepth;    // high-water mark of depth
+};
+
+/*
+number of stage bodies running on the calling thread
+*/
+inline int& stageBodies(){
+	static thread_local int n = 0;
+	return n;
+}
+
+/*
+bounded processing stage on a flow graph
+items wait in a queue of fixed capacity and are drained by at most
+`concurrency` bodies, so a slow consumer degrades into blocking or dropping
+instead of piling frames up in unbounded node buffers. items are moved into
+the queue and out to the body, frames and sets are references to buffers, so
+neither copies pixels nor allocates
+*/
+template<typename T>
+class BoundedStage {
+public:
+	typedef std::function<void(const T&)> Body;
+	BoundedStage(tbb::flow::graph& g, const std::string& name,
+		const StageConfig& config, const Body& body) :
+		name(name), config(config), body(body), queue(config.capacity), active(0),
+		runner(g, config.concurrency, [this](const tbb::flow::continue_msg&) -> tbb::flow::continue_msg {
+			drain();
+			return tbb::flow::continue_msg();
+		}) {
+		assert_throw(config.concurrency > 0);
+		assert_throw(config.capacity > 0);
+		counters.queued = 0;
+		counters.dropped = 0;
+		counters.processed = 0;
+		counters.failed = 0;
+		counters.depth = 0;
+		counters.maxDepth = 0;
+	}
+	void put(T item){
+		bool spawn = false;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			if (queue.size() >= config.capacity){
+				if (config.policy == BLOCK && stageBodies() == 0){
+					notFull.wait(lock, [this]{ return queue.size() < config.capacity; });
+				}
+				else{
+					queue.drop();
+					counters.dropped++;
+				}
+			}
+			queue.push(std::move(item));
+			counters.queued++;
+			counters.maxDepth = std::max(counters.maxDepth, queue.size());
+			if (active < config.concurrency){
+				active++;
+				spawn = true;
+			}
+		}
+		if (spawn){
+			runner.try_put(tbb::flow::continue_msg());
+		}
+	}
+	StageStats stats() const{
+		std::lock_guard<std::mutex> lock(mtx);
+		StageStats r = counters;
+		r.depth = queue.size();
+		return r;
+	}
+	const std::string name;
+private:
+	BoundedStage(const BoundedStage&);
+	BoundedStage& operator=(const BoundedStage&);
+	/*
+	runs queued items until the queue is empty, then gives up its concurrency slot
+	*/
+	void drain(){
+		while (true){
+			T item;
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				if (!queue.pop(item)){
+					active--;
+					return;
+				}
+			}
+			notFull.notify_one();
+			stageBodies()++;
+			try{
+				body(item);
+			}
+			catch (...){
+				stageBodies()--;
+				// hand the slot back so the next put() restarts draining
+				std::lock_guard<std::mutex> lock(mtx);
+				counters.failed++;
+				active--;
+				throw;
+			}
+			stageBodies()--;
+			std::lock_guard<std::mutex> lock(mtx);
+			counters.processed++;
+		}
+	}
+
+	const StageConfig config;
+	const Body body;
+	FixedQueue<T> queue;
+	size_t active;
+	StageStats counters;
+	mutable std::mutex mtx;
+	std::condition_variable notFull;
+	tbb::flow::function_node<tbb::flow::continue_msg> runner;
+};
+
+#endif /* STAGE_H_ */
@@ -0,0 +1,55 @@
+#include "stdafx.h"
+
+#include "Startup.h"
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <exception>
+
+using namespace std;
+using namespace cv;
+
+vector<Ptr<TriggeredCam> > openCameras(const vector<CamOpener>& openers) {
+	vector<Ptr<TriggeredCam> > cams(openers.size());
+	vector<exception_ptr> errors(openers.size());
+	vector<thread> threads;
+	for (size_t i = 0; i < openers.size(); i++){
+		threads.push_back(thread([&, i]{
+			try{
+				cams[i] = openers[i]();
+			}
+			catch (const exception& e){
+				cerr << __FILE__ << "[" << __LINE__ << "] " << e.what() << endl;
+				errors[i] = current_exception();
+			}
+			catch (...){
+				errors[i] = current_exception();
+			}
+		}));
+	}
+	for (size_t i = 0; i < threads.size(); i++){
+		threads[i].join();
+	}
+	for (size_t i = 0; i < errors.size(); i++){
+		if (errors[i]){
+			// cams goes out of scope and closes whatever did open
+			rethrow_exception(errors[i]);
+		}
+	}
+	return cams;
+}
+
+void printStartup(const vector<Ptr<TriggeredCam> >& cams, ostream& os) {
+	stringstream ss;
+	for (size_t i = 0; i < cams.size(); i++){
+		const vector<StartupPhase>& phases = cams[i]->startupPhases();
+		double total = 0;
+		ss << "startup " << cams[i]->serial << ":";
+		for (size_t p = 0; p < phases.size(); p++){
+			ss << " " << phases[p].name << " " << fixed << setprecision(0) << phases[p].ms << " ms";
+			total += phases[p].ms;
+		}
+		ss << ", total " << fixed << setprecision(0) << total << " ms" << endl;
+	}
+	os << ss.str();
+}
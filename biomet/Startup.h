@@ -0,0 +1,30 @@
+#include "stdafx.h"
+
+#ifndef STARTUP_H_
+#define STARTUP_H_
+
+#include "TriggeredCam.h"
+#include <opencv2/core/core.hpp>
+#include <vector>
+#include <functional>
+#include <ostream>
+
+/*
+constructs one camera, connecting, configuring and starting capture
+*/
+typedef std::function<TriggeredCam *()> CamOpener;
+
+/*
+runs the openers concurrently so bring-up takes as long as the slowest camera
+instead of the sum of all of them. cameras come back in the order of openers.
+if any opener throws, the cameras already open are closed again and the first
+error is rethrown once every opener has finished
+*/
+std::vector<cv::Ptr<TriggeredCam> > openCameras(const std::vector<CamOpener>& openers);
+
+/*
+per camera startup phases and their total
+*/
+void printStartup(const std::vector<cv::Ptr<TriggeredCam> >& cams, std::ostream& os);
+
+#endif /* STARTUP_H_ */
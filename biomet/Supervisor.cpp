@@ -0,0 +1,80 @@
+#include "stdafx.h"
+
+#include "Supervisor.h"
+#include "TriggeredCam.h"
+#include <algorithm>
+
+using namespace std;
+
+static CamSupervisor::Clock::duration toDuration(const double ms){
+	return chrono::duration_cast<CamSupervisor::Clock::duration>(chrono::duration<double, milli>(ms));
+}
+
+CamSupervisor::CamSupervisor(const SupervisorConfig& config) :
+	config(config), started(Clock::now()), isUp(true), failures(0),
+	downTime(Clock::duration::zero()), backoff(toDuration(config.backoffMs)) {
+	assert_throw(config.failuresToReconnect > 0);
+	assert_throw(config.backoffMs > 0 && config.maxBackoffMs >= config.backoffMs);
+	counters.up = true;
+	counters.disconnects = 0;
+	counters.attempts = 0;
+	counters.reconnects = 0;
+	counters.downSeconds = 0;
+	counters.availability = 1;
+}
+
+void CamSupervisor::succeeded() {
+	lock_guard<mutex> lock(mtx);
+	failures = 0;
+}
+
+bool CamSupervisor::failed() {
+	lock_guard<mutex> lock(mtx);
+	if (!isUp || ++failures < config.failuresToReconnect){
+		return false;
+	}
+	isUp = false;
+	downAt = Clock::now();
+	backoff = toDuration(config.backoffMs);
+	attemptAt = downAt + backoff;
+	counters.disconnects++;
+	return true;
+}
+
+bool CamSupervisor::up() const {
+	lock_guard<mutex> lock(mtx);
+	return isUp;
+}
+
+CamSupervisor::Clock::time_point CamSupervisor::nextAttempt() const {
+	lock_guard<mutex> lock(mtx);
+	return attemptAt;
+}
+
+void CamSupervisor::reconnectFailed() {
+	lock_guard<mutex> lock(mtx);
+	counters.attempts++;
+	backoff = min(backoff * 2, toDuration(config.maxBackoffMs));
+	attemptAt = Clock::now() + backoff;
+}
+
+void CamSupervisor::reconnected() {
+	lock_guard<mutex> lock(mtx);
+	counters.attempts++;
+	counters.reconnects++;
+	downTime += Clock::now() - downAt;
+	isUp = true;
+	failures = 0;
+}
+
+CamSupervisor::Stats CamSupervisor::stats() const {
+	lock_guard<mutex> lock(mtx);
+	const Clock::time_point now = Clock::now();
+	const Clock::duration down = downTime + (isUp ? Clock::duration::zero() : now - downAt);
+	const double total = chrono::duration<double>(now - started).count();
+	Stats r = counters;
+	r.up = isUp;
+	r.downSeconds = chrono::duration<double>(down).count();
+	r.availability = total > 0 ? 1. - r.downSeconds / total : 1.;
+	return r;
+}
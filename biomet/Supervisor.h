@@ -0,0 +1,74 @@
+#include "stdafx.h"
+
+#ifndef SUPERVISOR_H_
+#define SUPERVISOR_H_
+
+#include <stdint.h>
+#include <chrono>
+#include <mutex>
+
+struct SupervisorConfig{
+	SupervisorConfig() :
+		failuresToReconnect(3), backoffMs(500), maxBackoffMs(30000) {
+	}
+	int failuresToReconnect; // consecutive failed reads that take a camera down
+	double backoffMs;        // wait before the first reconnect attempt, doubled after every failed one
+	double maxBackoffMs;
+};
+
+/*
+health of one camera
+a camera goes down after failuresToReconnect consecutive failed reads, from
+then on it is torn down and reconstructed with exponential backoff between the
+attempts until one succeeds. availability is the fraction of the supervised
+time the camera was up
+*/
+class CamSupervisor {
+public:
+	typedef std::chrono::steady_clock Clock;
+	struct Stats{
+		bool up;
+		uint64_t disconnects; // times the camera went down
+		uint64_t attempts;    // reconnect attempts
+		uint64_t reconnects;  // successful ones
+		double downSeconds;
+		double availability;
+	};
+	CamSupervisor(const SupervisorConfig& config = SupervisorConfig());
+	/*
+	a frame was read
+	*/
+	void
+		succeeded();
+	/*
+	a read failed, true when it took the camera down
+	*/
+	bool
+		failed();
+	bool
+		up() const;
+	/*
+	when the next reconnect attempt is due
+	*/
+	Clock::time_point
+		nextAttempt() const;
+	void
+		reconnectFailed();
+	void
+		reconnected();
+	Stats
+		stats() const;
+private:
+	const SupervisorConfig config;
+	const Clock::time_point started;
+	bool isUp;
+	int failures;           // consecutive
+	Clock::time_point downAt;
+	Clock::duration downTime; // of past outages
+	Clock::duration backoff;
+	Clock::time_point attemptAt;
+	Stats counters;
+	mutable std::mutex mtx;
+};
+
+#endif /* SUPERVISOR_H_ */
@@ -0,0 +1,279 @@
+#include "stdafx.h"
+
+#include "Synchronizer.h"
+#include "TriggeredCam.h"
+#include <algorithm>
+#include <climits>
+#include <stdint.h>
+
+using namespace std;
+using namespace cv;
+
+FrameSynchronizer::FrameSynchronizer(const vector<uint32_t>& serials,
+	const size_t window, const Clock::duration timeout, const SyncMode mode, const Clock::duration tolerance,
+	const bool partial) :
+	serials(serials), sets(serials.size(), 2 * window), slots(window), timeout(timeout), mode(mode),
+	tolerance(chrono::duration_cast<chrono::nanoseconds>(tolerance).count()), partial(partial),
+	floor(0), floorTime(INT64_MIN), missed(serials.size(), 0) {
+	assert_throw(serials.size() > 0);
+	assert_throw(window > 0);
+	assert_throw(mode == SYNC_FRAME_NO || this->tolerance > 0);
+	for (size_t i = 0; i < serials.size(); i++){
+		assert_throw(serial2index.insert(make_pair(serials[i], i)).second);
+	}
+	for (size_t i = 0; i < slots.size(); i++){
+		slots[i].frame_no = -1;
+		slots[i].time = 0;
+		slots[i].count = 0;
+	}
+	counters.completed = 0;
+	counters.partial = 0;
+	counters.expired = 0;
+	counters.late = 0;
+	SkewSum zero = { 0, 0, 0 };
+	skews.assign(serials.size() * (serials.size() - 1) / 2, zero);
+}
+
+size_t FrameSynchronizer::size() const {
+	return serial2index.size();
+}
+
+size_t FrameSynchronizer::indexOf(const uint32_t serial) const {
+	unordered_map<uint32_t, size_t>::const_iterator it = serial2index.find(serial);
+	assert_throw(it != serial2index.end());
+	return it->second;
+}
+
+FrameSynchronizer::Stats FrameSynchronizer::stats() const {
+	lock_guard<mutex> lock(mtx);
+	return counters;
+}
+
+void FrameSynchronizer::setTolerance(const Clock::duration tolerance) {
+	const int64_t ns = chrono::duration_cast<chrono::nanoseconds>(tolerance).count();
+	assert_throw(mode == SYNC_FRAME_NO || ns > 0);
+	lock_guard<mutex> lock(mtx);
+	this->tolerance = ns;
+}
+
+vector<FrameSynchronizer::PairSkew> FrameSynchronizer::skew() const {
+	lock_guard<mutex> lock(mtx);
+	vector<PairSkew> r;
+	size_t k = 0;
+	for (size_t i = 0; i < serials.size(); i++){
+		for (size_t j = i + 1; j < serials.size(); j++, k++){
+			PairSkew p;
+			p.first = serials[i];
+			p.second = serials[j];
+			p.count = skews[k].count;
+			p.mean = p.count > 0 ? skews[k].sum * 1e-9 / p.count : 0;
+			p.maxAbs = skews[k].maxAbs * 1e-9;
+			r.push_back(p);
+		}
+	}
+	return r;
+}
+
+vector<uint64_t> FrameSynchronizer::misses() const {
+	lock_guard<mutex> lock(mtx);
+	return missed;
+}
+
+const FrameSetPool& FrameSynchronizer::setPool() const {
+	return sets;
+}
+
+/*
+starts the set of f in an unused slot
+*/
+void FrameSynchronizer::open(Slot& slot, const TriggeredFrame& f, const Clock::time_point now) {
+	slot.frame_no = f.frame_no;
+	slot.time = f.captured;
+	slot.first = now;
+	slot.frames = sets.acquire();
+}
+
+/*
+lets go of the slot's set, handed out sets live on with their holders
+*/
+void FrameSynchronizer::reset(Slot& slot) {
+	slot.frames.release();
+	slot.frame_no = -1;
+	slot.time = 0;
+	slot.count = 0;
+}
+
+/*
+gives up on the cameras a set is still missing, handing it out with
+placeholders in their place when partial sets are enabled
+*/
+void FrameSynchronizer::expire(Slot& slot, vector<FrameSetPtr>& ready) {
+	FrameSet& set = *slot.frames;
+	for (size_t i = 0; i < set.size(); i++){
+		if (set[i].frame.empty()){
+			missed[i]++;
+			set[i] = TriggeredFrame();
+			set[i].serial = serials[i];
+			set[i].frame_no = slot.frame_no;
+		}
+	}
+	if (partial){
+		counters.partial++;
+		ready.push_back(move(slot.frames));
+	}
+	else{
+		counters.expired++;
+	}
+	floor = max(floor, slot.frame_no + 1);
+	floorTime = max(floorTime, slot.time + tolerance);
+	reset(slot);
+}
+
+/*
+expires the open sets matching pred, oldest first
+*/
+void FrameSynchronizer::expireWhere(const function<bool(const Slot&)>& pred, vector<FrameSetPtr>& ready) {
+	vector<Slot *> matching;
+	for (size_t i = 0; i < slots.size(); i++){
+		if (slots[i].frame_no >= 0 && pred(slots[i])){
+			matching.push_back(&slots[i]);
+		}
+	}
+	sort(matching.begin(), matching.end(), [this](const Slot *a, const Slot *b){
+		return mode == SYNC_TIMESTAMP ? a->time < b->time : a->frame_no < b->frame_no;
+	});
+	for (size_t i = 0; i < matching.size(); i++){
+		expire(*matching[i], ready);
+	}
+}
+
+/*
+counts a full set and adds its pairwise skew
+*/
+void FrameSynchronizer::complete(Slot& slot) {
+	counters.completed++;
+	if (mode == SYNC_TIMESTAMP){
+		floorTime = max(floorTime, slot.time + tolerance);
+	}
+	const FrameSet& set = *slot.frames;
+	size_t k = 0;
+	for (size_t i = 0; i < set.size(); i++){
+		for (size_t j = i + 1; j < set.size(); j++, k++){
+			if (set[i].captured == 0 || set[j].captured == 0){
+				continue;
+			}
+			const int64_t d = set[j].captured - set[i].captured;
+			skews[k].count++;
+			skews[k].sum += d;
+			skews[k].maxAbs = max(skews[k].maxAbs, d < 0 ? -d : d);
+		}
+	}
+}
+
+/*
+the slot of f's frame_no, NULL when its set is gone
+*/
+FrameSynchronizer::Slot *FrameSynchronizer::slotByFrameNo(const TriggeredFrame& f, const Clock::time_point now,
+	vector<FrameSetPtr>& ready) {
+	Slot& slot = slots[size_t(f.frame_no) % slots.size()];
+	if (slot.frame_no != f.frame_no){
+		if (f.frame_no < floor || (slot.frame_no > f.frame_no)){
+			return NULL;
+		}
+		if (slot.frame_no >= 0){
+			// slot needed for a newer set
+			expire(slot, ready);
+		}
+		open(slot, f, now);
+	}
+	return &slot;
+}
+
+/*
+the open set captured nearest to f within the tolerance, or a new one, NULL
+when f is older than every set still open and its own set is gone
+*/
+FrameSynchronizer::Slot *FrameSynchronizer::slotByTime(const TriggeredFrame& f, const Clock::time_point now,
+	vector<FrameSetPtr>& ready) {
+	Slot *nearest = NULL, *unused = NULL, *oldest = NULL;
+	int64_t nearestDist = INT64_MAX;
+	for (size_t i = 0; i < slots.size(); i++){
+		Slot& slot = slots[i];
+		if (slot.frame_no < 0){
+			unused = unused != NULL ? unused : &slot;
+			continue;
+		}
+		const int64_t d = f.captured > slot.time ? f.captured - slot.time : slot.time - f.captured;
+		if (d <= tolerance && d < nearestDist){
+			nearest = &slot;
+			nearestDist = d;
+		}
+		if (oldest == NULL || slot.time < oldest->time){
+			oldest = &slot;
+		}
+	}
+	if (nearest != NULL){
+		return nearest;
+	}
+	if (f.captured < floorTime){
+		return NULL;
+	}
+
+	Slot *slot = unused;
+	if (slot == NULL){
+		if (oldest->time > f.captured){
+			return NULL;
+		}
+		// slot needed for a newer set
+		expire(*oldest, ready);
+		slot = oldest;
+	}
+	open(*slot, f, now);
+	return slot;
+}
+
+void FrameSynchronizer::put(const TriggeredFrame& f, const Sink& sink) {
+	const size_t cam = indexOf(f.serial);
+	const Clock::time_point now = Clock::now();
+	// sets for the sink, a vector per thread that keeps its capacity. swapped
+	// out while in use, should a sink ever come back here on the same thread
+	static thread_local vector<FrameSetPtr> scratch;
+	vector<FrameSetPtr> ready;
+	ready.swap(scratch);
+	{
+		lock_guard<mutex> lock(mtx);
+
+		// expire sets that waited too long for a missing camera
+		expireWhere([&](const Slot& s){ return now - s.first > timeout; }, ready);
+
+		Slot *slot = mode == SYNC_TIMESTAMP ? slotByTime(f, now, ready) : slotByFrameNo(f, now, ready);
+		// by timestamp, a second frame of a camera in one set is one of them being stale
+		if (slot == NULL || (mode == SYNC_TIMESTAMP && !(*slot->frames)[cam].frame.empty())){
+			counters.late++;
+		}
+		else{
+			FrameSet& set = *slot->frames;
+			if (set[cam].frame.empty()){
+				slot->count++;
+			}
+			set[cam] = f;
+
+			if (slot->count == set.size()){
+				if (partial){
+					// whatever is older can't be shown after this set, flush it first
+					expireWhere([&](const Slot& s){
+						return mode == SYNC_TIMESTAMP ? s.time < slot->time : s.frame_no < slot->frame_no;
+					}, ready);
+				}
+				complete(*slot);
+				ready.push_back(move(slot->frames));
+				reset(*slot);
+			}
+		}
+	}
+	for (size_t i = 0; i < ready.size(); i++){
+		sink(ready[i]);
+	}
+	ready.clear();
+	ready.swap(scratch);
+}
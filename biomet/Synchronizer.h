@@ -0,0 +1,132 @@
+#include "stdafx.h"
+
+#ifndef SYNCHRONIZER_H_
+#define SYNCHRONIZER_H_
+
+#include "TriggeredFrame.h"
+#include "FrameSet.h"
+#include <stdint.h>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+
+/*
+how frames of different cameras are told to belong to the same set
+*/
+typedef enum
+{
+	SYNC_FRAME_NO = 0, // same trigger tick, trusts every read() to return the frame of its trigger
+	SYNC_TIMESTAMP = 1 // captured within `tolerance` of each other, catches stale buffers
+} SyncMode;
+
+/*
+groups triggered frames of a runtime number of cameras into sets
+sets are held in a fixed window of slots, by frame_no the slot is frame_no
+modulo the window, by timestamp it is the open set nearest in captured time.
+a set that is still incomplete when its slot is needed again or after
+`timeout` is expired, so memory and latency stay bounded no matter which
+camera stalls. with `partial`, expired sets still go to the sink with an
+empty frame in place of every missing camera, and completing a set flushes
+the older ones first so sets come out in order
+a slot fills a set from a pool of twice the window, the open sets plus as
+many handed out and still held downstream, and hands the reference on
+*/
+class FrameSynchronizer {
+public:
+	// sets hold one frame per camera, in the order of the serials given to the constructor
+	typedef std::function<void(const FrameSetPtr&)> Sink;
+	typedef std::chrono::steady_clock Clock;
+	struct Stats{
+		uint64_t completed; // sets handed to the sink
+		uint64_t partial;   // incomplete sets handed to the sink with placeholders
+		uint64_t expired;   // incomplete sets discarded
+		uint64_t late;      // frames arriving after their set was discarded
+	};
+	/*
+	captured time of the second camera minus the first over completed sets
+	*/
+	struct PairSkew{
+		uint32_t first, second;
+		uint64_t count;
+		double mean, maxAbs; // seconds
+	};
+	FrameSynchronizer(const std::vector<uint32_t>& serials, const size_t window = 8,
+		const Clock::duration timeout = std::chrono::milliseconds(500),
+		const SyncMode mode = SYNC_FRAME_NO, const Clock::duration tolerance = Clock::duration::zero(),
+		const bool partial = false);
+	/*
+	adds a frame, completed sets are passed to sink outside the internal lock
+	a placeholder has the camera's serial, the set's frame_no and an empty frame
+	*/
+	void
+		put(const TriggeredFrame& f, const Sink& sink);
+	size_t
+		size() const;
+	size_t
+		indexOf(const uint32_t serial) const;
+	Stats
+		stats() const;
+	/*
+	SYNC_TIMESTAMP window for frames arriving from now on
+	*/
+	void
+		setTolerance(const Clock::duration tolerance);
+	/*
+	one entry per pair of cameras
+	*/
+	std::vector<PairSkew>
+		skew() const;
+	/*
+	per camera in the order of the serials, sets that went out partial or
+	expired without its frame
+	*/
+	std::vector<uint64_t>
+		misses() const;
+	const FrameSetPool&
+		setPool() const;
+private:
+	struct Slot{
+		int frame_no; // -1 when unused
+		int64_t time; // captured time of the set's first frame
+		size_t count;
+		Clock::time_point first;
+		FrameSetPtr frames; // empty while unused
+	};
+	struct SkewSum{
+		uint64_t count;
+		int64_t sum, maxAbs; // ns
+	};
+	Slot *
+		slotByFrameNo(const TriggeredFrame& f, const Clock::time_point now, std::vector<FrameSetPtr>& ready);
+	Slot *
+		slotByTime(const TriggeredFrame& f, const Clock::time_point now, std::vector<FrameSetPtr>& ready);
+	void
+		complete(Slot& slot);
+	void
+		expire(Slot& slot, std::vector<FrameSetPtr>& ready);
+	void
+		expireWhere(const std::function<bool(const Slot&)>& pred, std::vector<FrameSetPtr>& ready);
+	void
+		open(Slot& slot, const TriggeredFrame& f, const Clock::time_point now);
+	void
+		reset(Slot& slot);
+
+	std::vector<uint32_t> serials;
+	std::unordered_map<uint32_t, size_t> serial2index;
+	FrameSetPool sets;
+	std::vector<Slot> slots;
+	const Clock::duration timeout;
+	const SyncMode mode;
+	int64_t tolerance; // ns
+	const bool partial;
+	int floor;          // frames below this whose set is gone are late
+	int64_t floorTime;  // same for captured times
+	Stats counters;
+	std::vector<SkewSum> skews; // pairs (i, j), i < j, in row order
+	std::vector<uint64_t> missed;
+	mutable std::mutex mtx;
+};
+
+#endif /* SYNCHRONIZER_H_ */
@@ -0,0 +1,209 @@
+#include "stdafx.h"
+
+#include "ThermalCodec.h"
+#include "TriggeredCam.h"
+#include <tbb/parallel_for.h>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+using namespace cv;
+
+static size_t maxStripBytes(const int rows, const int cols){
+	const size_t blocks = (size_t(rows) * cols + THERMAL_BLOCK - 1) / THERMAL_BLOCK;
+	return blocks * (1 + THERMAL_BLOCK * 2);
+}
+
+static inline int predict(const int a, const int b, const int c){
+	const int mx = max(a, b), mn = min(a, b);
+	return c >= mx ? mn : c <= mn ? mx : a + b - c;
+}
+
+/*
+residuals are taken modulo 2^16, mapped 0, -1, 1, -2, ... -> 0, 1, 2, 3, ...
+*/
+static inline ushort zigzag(const int r){
+	const unsigned d = ushort(r);
+	return ushort((d << 1) ^ (0u - (d >> 15)));
+}
+
+static inline ushort unzigzag(const ushort z){
+	return ushort((z >> 1) ^ (0u - (z & 1u)));
+}
+
+static uint8_t *packBlocks(const ushort *z, const size_t n, uint8_t *dst){
+	for (size_t i = 0; i < n; i += THERMAL_BLOCK){
+		ushort v[THERMAL_BLOCK] = { 0 };
+		const size_t m = min(size_t(THERMAL_BLOCK), n - i);
+		unsigned any = 0;
+		for (size_t k = 0; k < m; k++){
+			v[k] = z[i + k];
+			any |= v[k];
+		}
+		int width = 0;
+		while (any >> width){
+			width++;
+		}
+		*dst++ = uint8_t(width);
+
+		// 16 values of width bits always fill whole 16 bit words
+		uint64_t acc = 0;
+		int bits = 0;
+		for (int k = 0; k < THERMAL_BLOCK; k++){
+			acc |= uint64_t(v[k]) << bits;
+			bits += width;
+			if (bits >= 32){
+				dst[0] = uint8_t(acc);
+				dst[1] = uint8_t(acc >> 8);
+				dst[2] = uint8_t(acc >> 16);
+				dst[3] = uint8_t(acc >> 24);
+				dst += 4;
+				acc >>= 32;
+				bits -= 32;
+			}
+		}
+		if (bits > 0){
+			dst[0] = uint8_t(acc);
+			dst[1] = uint8_t(acc >> 8);
+			dst += 2;
+		}
+	}
+	return dst;
+}
+
+static void unpackBlocks(const uint8_t *src, const size_t size, ushort *z, const size_t n){
+	const uint8_t *end = src + size;
+	for (size_t i = 0; i < n; i += THERMAL_BLOCK){
+		assert_throw(src < end);
+		const int width = *src++;
+		assert_throw(width <= 16 && src + 2 * width <= end);
+		const size_t m = min(size_t(THERMAL_BLOCK), n - i);
+		const uint64_t mask = (uint64_t(1) << width) - 1;
+		uint64_t acc = 0;
+		int bits = 0;
+		for (size_t k = 0; k < m; k++){
+			while (bits < width){
+				acc |= uint64_t(*src++) << bits;
+				bits += 8;
+			}
+			z[i + k] = ushort(acc & mask);
+			acc >>= width;
+			bits -= width;
+		}
+		src += 2 * width - (m * width + 7) / 8;
+	}
+	assert_throw(src == end);
+}
+
+static size_t encodeStrip(const Mat& src, const int y0, const int y1, uint8_t *dst){
+	const int cols = src.cols;
+	// residuals, kept per worker thread from strip to strip
+	static thread_local vector<ushort> z;
+	z.resize(size_t(y1 - y0) * cols);
+	ushort *r = &z[0];
+	for (int y = y0; y < y1; y++, r += cols){
+		const ushort *cur = src.ptr<ushort>(y);
+		if (y == y0){
+			r[0] = zigzag(cur[0]);
+			for (int x = 1; x < cols; x++){
+				r[x] = zigzag(cur[x] - cur[x - 1]);
+			}
+			continue;
+		}
+		const ushort *up = src.ptr<ushort>(y - 1);
+		r[0] = zigzag(cur[0] - up[0]);
+		for (int x = 1; x < cols; x++){
+			r[x] = zigzag(cur[x] - predict(cur[x - 1], up[x], up[x - 1]));
+		}
+	}
+	return packBlocks(&z[0], z.size(), dst) - dst;
+}
+
+static void decodeStrip(const uint8_t *src, const size_t size, Mat& dst, const int y0, const int y1){
+	const int cols = dst.cols;
+	vector<ushort> z(size_t(y1 - y0) * cols);
+	unpackBlocks(src, size, &z[0], z.size());
+	const ushort *r = &z[0];
+	for (int y = y0; y < y1; y++, r += cols){
+		ushort *cur = dst.ptr<ushort>(y);
+		if (y == y0){
+			cur[0] = unzigzag(r[0]);
+			for (int x = 1; x < cols; x++){
+				cur[x] = ushort(cur[x - 1] + unzigzag(r[x]));
+			}
+			continue;
+		}
+		const ushort *up = dst.ptr<ushort>(y - 1);
+		cur[0] = ushort(up[0] + unzigzag(r[0]));
+		for (int x = 1; x < cols; x++){
+			cur[x] = ushort(predict(cur[x - 1], up[x], up[x - 1]) + unzigzag(r[x]));
+		}
+	}
+}
+
+size_t thermalMaxEncodedSize(const int rows, const int cols){
+	const size_t strips = (rows + THERMAL_STRIP_ROWS - 1) / THERMAL_STRIP_ROWS;
+	return sizeof(ThermalHeader) + strips * sizeof(uint32_t) + strips * maxStripBytes(THERMAL_STRIP_ROWS, cols);
+}
+
+size_t thermalEncode(const Mat& src, uint8_t *dst){
+	assert_throw(src.type() == CV_16UC1);
+	ThermalHeader h;
+	h.magic = THERMAL_MAGIC;
+	h.rows = src.rows;
+	h.cols = src.cols;
+	h.strips = (src.rows + THERMAL_STRIP_ROWS - 1) / THERMAL_STRIP_ROWS;
+
+	// strips are coded into worst case slots in parallel, then compacted
+	// the strip sizes go straight into their table, dst needn't be aligned
+	uint8_t *table = dst + sizeof(h);
+	uint8_t *data = table + h.strips * sizeof(uint32_t);
+	const size_t slot = maxStripBytes(THERMAL_STRIP_ROWS, src.cols);
+	tbb::parallel_for(0, int(h.strips), [&](const int s){
+		const int y0 = s * THERMAL_STRIP_ROWS;
+		const uint32_t bytes = uint32_t(encodeStrip(src, y0, min(src.rows, y0 + THERMAL_STRIP_ROWS), data + s * slot));
+		memcpy(table + s * sizeof(uint32_t), &bytes, sizeof(bytes));
+	});
+	size_t used = 0;
+	for (size_t s = 0; s < h.strips; s++){
+		uint32_t bytes;
+		memcpy(&bytes, table + s * sizeof(uint32_t), sizeof(bytes));
+		memmove(data + used, data + s * slot, bytes);
+		used += bytes;
+	}
+
+	memcpy(dst, &h, sizeof(h));
+	return sizeof(h) + h.strips * sizeof(uint32_t) + used;
+}
+
+void thermalDecode(const uint8_t *src, const size_t size, Mat& dst){
+	ThermalHeader h;
+	if (size < sizeof(h)){
+		throw runtime_error("thermal frame truncated");
+	}
+	memcpy(&h, src, sizeof(h));
+	if (h.magic != THERMAL_MAGIC || h.rows <= 0 || h.cols <= 0 ||
+		h.strips != uint32_t((h.rows + THERMAL_STRIP_ROWS - 1) / THERMAL_STRIP_ROWS) ||
+		size < sizeof(h) + h.strips * sizeof(uint32_t)){
+		throw runtime_error("not a thermal frame");
+	}
+
+	vector<uint32_t> stripBytes(h.strips);
+	memcpy(&stripBytes[0], src + sizeof(h), h.strips * sizeof(uint32_t));
+	vector<size_t> stripOffset(h.strips);
+	size_t offset = sizeof(h) + h.strips * sizeof(uint32_t);
+	for (size_t s = 0; s < h.strips; s++){
+		stripOffset[s] = offset;
+		offset += stripBytes[s];
+	}
+	if (offset != size){
+		throw runtime_error("thermal frame size mismatch");
+	}
+
+	dst.create(h.rows, h.cols, CV_16UC1);
+	tbb::parallel_for(0, int(h.strips), [&](const int s){
+		const int y0 = s * THERMAL_STRIP_ROWS;
+		decodeStrip(src + stripOffset[s], stripBytes[s], dst, y0, min(h.rows, y0 + THERMAL_STRIP_ROWS));
+	});
+}
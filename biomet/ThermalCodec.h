@@ -0,0 +1,56 @@
+#include "stdafx.h"
+
+#ifndef THERMALCODEC_H_
+#define THERMALCODEC_H_
+
+#include <opencv2/core/core.hpp>
+#include <stdint.h>
+#include <cstddef>
+
+/*
+lossless codec for 16 bit single channel (Xenics) frames
+
+every pixel is predicted from its left, upper and upper-left neighbours (the
+LOCO-I median predictor, left only on a strip's first row), the residual is
+zigzag mapped and packed in blocks of THERMAL_BLOCK values at the bit width of
+the block's largest residual. thermal scenes use a narrow band of the 16 bit
+range and change slowly, so most blocks need a few bits per pixel
+
+the frame is coded in independent strips of THERMAL_STRIP_ROWS rows which are
+encoded and decoded in parallel
+
+layout:
+  ThermalHeader
+  uint32_t stripBytes[strips]
+  strip 0 .. strips-1, each a sequence of blocks:
+    uint8_t width, then THERMAL_BLOCK values of width bits, LSB first
+*/
+#define THERMAL_MAGIC (0x4d524854) // "THRM"
+#define THERMAL_STRIP_ROWS (32)
+#define THERMAL_BLOCK (16)
+
+struct ThermalHeader{
+	uint32_t magic;
+	int32_t rows;
+	int32_t cols;
+	uint32_t strips;
+};
+
+/*
+upper bound of thermalEncode()'s output for a rows x cols frame
+*/
+size_t thermalMaxEncodedSize(const int rows, const int cols);
+
+/*
+encodes a CV_16UC1 frame into dst, which must hold thermalMaxEncodedSize()
+bytes, returns the bytes used
+*/
+size_t thermalEncode(const cv::Mat& src, uint8_t *dst);
+
+/*
+decodes size bytes written by thermalEncode() into a CV_16UC1 frame
+throws if the data is corrupt
+*/
+void thermalDecode(const uint8_t *src, const size_t size, cv::Mat& dst);
+
+#endif /* THERMALCODEC_H_ */
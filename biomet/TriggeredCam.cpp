@@ -1,13 +1,133 @@
 #include "stdafx.h"
 
 #include "TriggeredCam.h"
+#include "DeviceRegistry.h"
 #include <iostream>
 #include <exception>
+#include <vector>
+#include <mutex>
+#include <cstring>
+#include <cmath>
 
 using namespace std;
 using namespace FlyCapture2;
 using namespace cv;
 
+/*
+FlyCapture2 discovery, one bus manager for every PG camera in the process
+*/
+class PGEnumerator : public DeviceEnumerator {
+public:
+	virtual vector<DeviceInfo> enumerate(){
+		unsigned int n = 0;
+		PG_Call(bm.GetNumOfCameras(&n), 1, 0, 0);
+		vector<DeviceInfo> devices;
+		for (unsigned int i = 0; i < n; i++){
+			DeviceInfo d;
+			PGRGuid guid;
+			unsigned int serial;
+			PG_Call(bm.GetCameraFromIndex(i, &guid), 1, 0, 0);
+			PG_Call(bm.GetCameraSerialNumberFromIndex(i, &serial), 1, 0, 0);
+			d.serial = serial;
+			memcpy(d.guid, guid.value, sizeof(d.guid));
+			devices.push_back(d);
+		}
+		return devices;
+	}
+private:
+	BusManager bm;
+};
+
+/*
+XCamera GigE Vision discovery
+*/
+class XCEnumerator : public DeviceEnumerator {
+public:
+	virtual vector<DeviceInfo> enumerate(){
+		uint32_t deviceCount = 0;
+		XC_Call(XCD_EnumerateDevices(NULL, &deviceCount, XEF_GigEVision), 1, 0, 0);
+		vector<DeviceInfo> devices;
+		if (deviceCount == 0){
+			return devices;
+		}
+		vector<XDeviceInformation> info(deviceCount);
+		XC_Call(XCD_EnumerateDevices(&info[0], &deviceCount, XEF_UseCached), 1, 0, 0);
+		XC_Call(XCD_EnumerateDevices(NULL, NULL, XEF_ReleaseCache), 1, 0, 0);
+		for (uint32_t i = 0; i < deviceCount; i++){
+			DeviceInfo d;
+			d.serial = info[i].serial;
+			d.address = string("gev://") + info[i].address;
+			devices.push_back(d);
+		}
+		return devices;
+	}
+};
+
+/*
+points a PG camera's blocking RetrieveBuffer at a new deadline, the camera is
+only reconfigured when the deadline changes
+*/
+template <class C>
+static void setGrabTimeout(C& cam, int& current, const int ms){
+	if (ms == current){
+		return;
+	}
+	FC2Config config;
+	PG_Call(cam.GetConfiguration(&config), 1, 0, 0);
+	config.grabTimeout = ms;
+	PG_Call(cam.SetConfiguration(&config), 1, 0, 0);
+	current = ms;
+}
+
+/*
+origin of a roi of size along a sensor axis of max, centered for offset < 0,
+aligned down to the camera's offset step
+*/
+static unsigned int roiOffset(const int offset, const unsigned int size, const unsigned int max, const unsigned int step){
+	assert_throw(size > 0 && size <= max);
+	unsigned int o = offset < 0 ? (max - size) / 2 : unsigned(offset);
+	if (step > 1){
+		o -= o % step;
+	}
+	assert_throw(o + size <= max);
+	return o;
+}
+
+/*
+manual shutter of a PG camera, only written when it differs
+*/
+template <class C>
+static void setShutter(C& cam, const double ms){
+	Property prop;
+	prop.type = SHUTTER;
+	PG_Call(cam.GetProperty(&prop), 1, 0, 0);
+	if (prop.autoManualMode != false || fabs(prop.absValue - ms) > .01) {
+		DBG(cerr << prop.autoManualMode << " " << prop.absValue << endl);
+		prop.autoManualMode = false;
+		prop.absControl = true;
+		prop.absValue = float(ms);
+		PG_Call(cam.SetProperty(&prop), 1, 100, 0);
+	}
+}
+
+/*
+the process-wide registry with the SDK enumerators, unless something else was
+installed first
+*/
+static DeviceRegistry& registry(){
+	static once_flag once;
+	call_once(once, []{
+		DeviceRegistry& r = DeviceRegistry::instance();
+		if (!r.hasEnumerator(BUS_PG)){
+			r.setEnumerator(BUS_PG, new PGEnumerator());
+		}
+		if (!r.hasEnumerator(BUS_XC)){
+			r.setEnumerator(BUS_XC, new XCEnumerator());
+		}
+	});
+	return DeviceRegistry::instance();
+}
+
 /*
 callback for status messages for XC cams
 */
@@ -39,35 +159,128 @@ ErrCode statusCheck(void *v_pUserParm, int iMsg, unsigned long ulP,
 	return I_OK;
 }
 
-//XCTriggeredCam::XCTriggeredCam(const uint32_t serial, const uint32_t pktDelay) :
-//TriggeredCam(serial) {
-XCTriggeredCam::XCTriggeredCam(const uint32_t serial) : TriggeredCam(serial){
+/*
+camera clock of a PG frame in ns, from the cycle timer the camera embeds into
+the image. seconds and microSeconds of a TimeStamp are the host's time the
+frame was received, not a camera clock. the cycle timer counts 128 s in 8000
+cycles of 125 us a second, each of 3072 ticks, and wraps, so every frame is
+placed after the previous one with the wraps added up in epoch. cameras are
+read at far more than one frame per wrap
+*/
+static int64_t cycleTime(const TimeStamp& ts, int64_t& last, int64_t& epoch){
+	const int64_t WRAP = int64_t(128) * 1000000000;
+	const int64_t t = int64_t(ts.cycleSeconds) * 1000000000 + int64_t(ts.cycleCount) * 125000
+		+ int64_t(ts.cycleOffset) * 125000 / 3072;
+	if (t < last){
+		epoch += WRAP;
+	}
+	last = t;
+	return epoch + t;
+}
+
+/*
+turns on the cycle timer stamp of every frame where the camera has one, it
+takes the place of the first four pixel bytes until hideCycleTime() restores
+them. false leaves the camera's frames without a device clock
+*/
+template<typename C>
+static bool embedCycleTime(C& cam){
+	EmbeddedImageInfo embedded;
+	PG_Call(cam.GetEmbeddedImageInfo(&embedded), 1, 0, 0);
+	if (!embedded.timestamp.available){
+		return false;
+	}
+	if (!embedded.timestamp.onOff){
+		embedded.timestamp.onOff = true;
+		PG_Call(cam.SetEmbeddedImageInfo(&embedded), 1, 100, 0);
+	}
+	return true;
+}
+
+/*
+puts pixels back where the camera embedded its cycle timer, once the stamp was
+taken through GetTimeStamp(). the same bytes two rows down are the same colour
+of a Bayer mosaic in any pixel format, so neither the saved frames nor their
+demosaic and previews see the stamp
+*/
+static void hideCycleTime(Image& image){
+	const unsigned int stride = image.GetStride();
+	if (image.GetRows() < 3 || stride < 4){
+		return;
+	}
+	unsigned char *data = image.GetData();
+	memcpy(data, data + 2 * stride, 4);
+}
+
+/*
+the mosaic layout a PG camera reports for its sensor
+*/
+static BayerPattern tilePattern(const BayerTileFormat tile){
+	switch (tile){
+	case RGGB:
+		return BAYER_RGGB;
+	case GRBG:
+		return BAYER_GRBG;
+	case GBRG:
+		return BAYER_GBRG;
+	case BGGR:
+		return BAYER_BGGR;
+	default:
+		return BAYER_NONE;
+	}
+}
+
+/*
+the 8 bit sensor format raw mode reads, RAW8 on colour sensors and MONO8 on
+monochrome ones, out of a mode's pixelFormatBitField
+*/
+static PixelFormat rawFormat(const unsigned int supported){
+	if (supported & PIXEL_FORMAT_RAW8){
+		return PIXEL_FORMAT_RAW8;
+	}
+	if (supported & PIXEL_FORMAT_MONO8){
+		return PIXEL_FORMAT_MONO8;
+	}
+	throw runtime_error("camera can't send RAW8 or MONO8 for raw capture");
+}
+
+static void checkRawFormat(const PixelFormat format){
+	if (format != PIXEL_FORMAT_RAW8 && format != PIXEL_FORMAT_MONO8){
+		throw runtime_error("raw capture needs RAW8 or MONO8, camera sends pixel format " + to_string(unsigned(format)));
+	}
+}
+
+/*
+copies a retrieved PG image into a pooled CV_8UC1 frame without conversion
+*/
+static Mat readRaw(const Image& rawImage, FramePool& pool, BayerPattern& bayer){
+	checkRawFormat(rawImage.GetPixelFormat());
+	bayer = tilePattern(rawImage.GetBayerTileFormat());
+	Mat m = pool.acquire(rawImage.GetRows(), rawImage.GetCols(), CV_8UC1);
+	Mat(m.rows, m.cols, CV_8UC1, rawImage.GetData(), rawImage.GetStride()).copyTo(m);
+	return m;
+}
+
+XCTriggeredCam::XCTriggeredCam(const uint32_t serial, const CamSettings& settings) : TriggeredCam(serial), getFrameTimeout(READ_TIMEOUT_MS){
 	try{
 		DBG(cerr << "construct " << serial << endl);
 
 		// find device from serial
-		uint32_t deviceCount = 0;
-		XC_Call(XCD_EnumerateDevices(NULL, &deviceCount, XEF_GigEVision), 1, 0, 0);
-		assert_throw(deviceCount > 0);
-
-		XDeviceInformation *devices = new XDeviceInformation[deviceCount];
-		XC_Call(XCD_EnumerateDevices(devices, &deviceCount, XEF_UseCached), 1, 0, 0);
-
-		XDeviceInformation *dev;
-		for (dev = devices; dev != devices + deviceCount; dev++) {
-			if (dev->serial == serial) {
-				break;
-			}
-		}
-		assert_throw(dev != devices + deviceCount);
-		XC_Call(XCD_EnumerateDevices(NULL, NULL, XEF_ReleaseCache), 1, 0, 0);
+		const DeviceInfo dev = registry().find(BUS_XC, serial);
+		phase("enumerate");
 
 		// init gige camera
-		stringstream ss;
-		ss << "gev://" << dev->address;
-		assert_throw(
-			(cam = XCamera::Create(ss.str().c_str(), DBGIFELSE(statusCheck, (XStatus)0))) != NULL);
-		assert_throw(cam->IsInitialised());
+		try{
+			assert_throw(
+				(cam = XCamera::Create(dev.address.c_str(), DBGIFELSE(statusCheck, (XStatus)0))) != NULL);
+			assert_throw(cam->IsInitialised());
+		}
+		catch (...){
+			// the device may be back at another address by the next attempt
+			registry().invalidate(serial);
+			throw;
+		}
+		phase("connect");
 
 		long pValue;
 
@@ -84,29 +297,59 @@ XCTriggeredCam::XCTriggeredCam(const uint32_t serial) : TriggeredCam(serial){
 		if (pValue != 1)
 			XC_Call(cam->SetPropertyValueL("TriggerInEnable", 1), 1, 100, 0);
 
-		if (cam->GetHeight() != cam->GetMaxHeight())
-			XC_Call(cam->SetPropertyValueL("Height", cam->GetMaxHeight()), 1, 100, 0);
+		// roi of the configured size, binning is left to the camera's own modes
+		assert_throw(settings.binning == 1);
+		const dword width = settings.width > 0 ? settings.width : cam->GetMaxWidth();
+		const dword height = settings.height > 0 ? settings.height : cam->GetMaxHeight();
+		const long offsetX = roiOffset(settings.offsetX, width, cam->GetMaxWidth(), 1);
+		const long offsetY = roiOffset(settings.offsetY, height, cam->GetMaxHeight(), 1);
+		if (cam->GetWidth() != width || cam->GetHeight() != height) {
+			// a larger roi only fits once the old one is moved to the origin
+			XC_Call(cam->SetPropertyValueL("OffsetX", 0), 1, 0, 0);
+			XC_Call(cam->SetPropertyValueL("OffsetY", 0), 1, 0, 0);
+			XC_Call(cam->SetPropertyValueL("Width", width), 1, 100, 0);
+			XC_Call(cam->SetPropertyValueL("Height", height), 1, 100, 0);
+		}
+
+		XC_Call(cam->GetPropertyValueL("OffsetX", &pValue), 1, 0, 0);
+		if (pValue != offsetX)
+			XC_Call(cam->SetPropertyValueL("OffsetX", offsetX), 1, 100, 0);
 
-		if (cam->GetWidth() != cam->GetMaxWidth())
-			XC_Call(cam->SetPropertyValueL("Width", cam->GetMaxWidth()), 1, 100, 0);
+		XC_Call(cam->GetPropertyValueL("OffsetY", &pValue), 1, 0, 0);
+		if (pValue != offsetY)
+			XC_Call(cam->SetPropertyValueL("OffsetY", offsetY), 1, 100, 0);
+		decimation = settings.decimation;
+
+		if (settings.packetSize > 0){
+			XC_Call(cam->GetPropertyValueL("GevSCPSPacketSize", &pValue), 1, 0, 0);
+			if (pValue != long(settings.packetSize))
+				XC_Call(cam->SetPropertyValueL("GevSCPSPacketSize", settings.packetSize), 1, 100, 0);
+		}
 
 		XC_Call(cam->GetPropertyValueL("XGIGEV_PacketDelay", &pValue), 1, 0, 0);
-		if (pValue != 1000)
-			XC_Call(cam->SetPropertyValueL("XGIGEV_PacketDelay", 1000), 1, 100, 0);
+		if (pValue != long(settings.packetDelay))
+			XC_Call(cam->SetPropertyValueL("XGIGEV_PacketDelay", settings.packetDelay), 1, 100, 0);
 
+		// frames missing packets are dropped, so a lossy link shows up as failed reads
 		XC_Call(cam->GetPropertyValueL("_API_FPC_DROPS", &pValue), 1, 0, 0);
 		if (pValue != 1)
 			XC_Call(cam->SetPropertyValueL("_API_FPC_DROPS", 1), 1, 100, 0);
 
+		XC_Call(cam->GetPropertyValueL("_API_GETFRAME_TIMEOUT", &pValue), 1, 0, 0);
+		if (pValue != getFrameTimeout)
+			XC_Call(cam->SetPropertyValueL("_API_GETFRAME_TIMEOUT", getFrameTimeout), 1, 0, 0);
+
 		frameSize = cam->GetFrameSize();
 		frameWidth = cam->GetWidth();
 		frameHeight = cam->GetHeight();
 		DBG(assert_throw(frameSize == (frameWidth * frameHeight * sizeof(word))));
 
-		camsleep(3000);
+		phase("configure");
 
-		XC_Call(cam->StartCapture(), 1, 1000, 0);
-		assert_throw(cam->IsCapturing());
+		// ready once the camera reports capturing, instead of a fixed settle time
+		XC_Call(cam->StartCapture(), 1, 0, 0);
+		waitReady([this]{ return cam->IsCapturing(); }, READY_TIMEOUT_MS, "capturing");
+		phase("capture");
 	}
 	catch (const runtime_error& e){
 		throw TriggeredCamError(serial, e.what());
@@ -114,12 +357,13 @@ XCTriggeredCam::XCTriggeredCam(const uint32_t serial) : TriggeredCam(serial){
 }
 
 XCTriggeredCam::~XCTriggeredCam() {
+	// destructors must not throw, a camera torn down after losing its link can't stop
 	try{
 		DBG(cerr << "destroy " << serial << endl);
 		XC_Call(cam->StopCapture(), 1, 0, 0);
 	}
 	catch (const runtime_error& e){
-		throw TriggeredCamError(serial, e.what());
+		cerr << TriggeredCamError(serial, e.what()).what() << endl;
 	}
 }
 
@@ -138,7 +382,7 @@ void XCTriggeredCam::trigger() {
 	}
 }
 
-Mat XCTriggeredCam::read() {
+Mat XCTriggeredCam::read(const chrono::milliseconds& timeout) {
 	try{
 		DBG(cerr << "read " << serial << endl);
 #if defined(_DEBUG)
@@ -146,37 +390,43 @@ Mat XCTriggeredCam::read() {
 		assert_throw(cam->IsInitialised());
 		assert_throw(cam->IsCapturing());
 #endif
-		Mat m;
-		word *frameBuffer = new word[frameSize / sizeof(word)];
-		try {
-			XC_Call(cam->GetFrame(FT_NATIVE, 0, frameBuffer, frameSize), 40, 0, 1);
-			m = Mat(frameHeight, frameWidth, CV_16UC1, frameBuffer).clone();
-		}
-		catch (...) {
-			delete frameBuffer;
-			throw;
+		// grab straight into a pooled buffer, GetFrame carries no frame metadata
+		// so the frame keeps timestamp 0 and is matched by its trigger
+		Mat m = pool.acquire(frameHeight, frameWidth, CV_16UC1);
+		if (getFrameTimeout != long(timeout.count())){
+			XC_Call(cam->SetPropertyValueL("_API_GETFRAME_TIMEOUT", long(timeout.count())), 1, 0, 0);
+			getFrameTimeout = long(timeout.count());
 		}
-		delete frameBuffer;
-		return m;
+		// returns as soon as the frame lands instead of polling every millisecond
+		XC_Call(cam->GetFrame(FT_NATIVE, XGF_Blocking, m.data, frameSize), 1, 0, 0);
+		return decimated(m);
 	}
 	catch (const runtime_error& e){
 		throw TriggeredCamError(serial, e.what());
 	}
 }
 
-//PG1394TriggeredCam::PG1394TriggeredCam(const uint32_t serial,
-//	const float& shutterSpeed,
-//	const bool &broadcast) : broadcast(broadcast), TriggeredCam(serial){
-PG1394TriggeredCam::PG1394TriggeredCam(const uint32_t serial, const bool broadcast) : broadcast(broadcast), TriggeredCam(serial){
+PG1394TriggeredCam::PG1394TriggeredCam(const uint32_t serial, const bool broadcast, const bool raw,
+	const CamSettings& settings) : TriggeredCam(serial), broadcast(broadcast), raw(raw), grabTimeout(READ_TIMEOUT_MS),
+	cycleStamps(false), lastCycle(0), cycleEpoch(0){
 	try{
 		DBG(cerr << "construct " << serial << endl);
 
 		// init gige cam from serial
+		const DeviceInfo dev = registry().find(BUS_PG, serial);
+		phase("enumerate");
 		PGRGuid guid;
-		BusManager bm;
-		PG_Call(bm.GetCameraFromSerialNumber(this->serial, &guid), 1, 0, 0);
-		PG_Call(cam.Connect(&guid), 1, 0, 0);
-		assert_throw(cam.IsConnected());
+		memcpy(guid.value, dev.guid, sizeof(guid.value));
+		try{
+			PG_Call(cam.Connect(&guid), 1, 0, 0);
+			assert_throw(cam.IsConnected());
+		}
+		catch (...){
+			// the device may be back under another guid by the next attempt
+			registry().invalidate(serial);
+			throw;
+		}
+		phase("connect");
 		try {
 			// ensure properties are set
 
@@ -204,23 +454,14 @@ PG1394TriggeredCam::PG1394TriggeredCam(const uint32_t serial, const bool broadca
 			PG_Call(cam.SetTriggerMode(&tm), 1, 100, 0);
 			}*/
 
-			Property prop;
-			prop.type = SHUTTER;
-			PG_Call(cam.GetProperty(&prop), 1, 0, 0);
-			assert_throw(!(prop.autoManualMode != false || round(prop.absValue) != 10));
-			/*if (prop.autoManualMode != false || prop.absValue != shutterSpeed) {
-			DBG(cerr << prop.autoManualMode << " " << prop.absValue << endl);
-			//prop.onOff = true;
-			prop.autoManualMode = false;
-			prop.absControl = true;
-			prop.absValue = shutterSpeed;
-			PG_Call(cam.SetProperty(&prop), 1, 100, 0);
-			}*/
+			setShutter(cam, settings.shutterMs);
 
-			// i dont understand exactly
+			// binning is a format7 mode of its own, mode 1 bins 2x2
+			assert_throw(settings.binning == 1 || settings.binning == 2);
+			const Mode mode = settings.binning == 2 ? MODE_1 : MODE_0;
 			Format7Info fm7Info;
 			bool supported;
-			fm7Info.mode = MODE_0;
+			fm7Info.mode = mode;
 			PG_Call(cam.GetFormat7Info(&fm7Info, &supported), 1, 0, 0);
 			assert_throw(supported);
 
@@ -228,43 +469,56 @@ PG1394TriggeredCam::PG1394TriggeredCam(const uint32_t serial, const bool broadca
 			Format7PacketInfo fm7PktInfo;
 			float pktPct;
 			PG_Call(cam.GetFormat7Configuration(&fm7ImSett, &fm7PktInfo.unitBytesPerPacket, &pktPct), 1, 0, 0);
-			assert_throw(!(fm7ImSett.height != 960 || fm7ImSett.width != 1280
-				|| fm7ImSett.offsetX != (fm7Info.maxWidth - fm7ImSett.width) / 2
-				|| fm7ImSett.offsetY
-				!= (fm7Info.maxHeight - fm7ImSett.height) / 2));
-			/*if (gigeSett.height != 960 || gigeSett.width != 1280
-			|| gigeSett.offsetX != (gigeInfo.maxWidth - gigeSett.width) / 2
-			|| gigeSett.offsetY
-			!= (gigeInfo.maxHeight - gigeSett.height) / 2) {
-			DBG(cerr << gigeSett.height << " " << gigeSett.width << " " << gigeSett.offsetY << " " << gigeSett.offsetX << endl);
-			gigeSett.height = 960;
-			gigeSett.width = 1280;
-			gigeSett.offsetX = (gigeInfo.maxWidth - gigeSett.width) / 2;
-			gigeSett.offsetY = (gigeInfo.maxHeight - gigeSett.height) / 2;
-			PG_Call(cam.SetGigEImageSettings(&gigeSett), 1, 100, 0);
-			}*/
-
-			/*GigEStreamChannel channel;
-			PG_Call(cam.GetGigEStreamChannelInfo(0, &channel), 1, 0, 0);
-			assert_throw(!(channel.interPacketDelay != pktDelay));*/
-			/*if (channel.interPacketDelay != pktDelay) {
-			DBG(cerr << channel.interPacketDelay << endl);
-			channel.interPacketDelay = pktDelay;
-			PG_Call(cam.SetGigEStreamChannelInfo(0, &channel), 1, 100, 0);
-			}*/
+			const unsigned int width = settings.width > 0 ? settings.width : fm7Info.maxWidth;
+			const unsigned int height = settings.height > 0 ? settings.height : fm7Info.maxHeight;
+			assert_throw(fm7Info.imageHStepSize == 0 || width % fm7Info.imageHStepSize == 0);
+			assert_throw(fm7Info.imageVStepSize == 0 || height % fm7Info.imageVStepSize == 0);
+			const unsigned int offsetX = roiOffset(settings.offsetX, width, fm7Info.maxWidth, fm7Info.offsetHStepSize);
+			const unsigned int offsetY = roiOffset(settings.offsetY, height, fm7Info.maxHeight, fm7Info.offsetVStepSize);
+			// raw mode reads the sensor's 8 bit mosaic, otherwise any format converts to BGR
+			const PixelFormat format = raw ? rawFormat(fm7Info.pixelFormatBitField) : fm7ImSett.pixelFormat;
+			if (fm7ImSett.mode != mode || fm7ImSett.height != height || fm7ImSett.width != width
+				|| fm7ImSett.offsetX != offsetX || fm7ImSett.offsetY != offsetY || fm7ImSett.pixelFormat != format) {
+				DBG(cerr << fm7ImSett.mode << " " << fm7ImSett.height << " " << fm7ImSett.width << " " << fm7ImSett.offsetY << " " << fm7ImSett.offsetX << endl);
+				fm7ImSett.mode = mode;
+				fm7ImSett.height = height;
+				fm7ImSett.width = width;
+				fm7ImSett.offsetX = offsetX;
+				fm7ImSett.offsetY = offsetY;
+				fm7ImSett.pixelFormat = format;
+				PG_Call(cam.SetFormat7Configuration(&fm7ImSett, pktPct), 1, 100, 0);
+			}
+			if (raw){
+				PG_Call(cam.GetFormat7Configuration(&fm7ImSett, &fm7PktInfo.unitBytesPerPacket, &pktPct), 1, 0, 0);
+				checkRawFormat(fm7ImSett.pixelFormat);
+				CameraInfo info;
+				PG_Call(cam.GetCameraInfo(&info), 1, 0, 0);
+				bayer = fm7ImSett.pixelFormat == PIXEL_FORMAT_RAW8 ? tilePattern(info.bayerTileFormat) : BAYER_NONE;
+			}
+			decimation = settings.decimation;
 
 			FC2Config config;
 			PG_Call(cam.GetConfiguration(&config), 1, 0, 0);
-			if (config.grabMode != DROP_FRAMES) {
+			if (config.grabMode != DROP_FRAMES || config.grabTimeout != READ_TIMEOUT_MS) {
 				DBG(cerr << config.grabMode << endl);
-				//config.grabTimeout = 250;
+				// RetrieveBuffer blocks until the frame lands or the timeout passes
+				config.grabTimeout = READ_TIMEOUT_MS;
 				config.grabMode = DROP_FRAMES;
 				PG_Call(cam.SetConfiguration(&config), 1, 100, 0);
 			}
 
-			camsleep(3000);
+			cycleStamps = embedCycleTime(cam);
+
+			phase("configure");
 
-			PG_Call(cam.StartCapture(), 1, 1000, 0);
+			// ready once the camera takes a trigger, instead of a fixed settle time
+			PG_Call(cam.StartCapture(), 1, 0, 0);
+			waitReady([this]{
+				uint32_t regVal;
+				PG_Call(cam.ReadRegister(REG_SOFTWARE_TRIGGER, &regVal), 1, 0, 0);
+				return regVal >> 31 == 0;
+			}, READY_TIMEOUT_MS, "trigger ready");
+			phase("capture");
 		}
 		catch (...) {
 			PG_Call(cam.Disconnect(), 1, 0, 0);
@@ -277,13 +531,19 @@ PG1394TriggeredCam::PG1394TriggeredCam(const uint32_t serial, const bool broadca
 }
 
 PG1394TriggeredCam::~PG1394TriggeredCam() {
+	DBG(cerr << "destroy " << serial << endl);
+	// a camera torn down after losing its link can't stop, disconnect it anyway
 	try{
-		DBG(cerr << "destroy " << serial << endl);
 		PG_Call(cam.StopCapture(), 1, 0, 0);
+	}
+	catch (const runtime_error& e){
+		cerr << TriggeredCamError(serial, e.what()).what() << endl;
+	}
+	try{
 		PG_Call(cam.Disconnect(), 1, 0, 0);
 	}
 	catch (const runtime_error& e){
-		throw TriggeredCamError(serial, e.what());
+		cerr << TriggeredCamError(serial, e.what()).what() << endl;
 	}
 }
 
@@ -300,34 +560,53 @@ void PG1394TriggeredCam::trigger() {
 	}
 }
 
-Mat PG1394TriggeredCam::read() {
+Mat PG1394TriggeredCam::read(const chrono::milliseconds& timeout) {
 	try{
 		DBG(cerr << "read " << serial << endl);
 		DBG(assert_throw(cam.IsConnected()));
-		Image image, convImage;
-		PG_Call(cam.RetrieveBuffer(&image), 1, 0, 0);
-		PG_Call(image.Convert(PIXEL_FORMAT_BGR, &convImage), 1, 0, 0);
-		return Mat(convImage.GetRows(), convImage.GetCols(), CV_8UC3,
-			convImage.GetData()).clone();
+		setGrabTimeout(cam, grabTimeout, int(timeout.count()));
+		PG_Call(cam.RetrieveBuffer(&rawImage), 1, 0, 0);
+		timestamp = 0;
+		if (cycleStamps){
+			timestamp = cycleTime(rawImage.GetTimeStamp(), lastCycle, cycleEpoch);
+			hideCycleTime(rawImage);
+		}
+		if (raw){
+			return decimated(readRaw(rawImage, pool, bayer));
+		}
+
+		// convert straight into a pooled buffer
+		Mat m = pool.acquire(rawImage.GetRows(), rawImage.GetCols(), CV_8UC3);
+		Image convImage(m.rows, m.cols, (unsigned int)m.step, m.data,
+			(unsigned int)(m.step * m.rows), PIXEL_FORMAT_BGR);
+		PG_Call(rawImage.Convert(PIXEL_FORMAT_BGR, &convImage), 1, 0, 0);
+		return decimated(m);
 	}
 	catch (const runtime_error& e){
 		throw TriggeredCamError(serial, e.what());
 	}
 }
 
-//PGTriggeredCam::PGTriggeredCam(const uint32_t serial,
-//	const float& shutterSpeed, const uint32_t pktDelay) :
-//	TriggeredCam(serial) {
-PGTriggeredCam::PGTriggeredCam(const uint32_t serial) : TriggeredCam(serial){
+PGTriggeredCam::PGTriggeredCam(const uint32_t serial, const bool raw, const CamSettings& settings) : TriggeredCam(serial), raw(raw), grabTimeout(READ_TIMEOUT_MS),
+	cycleStamps(false), lastCycle(0), cycleEpoch(0){
 	try{
 		DBG(cerr << "construct " << serial << endl);
 
 		// init gige cam from serial
+		const DeviceInfo dev = registry().find(BUS_PG, serial);
+		phase("enumerate");
 		PGRGuid guid;
-		BusManager bm;
-		PG_Call(bm.GetCameraFromSerialNumber(this->serial, &guid), 1, 0, 0);
-		PG_Call(cam.Connect(&guid), 1, 0, 0);
-		assert_throw(cam.IsConnected());
+		memcpy(guid.value, dev.guid, sizeof(guid.value));
+		try{
+			PG_Call(cam.Connect(&guid), 1, 0, 0);
+			assert_throw(cam.IsConnected());
+		}
+		catch (...){
+			// the device may be back under another guid by the next attempt
+			registry().invalidate(serial);
+			throw;
+		}
+		phase("connect");
 		try {
 			// ensure properties are set
 
@@ -355,60 +634,79 @@ PGTriggeredCam::PGTriggeredCam(const uint32_t serial) : TriggeredCam(serial){
 				PG_Call(cam.SetTriggerMode(&tm), 1, 100, 0);
 				}*/
 
-			Property prop;
-			prop.type = SHUTTER;
-			PG_Call(cam.GetProperty(&prop), 1, 0, 0);
-			assert_throw(!(prop.autoManualMode != false || prop.absValue != 10));
-			/*if (prop.autoManualMode != false || prop.absValue != shutterSpeed) {
-				DBG(cerr << prop.autoManualMode << " " << prop.absValue << endl);
-				//prop.onOff = true;
-				prop.autoManualMode = false;
-				prop.absControl = true;
-				prop.absValue = shutterSpeed;
-				PG_Call(cam.SetProperty(&prop), 1, 100, 0);
-				}*/
+			setShutter(cam, settings.shutterMs);
+
+			// binning first, the roi limits follow from it
+			unsigned int hBin, vBin;
+			PG_Call(cam.GetGigEImageBinningSettings(&hBin, &vBin), 1, 0, 0);
+			if (hBin != unsigned(settings.binning) || vBin != unsigned(settings.binning)) {
+				DBG(cerr << hBin << " " << vBin << endl);
+				PG_Call(cam.SetGigEImageBinningSettings(settings.binning, settings.binning), 1, 100, 0);
+			}
 
 			GigEImageSettings gigeSett;
 			GigEImageSettingsInfo gigeInfo;
 			PG_Call(cam.GetGigEImageSettings(&gigeSett), 1, 0, 0);
 			PG_Call(cam.GetGigEImageSettingsInfo(&gigeInfo), 1, 0, 0);
-			assert_throw(!(gigeSett.height != 960 || gigeSett.width != 1280
-				|| gigeSett.offsetX != (gigeInfo.maxWidth - gigeSett.width) / 2
-				|| gigeSett.offsetY
-				!= (gigeInfo.maxHeight - gigeSett.height) / 2));
-			/*if (gigeSett.height != 960 || gigeSett.width != 1280
-				|| gigeSett.offsetX != (gigeInfo.maxWidth - gigeSett.width) / 2
-				|| gigeSett.offsetY
-				!= (gigeInfo.maxHeight - gigeSett.height) / 2) {
+			const unsigned int width = settings.width > 0 ? settings.width : gigeInfo.maxWidth;
+			const unsigned int height = settings.height > 0 ? settings.height : gigeInfo.maxHeight;
+			assert_throw(gigeInfo.imageHStepSize == 0 || width % gigeInfo.imageHStepSize == 0);
+			assert_throw(gigeInfo.imageVStepSize == 0 || height % gigeInfo.imageVStepSize == 0);
+			const unsigned int offsetX = roiOffset(settings.offsetX, width, gigeInfo.maxWidth, gigeInfo.offsetHStepSize);
+			const unsigned int offsetY = roiOffset(settings.offsetY, height, gigeInfo.maxHeight, gigeInfo.offsetVStepSize);
+			// raw mode reads the sensor's 8 bit mosaic, otherwise any format converts to BGR
+			const PixelFormat format = raw ? rawFormat(gigeInfo.pixelFormatBitField) : gigeSett.pixelFormat;
+			if (gigeSett.height != height || gigeSett.width != width
+				|| gigeSett.offsetX != offsetX || gigeSett.offsetY != offsetY || gigeSett.pixelFormat != format) {
 				DBG(cerr << gigeSett.height << " " << gigeSett.width << " " << gigeSett.offsetY << " " << gigeSett.offsetX << endl);
-				gigeSett.height = 960;
-				gigeSett.width = 1280;
-				gigeSett.offsetX = (gigeInfo.maxWidth - gigeSett.width) / 2;
-				gigeSett.offsetY = (gigeInfo.maxHeight - gigeSett.height) / 2;
+				gigeSett.height = height;
+				gigeSett.width = width;
+				gigeSett.offsetX = offsetX;
+				gigeSett.offsetY = offsetY;
+				gigeSett.pixelFormat = format;
 				PG_Call(cam.SetGigEImageSettings(&gigeSett), 1, 100, 0);
-				}*/
+			}
+			if (raw){
+				PG_Call(cam.GetGigEImageSettings(&gigeSett), 1, 0, 0);
+				checkRawFormat(gigeSett.pixelFormat);
+				CameraInfo info;
+				PG_Call(cam.GetCameraInfo(&info), 1, 0, 0);
+				bayer = gigeSett.pixelFormat == PIXEL_FORMAT_RAW8 ? tilePattern(info.bayerTileFormat) : BAYER_NONE;
+			}
+			decimation = settings.decimation;
 
 			GigEStreamChannel channel;
 			PG_Call(cam.GetGigEStreamChannelInfo(0, &channel), 1, 0, 0);
-			assert_throw(!(channel.interPacketDelay != 1000));
-			/*if (channel.interPacketDelay != pktDelay) {
-				DBG(cerr << channel.interPacketDelay << endl);
-				channel.interPacketDelay = pktDelay;
+			if (channel.interPacketDelay != settings.packetDelay
+				|| (settings.packetSize > 0 && channel.packetSize != settings.packetSize)) {
+				DBG(cerr << channel.packetSize << " " << channel.interPacketDelay << endl);
+				channel.packetSize = settings.packetSize > 0 ? settings.packetSize : channel.packetSize;
+				channel.interPacketDelay = settings.packetDelay;
 				PG_Call(cam.SetGigEStreamChannelInfo(0, &channel), 1, 100, 0);
-				}*/
+			}
 
 			FC2Config config;
 			PG_Call(cam.GetConfiguration(&config), 1, 0, 0);
-			if (config.grabMode != DROP_FRAMES) {
+			if (config.grabMode != DROP_FRAMES || config.grabTimeout != READ_TIMEOUT_MS) {
 				DBG(cerr << config.grabMode << endl);
-				//config.grabTimeout = 250;
+				// RetrieveBuffer blocks until the frame lands or the timeout passes
+				config.grabTimeout = READ_TIMEOUT_MS;
 				config.grabMode = DROP_FRAMES;
 				PG_Call(cam.SetConfiguration(&config), 1, 100, 0);
 			}
 
-			camsleep(3000);
+			cycleStamps = embedCycleTime(cam);
 
-			PG_Call(cam.StartCapture(), 1, 1000, 0);
+			phase("configure");
+
+			// ready once the camera takes a trigger, instead of a fixed settle time
+			PG_Call(cam.StartCapture(), 1, 0, 0);
+			waitReady([this]{
+				uint32_t regVal;
+				PG_Call(cam.ReadRegister(REG_SOFTWARE_TRIGGER, &regVal), 1, 0, 0);
+				return regVal >> 31 == 0;
+			}, READY_TIMEOUT_MS, "trigger ready");
+			phase("capture");
 		}
 		catch (...) {
 			PG_Call(cam.Disconnect(), 1, 0, 0);
@@ -421,13 +719,19 @@ PGTriggeredCam::PGTriggeredCam(const uint32_t serial) : TriggeredCam(serial){
 }
 
 PGTriggeredCam::~PGTriggeredCam() {
+	DBG(cerr << "destroy " << serial << endl);
+	// a camera torn down after losing its link can't stop, disconnect it anyway
 	try{
-		DBG(cerr << "destroy " << serial << endl);
 		PG_Call(cam.StopCapture(), 1, 0, 0);
+	}
+	catch (const runtime_error& e){
+		cerr << TriggeredCamError(serial, e.what()).what() << endl;
+	}
+	try{
 		PG_Call(cam.Disconnect(), 1, 0, 0);
 	}
 	catch (const runtime_error& e){
-		throw TriggeredCamError(serial, e.what());
+		cerr << TriggeredCamError(serial, e.what()).what() << endl;
 	}
 }
 
@@ -442,15 +746,27 @@ void PGTriggeredCam::trigger() {
 	}
 }
 
-Mat PGTriggeredCam::read() {
+Mat PGTriggeredCam::read(const chrono::milliseconds& timeout) {
 	try{
 		DBG(cerr << "read " << serial << endl);
 		DBG(assert_throw(cam.IsConnected()));
-		Image image, convImage;
-		PG_Call(cam.RetrieveBuffer(&image), 1, 0, 0);
-		PG_Call(image.Convert(PIXEL_FORMAT_BGR, &convImage), 1, 0, 0);
-		return Mat(convImage.GetRows(), convImage.GetCols(), CV_8UC3,
-			convImage.GetData()).clone();
+		setGrabTimeout(cam, grabTimeout, int(timeout.count()));
+		PG_Call(cam.RetrieveBuffer(&rawImage), 1, 0, 0);
+		timestamp = 0;
+		if (cycleStamps){
+			timestamp = cycleTime(rawImage.GetTimeStamp(), lastCycle, cycleEpoch);
+			hideCycleTime(rawImage);
+		}
+		if (raw){
+			return decimated(readRaw(rawImage, pool, bayer));
+		}
+
+		// convert straight into a pooled buffer
+		Mat m = pool.acquire(rawImage.GetRows(), rawImage.GetCols(), CV_8UC3);
+		Image convImage(m.rows, m.cols, (unsigned int)m.step, m.data,
+			(unsigned int)(m.step * m.rows), PIXEL_FORMAT_BGR);
+		PG_Call(rawImage.Convert(PIXEL_FORMAT_BGR, &convImage), 1, 0, 0);
+		return decimated(m);
 	}
 	catch (const runtime_error& e){
 		throw TriggeredCamError(serial, e.what());
@@ -19,8 +19,15 @@ an attempt at making this platform independent
 
 #include <XCamera.h>
 #include <opencv2/core/core.hpp>
+#include "FramePool.h"
+#include "Debayer.h"
 #include <stdint.h>
 #include <stdexcept>
+#include <string>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <thread>
 
 #ifndef _DEBUG                  /* For RELEASE builds */
 #define DBG(expr)  do {;} while (0)
@@ -28,21 +35,141 @@ an attempt at making this platform independent
 #define  DBG(expr) do { expr; } while (0)
 #endif
 
+/*
+a step of a camera's constructor and how long it took
+*/
+struct StartupPhase{
+	std::string name;
+	double ms;
+};
+
+/*
+acquisition parameters a camera is brought to when it is opened
+*/
+struct CamSettings{
+	CamSettings(const int width = 0, const int height = 0) :
+		shutterMs(10), width(width), height(height), offsetX(-1), offsetY(-1),
+		binning(1), decimation(1), packetSize(0), packetDelay(1000) {
+	}
+	double shutterMs;     // manual exposure, PG only
+	int width, height;    // roi of the binned sensor, 0 is all of it
+	int offsetX, offsetY; // roi origin, < 0 centers the roi
+	int binning;          // pixels summed per axis on the camera, less to transfer
+	int decimation;       // every n-th pixel (2x2 tile of a mosaic) is kept, on the host
+	uint32_t packetSize;  // GigE stream packet size in bytes, 0 keeps the camera's
+	uint32_t packetDelay; // GigE inter-packet delay in the camera's ticks, not used on 1394
+};
+
 /*
 base for all triggered cameras
 */
 class TriggeredCam {
 public:
 	TriggeredCam(const uint32_t serial) :
-		serial(serial) {
+		serial(serial), bayer(BAYER_NONE), timestamp(0), decimation(1),
+		phaseStart(std::chrono::steady_clock::now()) {
 	}
 	virtual ~TriggeredCam() {
 	}
 	virtual void
 		trigger() = 0;
+	/*
+	blocks until the frame of the last trigger() has arrived and returns it right
+	away, throws TriggeredCamError once timeout has passed without it
+	*/
 	virtual cv::Mat
-		read() = 0;
+		read(const std::chrono::milliseconds& timeout) = 0;
+	cv::Mat
+		read() {
+		return read(std::chrono::milliseconds(READ_TIMEOUT_MS));
+	}
+	const FramePool&
+		framePool() const {
+		return decimation > 1 ? decimatedPool : pool;
+	}
+	/*
+	mosaic layout of the frames read() returns, BAYER_NONE unless the camera
+	hands out raw sensor frames
+	*/
+	BayerPattern
+		bayerPattern() const {
+		return bayer;
+	}
+	/*
+	camera clock time of the frame read() returned last in nanoseconds, 0 for
+	cameras without a usable clock
+	*/
+	int64_t
+		deviceTimestamp() const {
+		return timestamp;
+	}
+	/*
+	where the constructor's time went, in order
+	*/
+	const std::vector<StartupPhase>&
+		startupPhases() const {
+		return phases;
+	}
 	const uint32_t serial;
+protected:
+	/*
+	ends the current startup phase, the next one starts now
+	*/
+	void
+		phase(const std::string& name) {
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		StartupPhase p;
+		p.name = name;
+		p.ms = std::chrono::duration<double, std::milli>(now - phaseStart).count();
+		phases.push_back(p);
+		phaseStart = now;
+	}
+	/*
+	polls ready() every pollMs until it holds, in place of fixed settle sleeps
+	throws once timeoutMs have passed
+	*/
+	static void
+		waitReady(const std::function<bool()>& ready, const int timeoutMs,
+		const std::string& what, const int pollMs = 5) {
+		const std::chrono::steady_clock::time_point deadline =
+			std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+		while (!ready()){
+			if (std::chrono::steady_clock::now() >= deadline){
+				std::stringstream ss;
+				ss << "timed out after " << timeoutMs << " ms waiting for " << what;
+				throw std::runtime_error(ss.str());
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(pollMs));
+		}
+	}
+
+	// how long a camera may take to become ready after StartCapture
+	static const int READY_TIMEOUT_MS = 5000;
+	// how long read() waits for a frame, the SDKs are configured with it at startup
+	static const int READ_TIMEOUT_MS = 1000;
+	/*
+	m as read() hands it out, reduced by the decimation factor into a buffer
+	of a pool of its own so full frames keep recycling
+	*/
+	cv::Mat
+		decimated(const cv::Mat& m) {
+		if (decimation == 1){
+			return m;
+		}
+		const cv::Size size = decimatedSize(m.size(), decimation, bayer);
+		cv::Mat d = decimatedPool.acquire(size.height, size.width, m.type());
+		decimate(m, decimation, bayer, d);
+		return d;
+	}
+	// buffers handed out by read(), recycled once the caller drops the frame
+	FramePool pool;
+	BayerPattern bayer;
+	int64_t timestamp;
+	int decimation;
+	FramePool decimatedPool;
+private:
+	std::vector<StartupPhase> phases;
+	std::chrono::steady_clock::time_point phaseStart;
 };
 
 /*
@@ -50,31 +177,50 @@ GigE point grey triggered camera
 */
 class PGTriggeredCam : public TriggeredCam {
 public:
-	//PGTriggeredCam(const uint32_t serial, const float& shutterSpeed,
-	//	const uint32_t pktDelay);
-	PGTriggeredCam(const uint32_t serial);
+	/*
+	raw returns the sensor buffer as a CV_8UC1 mosaic instead of converting
+	every frame to BGR on the grab thread
+	*/
+	PGTriggeredCam(const uint32_t serial, const bool raw = false,
+		const CamSettings& settings = CamSettings(1280, 960));
 	virtual
 		~PGTriggeredCam();
 	virtual void
 		trigger();
+	using TriggeredCam::read;
 	virtual cv::Mat
-		read();
+		read(const std::chrono::milliseconds& timeout);
 private:
 	static const uint32_t REG_CAM_POWER = 0x610;
+	static const uint32_t REG_SOFTWARE_TRIGGER = 0x62C; // bit 31 is set while a trigger can't be taken
 	FlyCapture2::GigECamera cam;
+	FlyCapture2::Image rawImage;
+	const bool raw;
+	int grabTimeout; // ms RetrieveBuffer blocks for, as configured on the camera
+	bool cycleStamps;   // frames carry the camera's cycle timer, see cycleTime()
+	int64_t lastCycle;  // cycle time of the previous frame, to count wraps
+	int64_t cycleEpoch; // ns of cycle timer wraps so far
 };
 
 class PG1394TriggeredCam : public TriggeredCam{
 public:
-	//PG1394TriggeredCam(const uint32_t serial, const float& shutterSpeed, const bool &broadcast);
-	PG1394TriggeredCam(const uint32_t serial, const bool broadcast);
+	PG1394TriggeredCam(const uint32_t serial, const bool broadcast, const bool raw = false,
+		const CamSettings& settings = CamSettings(1280, 960));
 	virtual ~PG1394TriggeredCam();
 	virtual void trigger();
-	virtual cv::Mat read();
+	using TriggeredCam::read;
+	virtual cv::Mat read(const std::chrono::milliseconds& timeout);
 private:
 	static const uint32_t REG_CAM_POWER = 0x610;
+	static const uint32_t REG_SOFTWARE_TRIGGER = 0x62C;
 	FlyCapture2::Camera cam;
+	FlyCapture2::Image rawImage;
 	bool broadcast;
+	const bool raw;
+	int grabTimeout;
+	bool cycleStamps;
+	int64_t lastCycle;
+	int64_t cycleEpoch;
 };
 
 /*
@@ -82,16 +228,17 @@ GigE xenics triggered camera
 */
 class XCTriggeredCam : public TriggeredCam {
 public:
-	//XCTriggeredCam(const uint32_t serial, const uint32_t pktDelay);
-	XCTriggeredCam(const uint32_t serial);
+	XCTriggeredCam(const uint32_t serial, const CamSettings& settings = CamSettings());
 	virtual
 		~XCTriggeredCam();
 	virtual void
 		trigger();
+	using TriggeredCam::read;
 	virtual cv::Mat
-		read();
+		read(const std::chrono::milliseconds& timeout);
 private:
 	cv::Ptr<XCamera> cam;
+	long getFrameTimeout; // ms a blocking GetFrame waits for, as configured on the camera
 	dword frameSize;
 	dword frameWidth;
 	dword frameHeight;
@@ -137,6 +284,7 @@ assert that throws an exception
 
 /*
 calls PG or XC functions with multiple "tries" and sleeps for "passms" or "failms" depending on success of call
+a pause of 0 doesn't sleep at all, waiting on the device belongs to blocking SDK calls
 */
 #define PG_Call(expr, tries, passms, failms) \
 { \
@@ -146,14 +294,15 @@ calls PG or XC functions with multiple "tries" and sleeps for "passms" or "failm
 	for (i = 0; i < (tries); i++){ \
 		try{ \
 			PG_CheckError(expr); \
-			camsleep((passms)); \
+			if ((passms) > 0) \
+				camsleep((passms)); \
 			break; \
 		} \
 		catch (const PGError& pge){ \
 			DBG(cerr << "try " << i + 1 << ": " << pge.what() << endl); \
 			if( i + 1 >= (tries)) \
 				throw; \
-												else \
+												else if ((failms) > 0) \
 				camsleep((failms)); \
 		} \
 			} \
@@ -167,14 +316,15 @@ calls PG or XC functions with multiple "tries" and sleeps for "passms" or "failm
 	for (i = 0; i < (tries); i++){ \
 		try{ \
 			XC_CheckError(expr); \
-			camsleep((passms)); \
+			if ((passms) > 0) \
+				camsleep((passms)); \
 			break; \
 		} \
 		catch (const XCError& xce){ \
 			DBG(cerr << "try " << i + 1 << ": " << xce.what() << endl); \
 			if( i + 1 >= (tries)) \
 				throw; \
-												else \
+												else if ((failms) > 0) \
 				camsleep((failms)); \
 		} \
 			} \
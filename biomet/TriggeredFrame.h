@@ -0,0 +1,52 @@
+#include "stdafx.h"
+
+#ifndef TRIGGEREDFRAME_H_
+#define TRIGGEREDFRAME_H_
+
+#include "Debayer.h"
+#include <opencv2/core/core.hpp>
+#include <stdint.h>
+#include <chrono>
+
+/*
+points on a frame's way through the pipeline, stamped in nanoseconds on the
+monotonic clock, 0 while not reached
+*/
+enum FrameStamp{
+	STAMP_TRIGGER = 0, // before trigger()
+	STAMP_READ,        // read() returned
+	STAMP_DISPATCH,    // handed from the acquisition engine to the stages
+	STAMP_WRITE,       // appended to its sequence file
+	STAMP_RENDER,      // shown as part of a mosaic
+	STAMPS
+};
+
+/*
+triggered frame structure passed between nodes
+*/
+struct TriggeredFrame{
+	TriggeredFrame() :
+		flags(0), frame_no(0), serial(0), bayer(BAYER_NONE), deviceStamp(0), captured(0) {
+		for (int i = 0; i < STAMPS; i++){
+			stamps[i] = 0;
+		}
+	}
+	uint64_t flags;
+	int frame_no;
+	uint32_t serial;
+	BayerPattern bayer; // mosaic layout of a raw frame, BAYER_NONE once demosaiced
+	int64_t stamps[STAMPS];
+	int64_t deviceStamp; // camera clock in ns, 0 for cameras without one
+	int64_t captured;    // exposure on the host clock, deviceStamp mapped over or the trigger stamp
+	cv::Mat frame;
+	static int getTag(const TriggeredFrame& f){
+		return f.frame_no;
+	};
+	// current time in the units of stamps
+	static int64_t now(){
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+};
+
+#endif /* TRIGGEREDFRAME_H_ */
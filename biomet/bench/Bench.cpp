@@ -0,0 +1,42 @@
+#include "stdafx.h"
+
+#include "Bench.h"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+using namespace boost::filesystem;
+
+Mat syntheticFrame(const int rows, const int cols, const int type, const int seed){
+	Mat m(rows, cols, type);
+	for (int y = 0; y < rows; y++){
+		uchar *p = m.ptr(y);
+		for (size_t x = 0; x < cols * m.elemSize(); x++){
+			p[x] = uchar((x * 7 + y * 3 + seed) & 0xff);
+		}
+	}
+	return m;
+}
+
+void report(const string& name, const size_t frames, const uint64_t bytes, const double s){
+	cout << left << setw(28) << name << right
+		<< setw(10) << fixed << setprecision(1) << frames / s << " frames/s"
+		<< setw(10) << bytes / s / (1 << 20) << " MB/s" << endl;
+}
+
+double percentile(vector<double>& samples, const double p){
+	if (samples.empty()){
+		return 0;
+	}
+	sort(samples.begin(), samples.end());
+	const size_t i = min(samples.size() - 1, size_t(p / 100. * (samples.size() - 1) + .5));
+	return samples[i];
+}
+
+void writeText(const path& p, const string& text){
+	std::ofstream os(p.string().c_str(), ios::binary | ios::trunc);
+	os << text;
+}
@@ -0,0 +1,72 @@
+#include "stdafx.h"
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <opencv2/core/core.hpp>
+#include <boost/filesystem.hpp>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <stdint.h>
+
+/*
+benchmarks of camcap_bench, run as `camcap_bench <name> [args]`
+each one prints its measurements and a one line verdict, and returns
+EXIT_FAILURE when the property it checks doesn't hold
+*/
+
+/*
+synthetic frames shaped like the rig's cameras
+*/
+cv::Mat syntheticFrame(const int rows, const int cols, const int type, const int seed);
+
+/*
+frames/s and MB/s of frames totalling bytes written in s seconds
+*/
+void report(const std::string& name, const size_t frames, const uint64_t bytes, const double s);
+
+/*
+p-th percentile (0-100) of samples, which get sorted
+*/
+double percentile(std::vector<double>& samples, const double p);
+
+void writeText(const boost::filesystem::path& p, const std::string& text);
+
+// StorageBench.cpp
+int bench_sequence(int argc, char **argv);
+int bench_io(int argc, char **argv);
+int bench_codec(int argc, char **argv);
+
+// ImageBench.cpp
+int bench_normalize(int argc, char **argv);
+int bench_bayer(int argc, char **argv);
+int bench_pool(int argc, char **argv);
+
+// GraphBench.cpp
+int bench_metrics(int argc, char **argv);
+int bench_graph(int argc, char **argv);
+int bench_headless(int argc, char **argv);
+int bench_preview(int argc, char **argv);
+int bench_display(int argc, char **argv);
+int bench_soak(int argc, char **argv);
+
+// CameraBench.cpp
+int bench_startup(int argc, char **argv);
+int bench_discovery(int argc, char **argv);
+int bench_reconnect(int argc, char **argv);
+int bench_scaling(int argc, char **argv);
+int bench_read(int argc, char **argv);
+int bench_rig(int argc, char **argv);
+int bench_roi(int argc, char **argv);
+int bench_calibrate(int argc, char **argv);
+int bench_trigger(int argc, char **argv);
+
+// SyncBench.cpp
+int bench_sync(int argc, char **argv);
+int bench_partial(int argc, char **argv);
+int bench_synccost(int argc, char **argv);
+
+#endif /* BENCH_H_ */
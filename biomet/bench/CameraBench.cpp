@@ -0,0 +1,745 @@
+#include "stdafx.h"
+
+#include "Bench.h"
+#include "TriggeredCam.h"
+#include "Pipeline.h"
+#include "SimulatedCam.h"
+#include "Startup.h"
+#include "DeviceRegistry.h"
+#include "Acquisition.h"
+#include "Supervisor.h"
+#include "RigConfig.h"
+#include "Calibration.h"
+#include "Scheduler.h"
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <cmath>
+
+using namespace std;
+using namespace cv;
+using namespace boost::filesystem;
+
+/*
+camera bring-up one after another against openCameras(), on simulated cameras
+whose startup times are spread up to `ms`. the parallel bring-up is checked to
+be bounded by the slowest camera rather than the sum
+*/
+int bench_startup(int argc, char **argv){
+	const size_t n = argc > 0 ? size_t(atoi(argv[0])) : 4;
+	const double ms = argc > 1 ? atof(argv[1]) : 400;
+	vector<CamOpener> openers;
+	double slowest = 0, sum = 0;
+	for (size_t i = 0; i < n; i++){
+		SimulatedTriggeredCam::Config config;
+		config.rows = 240;
+		config.cols = 320;
+		config.startupMs = ms * (i + 1) / n;
+		slowest = max(slowest, config.startupMs);
+		sum += config.startupMs;
+		openers.push_back([=]{ return new SimulatedTriggeredCam(uint32_t(i), config); });
+	}
+	cout << n << " cameras, startup " << ms / n << ".." << ms << " ms each, sum "
+		<< fixed << setprecision(0) << sum << " ms" << endl;
+
+	double s = double(getTickCount());
+	{
+		vector<Ptr<TriggeredCam> > cams;
+		for (size_t i = 0; i < openers.size(); i++){
+			cams.push_back(openers[i]());
+		}
+	}
+	const double sequential = (getTickCount() - s) / getTickFrequency() * 1000;
+
+	s = double(getTickCount());
+	const vector<Ptr<TriggeredCam> > cams = openCameras(openers);
+	const double parallel = (getTickCount() - s) / getTickFrequency() * 1000;
+	printStartup(cams, cout);
+
+	// a few ms per camera for thread start-up and polling
+	const bool ok = parallel < slowest + 20 + 2 * n;
+	cout << "  sequential " << sequential << " ms, parallel " << parallel << " ms, slowest camera "
+		<< slowest << " ms" << endl
+		<< "  parallel bring-up " << (ok ? "bounded by the slowest camera" : "NOT BOUNDED by the slowest camera") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+discovery of a rig where every camera enumerates the bus itself, against one
+shared registry, plus the bounded refresh for a camera that shows up late and
+one that never does, and a rescan after a camera fails to connect
+*/
+int bench_discovery(int argc, char **argv){
+	const size_t n = argc > 0 ? size_t(atoi(argv[0])) : 8;
+	const double ms = argc > 1 ? atof(argv[1]) : 100;
+	cout << n << " cameras, " << ms << " ms per bus scan" << endl;
+
+	double elapsed[2];
+	uint64_t scans[2];
+	for (int shared = 0; shared < 2; shared++){
+		Ptr<SimulatedEnumerator> bus = new SimulatedEnumerator(ms);
+		DeviceRegistry registry;
+		registry.setEnumerator(BUS_PG, bus);
+		vector<Ptr<DeviceRegistry> > own;
+		vector<CamOpener> openers;
+		for (size_t i = 0; i < n; i++){
+			bus->add(uint32_t(i));
+			SimulatedTriggeredCam::Config config;
+			config.rows = 240;
+			config.cols = 320;
+			if (shared){
+				config.registry = &registry;
+			}
+			else{
+				// what each constructor used to do, a discovery of its own
+				own.push_back(new DeviceRegistry());
+				own.back()->setEnumerator(BUS_PG, bus);
+				config.registry = own.back();
+			}
+			openers.push_back([=]{ return new SimulatedTriggeredCam(uint32_t(i), config); });
+		}
+		double s = double(getTickCount());
+		const vector<Ptr<TriggeredCam> > cams = openCameras(openers);
+		elapsed[shared] = (getTickCount() - s) / getTickFrequency() * 1000;
+		scans[shared] = bus->scans();
+		cout << (shared ? "  shared registry  " : "  per camera       ") << fixed << setprecision(0)
+			<< elapsed[shared] << " ms, " << scans[shared] << " scans" << endl;
+	}
+
+	Ptr<SimulatedEnumerator> bus = new SimulatedEnumerator(ms);
+	DeviceRegistry registry;
+	registry.setEnumerator(BUS_XC, bus);
+	const double lateMs = 300;
+	thread boot([&]{
+		this_thread::sleep_for(chrono::milliseconds(int64_t(lateMs)));
+		bus->add(7);
+	});
+	double s = double(getTickCount());
+	bool late = false;
+	try{
+		late = registry.find(BUS_XC, 7, 2000).serial == 7;
+	}
+	catch (const exception& e){
+		cerr << e.what() << endl;
+	}
+	const double lateFound = (getTickCount() - s) / getTickFrequency() * 1000;
+	boot.join();
+	s = double(getTickCount());
+	bool missing = false;
+	try{
+		registry.find(BUS_XC, 8, 500);
+	}
+	catch (const runtime_error&){
+		missing = true;
+	}
+	const double missingFailed = (getTickCount() - s) / getTickFrequency() * 1000;
+	cout << "  late camera found after " << lateFound << " ms, missing camera given up after "
+		<< missingFailed << " ms, " << bus->scans() << " scans" << endl;
+
+	// a camera that can't connect at its cached address is looked up again
+	// when it is next opened, a camera that connects is served from the cache
+	SimulatedTriggeredCam::Config config;
+	config.rows = 240;
+	config.cols = 320;
+	config.registry = &registry;
+	config.bus = BUS_XC;
+	config.outage = make_shared<SimulatedOutage>();
+	config.outage->unplug(1e9);
+	const uint64_t cached = bus->scans();
+	bool refused = false;
+	try{
+		SimulatedTriggeredCam cam(7, config);
+	}
+	catch (const TriggeredCamError&){
+		refused = true;
+	}
+	registry.find(BUS_XC, 7);
+	const uint64_t rescans = bus->scans() - cached;
+	registry.find(BUS_XC, 7);
+	const bool rediscovered = refused && rescans == 1 && bus->scans() - cached == 1;
+	cout << "  failed connect rescanned the bus " << rescans << " times" << endl;
+
+	const bool ok = scans[1] == 1 && scans[0] == n && late && missing && rediscovered
+		&& lateFound < lateMs + 200 + 2 * ms && missingFailed < 500 + ms + 50;
+	cout << "  discovery " << (ok ? "as expected" : "NOT AS EXPECTED") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+one camera unplugged for a while among healthy ones. it has to be reopened
+with backoff once it is back, looked up on the bus again for every attempt,
+while the healthy cameras keep their cadence
+*/
+int bench_reconnect(int argc, char **argv){
+	const size_t n = argc > 0 ? size_t(atoi(argv[0])) : 4;
+	const double fps = argc > 1 ? atof(argv[1]) : 30;
+	const double seconds = argc > 2 ? atof(argv[2]) : 6;
+	const double outageS = argc > 3 ? atof(argv[3]) : 2;
+	const int ticks = int(seconds * fps);
+	cout << n << " cameras at " << fps << " fps, camera 0 unplugged after 1 s for " << outageS << " s" << endl;
+
+	shared_ptr<SimulatedOutage> outage = make_shared<SimulatedOutage>();
+	// discovered like the hardware cameras, through the process-wide registry
+	Ptr<SimulatedEnumerator> bus = new SimulatedEnumerator();
+	DeviceRegistry::instance().setEnumerator(BUS_PG, bus);
+	vector<Ptr<TriggeredCam> > cams;
+	vector<CamOpener> openers;
+	for (size_t i = 0; i < n; i++){
+		bus->add(uint32_t(i));
+		SimulatedTriggeredCam::Config config;
+		config.rows = 64;
+		config.cols = 64;
+		config.bayer = BAYER_NONE;
+		config.latencyMs = 5;
+		config.jitterMs = 1;
+		config.startupMs = 50;
+		config.registry = &DeviceRegistry::instance();
+		if (i == 0){
+			config.outage = outage;
+		}
+		const uint32_t s = uint32_t(i);
+		openers.push_back([=]{ return new SimulatedTriggeredCam(s, config); });
+		cams.push_back(openers.back()());
+	}
+	SupervisorConfig supervision;
+	supervision.backoffMs = 100;
+	supervision.maxBackoffMs = 800;
+	AcquisitionEngine engine(cams, fps, ticks, 4, openers, supervision);
+	cams.clear();
+	const chrono::steady_clock::time_point started = chrono::steady_clock::now();
+	const uint64_t scans = bus->scans();
+	engine.start([](const TriggeredFrame&){});
+	this_thread::sleep_for(chrono::seconds(1));
+	outage->unplug(outageS * 1000);
+	while (!engine.done()){
+		this_thread::sleep_for(chrono::milliseconds(10));
+	}
+	engine.stop();
+	const double s = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+	bool ok = true;
+	uint64_t attempts = 0;
+	const vector<AcquisitionEngine::CamStats> cs = engine.stats();
+	cout << left << setw(8) << "camera" << right << setw(8) << "read" << setw(8) << "failed" << setw(8) << "skipped"
+		<< setw(8) << "downs" << setw(10) << "attempts" << setw(8) << "down s" << setw(8) << "avail" << endl;
+	for (size_t i = 0; i < cs.size(); i++){
+		const CamSupervisor::Stats& h = cs[i].health;
+		cout << left << setw(8) << cs[i].serial << right << setw(8) << cs[i].read << setw(8) << cs[i].failed
+			<< setw(8) << cs[i].skipped << setw(8) << h.disconnects << setw(10) << h.attempts << fixed << setprecision(2)
+			<< setw(8) << h.downSeconds << setw(8) << h.availability << endl;
+		cout.unsetf(ios::floatfield);
+		if (i == 0){
+			// back within a backoff period or two of the cable going back in
+			// and every reopen looked the camera up again instead of trusting the cache
+			ok = ok && h.up && h.disconnects == 1 && h.reconnects == 1
+				&& h.downSeconds < outageS + 1 && h.availability < 1 && bus->scans() - scans == h.attempts;
+			attempts = h.attempts;
+		}
+		else{
+			ok = ok && h.disconnects == 0 && cs[i].read >= uint64_t(ticks) * 95 / 100;
+		}
+	}
+	cout << "  " << bus->scans() - scans << " bus scans for " << attempts << " reopen attempts" << endl;
+	cout << "  " << fixed << setprecision(2) << s << " s for " << ticks << " ticks" << endl;
+	cout << "  supervisor " << (ok ? "reconnected the camera, healthy cameras kept their cadence" : "FAILED TO RECOVER") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+total frame rate against the number of cameras, with camera 0 taking longer
+than a frame period to deliver. the old lock-step loop triggered every camera,
+read every camera and only then started the next frame, so the slowest camera
+set the rate of the rig. on their own grab threads the total has to grow with
+every camera added and the others have to keep the requested rate
+*/
+int bench_scaling(int argc, char **argv){
+	const size_t maxCams = argc > 0 ? size_t(atoi(argv[0])) : 16;
+	const double fps = argc > 1 ? atof(argv[1]) : 30;
+	const double seconds = argc > 2 ? atof(argv[2]) : 3;
+	const double slowMs = 1500. / fps;
+	const int ticks = int(seconds * fps);
+	cout << "1.." << maxCams << " cameras at " << fps << " fps, camera 0 delivers after " << fixed << setprecision(1)
+		<< slowMs << " ms" << endl;
+	cout.unsetf(ios::floatfield);
+	cout << left << setw(6) << "cams" << right << setw(14) << "lock-step" << setw(14) << "threads"
+		<< setw(14) << "slowest fps" << setw(14) << "others fps" << endl;
+
+	const auto rig = [&](const size_t n){
+		vector<Ptr<TriggeredCam> > cams;
+		for (size_t i = 0; i < n; i++){
+			SimulatedTriggeredCam::Config config;
+			config.rows = 64;
+			config.cols = 64;
+			config.bayer = BAYER_NONE;
+			config.latencyMs = i == 0 ? slowMs : 5;
+			config.jitterMs = .2;
+			cams.push_back(new SimulatedTriggeredCam(uint32_t(i), config));
+		}
+		return cams;
+	};
+	bool ok = true;
+	double previous = 0;
+	for (size_t n = 1; n <= maxCams; n *= 2){
+		// trigger all, read all, wait out the rest of the period
+		double lockstep;
+		{
+			vector<Ptr<TriggeredCam> > cams = rig(n);
+			const chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+			const int frames = max(1, ticks / 4);
+			for (int i = 0; i < frames; i++){
+				const chrono::steady_clock::time_point due = t0 + chrono::microseconds(int64_t(i * 1e6 / fps));
+				this_thread::sleep_until(due);
+				for (size_t c = 0; c < n; c++){
+					cams[c]->trigger();
+				}
+				for (size_t c = 0; c < n; c++){
+					cams[c]->read();
+				}
+			}
+			lockstep = frames * n / chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		}
+
+		vector<Ptr<TriggeredCam> > cams = rig(n);
+		AcquisitionEngine engine(cams, fps, ticks);
+		cams.clear();
+		const chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+		engine.start([](const TriggeredFrame&){});
+		while (!engine.done()){
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+		engine.stop();
+		const double s = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		const vector<AcquisitionEngine::CamStats> cs = engine.stats();
+		double total = 0, others = n > 1 ? fps : 0;
+		for (size_t i = 0; i < cs.size(); i++){
+			total += cs[i].read / s;
+			others = i > 0 ? min(others, cs[i].read / s) : others;
+		}
+		cout << left << setw(6) << n << right << fixed << setprecision(1) << setw(14) << lockstep << setw(14) << total
+			<< setw(14) << cs[0].read / s << setw(14) << others << endl;
+		cout.unsetf(ios::floatfield);
+		// the slow camera makes every other tick, everyone else every one
+		ok = ok && total > previous && (n == 1 || (others >= fps * .95 && total > lockstep))
+			&& total >= ((n - 1) * fps + fps / 2) * .9;
+		previous = total;
+	}
+	cout << "  throughput " << (ok ? "scaled with the cameras, not capped by the slowest one"
+		: "DID NOT SCALE") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+trigger to read() latency of a camera polled every pollMs like the old retry
+loop around GetFrame, against one whose read() blocks until the frame lands.
+both see the same simulated latencies, any difference is waiting overhead.
+a read whose frame comes after its deadline has to give up on time
+*/
+int bench_read(int argc, char **argv){
+	const int frames = argc > 0 ? atoi(argv[0]) : 200;
+	const double latencyMs = argc > 1 ? atof(argv[1]) : 5;
+	const double pollMs = argc > 2 ? atof(argv[2]) : 1;
+	cout << frames << " reads, " << latencyMs << " ms frame latency" << endl;
+
+	vector<double> latencies[2];
+	for (int blocking = 0; blocking < 2; blocking++){
+		SimulatedTriggeredCam::Config config;
+		config.rows = 64;
+		config.cols = 64;
+		config.bayer = BAYER_NONE;
+		config.latencyMs = latencyMs;
+		config.jitterMs = latencyMs / 10;
+		config.pollMs = blocking ? 0 : pollMs;
+		SimulatedTriggeredCam cam(0, config);
+		for (int i = 0; i < frames; i++){
+			const int64_t t0 = TriggeredFrame::now();
+			cam.trigger();
+			cam.read();
+			latencies[blocking].push_back((TriggeredFrame::now() - t0) / 1e6);
+		}
+	}
+	// the same serial draws the same latencies, so reads pair up
+	vector<double> overhead;
+	for (int i = 0; i < frames; i++){
+		overhead.push_back(latencies[0][i] - latencies[1][i]);
+	}
+	for (int blocking = 0; blocking < 2; blocking++){
+		vector<double>& l = latencies[blocking];
+		double mean = 0, var = 0;
+		for (size_t i = 0; i < l.size(); i++){
+			mean += l[i] / l.size();
+		}
+		for (size_t i = 0; i < l.size(); i++){
+			var += (l[i] - mean) * (l[i] - mean) / l.size();
+		}
+		cout << (blocking ? "  blocking " : "  polled   ") << fixed << setprecision(3)
+			<< "p50 " << percentile(l, 50) << " ms p99 " << percentile(l, 99) << " ms max " << l.back()
+			<< " ms stddev " << sqrt(var) << " ms" << endl;
+	}
+	const double overheadP50 = percentile(overhead, 50);
+	cout << "  polling costs p50 " << overheadP50 << " ms p99 " << percentile(overhead, 99)
+		<< " ms max " << overhead.back() << " ms per read" << endl;
+	bool ok = overheadP50 > 0;
+
+	SimulatedTriggeredCam::Config config;
+	config.rows = 64;
+	config.cols = 64;
+	config.bayer = BAYER_NONE;
+	config.latencyMs = 50;
+	SimulatedTriggeredCam cam(0, config);
+	const int64_t t0 = TriggeredFrame::now();
+	bool timedOut = false;
+	try{
+		cam.trigger();
+		cam.read(chrono::milliseconds(10));
+	}
+	catch (const TriggeredCamError&){
+		timedOut = true;
+	}
+	const double waited = (TriggeredFrame::now() - t0) / 1e6;
+	cout << "  50 ms frame, 10 ms deadline: " << (timedOut ? "gave up" : "RETURNED") << " after " << waited << " ms" << endl;
+	ok = ok && timedOut && waited < 20;
+	cout << "  blocking reads " << (ok ? "returned sooner and gave up on time" : "DID NOT BEAT POLLING") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+rig files: a broken one has to be rejected with every problem listed at once,
+a valid one with simulated cameras is captured from while its fps is edited,
+and the new rate has to be picked up without restarting capture
+*/
+int bench_rig(int argc, char **argv){
+	const double fps0 = argc > 0 ? atof(argv[0]) : 10;
+	const double fps1 = argc > 1 ? atof(argv[1]) : 30;
+	const double seconds = argc > 2 ? atof(argv[2]) : 2;
+	const path dir = path("bench") / "rig";
+	remove_all(dir);
+	create_directories(dir);
+
+	bool ok = true;
+	writeText(dir / "broken.json",
+		"{ \"fps\": -1, \"sycn\": {}, \"io\": { \"backend\": \"tape\" },\n"
+		"  \"cameras\": [ { \"type\": \"xc\", \"serial\": 5003, \"roi\": { \"width\": \"wide\" } },\n"
+		"                 { \"type\": \"pg\", \"serial\": 5003, \"shutterMs\": 0 } ] }\n");
+	try{
+		loadRig((dir / "broken.json").string());
+		cout << "  broken rig ACCEPTED" << endl;
+		ok = false;
+	}
+	catch (const runtime_error& e){
+		const string what = e.what();
+		const size_t lines = size_t(count(what.begin(), what.end(), '\n'));
+		cout << "  broken rig rejected with " << lines << " problems:" << endl << what << endl;
+		ok = ok && lines == 6;
+	}
+
+	const string cams =
+		"  \"cameras\": [ { \"type\": \"sim\", \"serial\": 1, \"raw\": false, \"roi\": { \"width\": 64, \"height\": 64 } },\n"
+		"                 { \"type\": \"sim\", \"serial\": 2, \"raw\": false, \"roi\": { \"width\": 64, \"height\": 64 } } ] }\n";
+	const path rigPath = dir / "rig.json";
+	writeText(rigPath, "{ \"fps\": " + std::to_string(fps0) + ", \"window\": \"\",\n" + cams);
+	const RigConfig rig = loadRig(rigPath.string());
+	RigWatcher watcher(rigPath.string());
+	vector<Ptr<TriggeredCam> > opened;
+	for (size_t i = 0; i < rig.cams.size(); i++){
+		opened.push_back(camOpener(rig.cams[i])());
+	}
+	double rates[2];
+	{
+		Pipeline pipeline(opened, dir.string(), rig.pipeline);
+		opened.clear();
+		pipeline.start(0);
+		for (int phase = 0; phase < 2; phase++){
+			const uint64_t n0 = pipeline.frames();
+			const chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+			this_thread::sleep_for(chrono::microseconds(int64_t(seconds * 1e6)));
+			rates[phase] = (pipeline.frames() - n0) / double(rig.cams.size())
+				/ chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+			if (phase == 0){
+				// a structural edit alongside the rate, reported and left alone
+				writeText(rigPath, "{ \"fps\": " + std::to_string(fps1) + ", \"window\": \"\", \"framecount\": 100,\n" + cams);
+				double fps = 0;
+				if (watcher.poll(fps, cout)){
+					pipeline.setFps(fps);
+				}
+				ok = ok && fps == fps1;
+			}
+		}
+		pipeline.stop();
+	}
+	cout << "  " << fixed << setprecision(1) << rates[0] << " fps before the edit, " << rates[1] << " fps after" << endl;
+	ok = ok && fabs(rates[0] - fps0) < fps0 * .1 && fabs(rates[1] - fps1) < fps1 * .1;
+	remove_all(dir);
+	cout << "  rig file " << (ok ? "validated up front and reloaded its fps live" : "FAILED") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+achievable frame rate of a camera on a shared GigE link against its roi,
+binning and decimation. the simulated link moves linkMBps, so what is
+transferred caps the rate. decimation only happens on the host, it shrinks
+what is written but not what is sent
+*/
+int bench_roi(int argc, char **argv){
+	const double seconds = argc > 0 ? atof(argv[0]) : 1;
+	const double linkMBps = argc > 1 ? atof(argv[1]) : 100;
+	const double exposureMs = argc > 2 ? atof(argv[2]) : 5;
+	struct CamType{
+		const char *name;
+		int rows, cols, type, maxBinning;
+		BayerPattern bayer;
+	};
+	const CamType types[] = {
+		{ "PG 1280x960 RGGB", 960, 1280, CV_8UC1, 4, BAYER_RGGB },
+		{ "XC 640x512 16 bit", 512, 640, CV_16UC1, 1, BAYER_NONE },
+	};
+	struct Mode{
+		const char *name;
+		int divide, binning, decimation;
+	};
+	const Mode modes[] = {
+		{ "full", 1, 1, 1 },
+		{ "roi 1/2", 2, 1, 1 },
+		{ "roi 1/4", 4, 1, 1 },
+		{ "binning 2", 1, 2, 1 },
+		{ "binning 4", 1, 4, 1 },
+		{ "decimation 2", 1, 1, 2 },
+	};
+	cout << linkMBps << " MB/s link, " << exposureMs << " ms exposure" << endl;
+
+	bool ok = true;
+	for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++){
+		cout << types[t].name << endl << "  " << left << setw(14) << "mode" << right << setw(12) << "frame"
+			<< setw(10) << "fps" << setw(12) << "sent MB/s" << setw(12) << "kept MB/s" << endl;
+		double fullFps = 0;
+		for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++){
+			if (modes[m].binning > types[t].maxBinning){
+				continue;
+			}
+			SimulatedTriggeredCam::Config config;
+			config.rows = types[t].rows / modes[m].divide;
+			config.cols = types[t].cols / modes[m].divide;
+			config.type = types[t].type;
+			config.bayer = types[t].bayer;
+			config.latencyMs = exposureMs;
+			config.jitterMs = exposureMs / 50;
+			config.binning = modes[m].binning;
+			config.decimation = modes[m].decimation;
+			config.linkMBps = linkMBps;
+			vector<Ptr<TriggeredCam> > cams(1, Ptr<TriggeredCam>(new SimulatedTriggeredCam(0, config)));
+			cams[0]->trigger();
+			const Mat sample = cams[0]->read();
+			const double sent = double(config.rows / config.binning) * (config.cols / config.binning)
+				* CV_ELEM_SIZE(config.type);
+			const double kept = double(sample.total() * sample.elemSize());
+
+			// asks for far more than the link allows, every skipped tick is a frame it couldn't take
+			AcquisitionEngine engine(cams, 1000, int(seconds * 1000));
+			cams.clear();
+			const chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+			engine.start([](const TriggeredFrame&){});
+			while (!engine.done()){
+				this_thread::sleep_for(chrono::milliseconds(10));
+			}
+			engine.stop();
+			const double s = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+			const double fps = engine.stats()[0].read / s;
+			fullFps = m == 0 ? fps : fullFps;
+			stringstream geometry;
+			geometry << sample.cols << "x" << sample.rows;
+			cout << "  " << left << setw(14) << modes[m].name << right << setw(12) << geometry.str() << fixed
+				<< setprecision(1) << setw(10) << fps << setw(12) << sent * fps / 1e6 << setw(12) << kept * fps / 1e6 << endl;
+			cout.unsetf(ios::floatfield);
+			if (modes[m].decimation > 1){
+				// same transfer, same rate
+				ok = ok && fabs(fps - fullFps) < fullFps * .15;
+			}
+			else if (m > 0){
+				ok = ok && fps > fullFps * 1.2;
+			}
+		}
+	}
+	cout << "  smaller transfers " << (ok ? "raised the frame rate" : "DID NOT RAISE THE FRAME RATE") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+packet calibration of thermal cameras triggered together on one simulated
+GigE uplink. the sweep has to settle on a setting that streams every camera
+without loss, and on one that moves as much data as any stable setting did
+rather than the slowest safe one. the result has to survive the trip through
+the calibration file into a rig
+*/
+int bench_calibrate(int argc, char **argv){
+	const size_t n = argc > 0 ? size_t(atoi(argv[0])) : 4;
+	const double fps = argc > 1 ? atof(argv[1]) : 30;
+	const double seconds = argc > 2 ? atof(argv[2]) : 0.5;
+	const path dir = path("bench") / "calibrate";
+	remove_all(dir);
+	create_directories(dir);
+	cout << n << " XC 640x512 16 bit cameras at " << fps << " fps on a 118 MB/s uplink" << endl;
+
+	shared_ptr<SimulatedLink> link = make_shared<SimulatedLink>();
+	vector<CamSpec> cams;
+	for (size_t i = 0; i < n; i++){
+		CamSpec cam;
+		cam.type = CAM_SIM;
+		cam.serial = uint32_t(i + 1);
+		cam.raw = false;
+		cam.broadcast = false;
+		cam.settings = CamSettings(640, 512);
+		cams.push_back(cam);
+	}
+	const OpenerFactory opener = [=](const CamSpec& cam) -> CamOpener {
+		SimulatedTriggeredCam::Config config;
+		config.rows = cam.settings.height;
+		config.cols = cam.settings.width;
+		config.type = CV_16UC1;
+		config.bayer = BAYER_NONE;
+		config.latencyMs = 2;
+		config.jitterMs = .2;
+		config.link = link;
+		config.packetSize = cam.settings.packetSize > 0 ? cam.settings.packetSize : config.packetSize;
+		config.packetDelay = cam.settings.packetDelay;
+		const uint32_t s = cam.serial;
+		return [=]{ return new SimulatedTriggeredCam(s, config); };
+	};
+	CalibrationConfig config;
+	config.fps = fps;
+	config.seconds = seconds;
+	const CalibrationResult result = calibrate(cams, config, cout, opener);
+
+	bool ok = result.verified.stable(config.maxLoss) && result.settings.size() == n;
+	double bestMBps = 0, slowestMBps = 0;
+	const CalibrationTrial *fallback = NULL;
+	for (size_t t = 0; t < result.trials.size(); t++){
+		const CalibrationTrial& trial = result.trials[t];
+		if (trial.stable(config.maxLoss)){
+			bestMBps = max(bestMBps, trial.MBps());
+			slowestMBps = slowestMBps == 0 ? trial.MBps() : min(slowestMBps, trial.MBps());
+		}
+		if (trial.packetSize == 9000 && trial.packetDelay == 1000){
+			fallback = &trial;
+		}
+	}
+	ok = ok && result.verified.MBps() >= bestMBps * .97 && result.verified.MBps() > slowestMBps * 1.2;
+	cout << "  " << fixed << setprecision(1) << result.verified.MBps() << " MB/s calibrated, best stable trial "
+		<< bestMBps << " MB/s, slowest " << slowestMBps << " MB/s" << endl;
+	if (fallback){
+		cout << "  packet 9000 delay 1000, the old setting: " << fallback->MBps() << " MB/s"
+			<< (fallback->stable(config.maxLoss) ? "" : ", loses frames") << endl;
+		ok = ok && (!fallback->stable(config.maxLoss) || result.verified.MBps() >= fallback->MBps() * .97);
+	}
+	cout.unsetf(ios::floatfield);
+
+	// the calibration beside a rig overrides its packet settings
+	saveCalibration((dir / "calibration.json").string(), result.settings);
+	writeText(dir / "rig.json", "{ \"cameras\": [ { \"type\": \"sim\", \"serial\": 1, \"packetDelay\": 7 } ] }\n");
+	const RigConfig rig = loadRig((dir / "rig.json").string());
+	ok = ok && rig.cams[0].settings.packetSize == result.settings[0].packetSize
+		&& rig.cams[0].settings.packetDelay == result.settings[0].packetDelay;
+	remove_all(dir);
+	cout << "  calibration " << (ok ? "picked a stable setting that uses the link and the rig applies it"
+		: "FAILED") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+trigger timing at fps: the old GUI loop pacing, a relative waitKey sleep in
+whole milliseconds after every frame, against the engine's absolute deadlines
+waited for by sleeping only, and by sleeping then spinning. the loop drifts
+off the requested rate, the deadlines must not, and spinning must fire closer
+to them than sleeping alone. tails and misses are only reported, on a loaded
+or single core host they are the scheduler's and not ours
+*/
+int bench_trigger(int argc, char **argv){
+	const size_t n = argc > 0 ? size_t(atoi(argv[0])) : 4;
+	const double fps = argc > 1 ? atof(argv[1]) : 30;
+	const double seconds = argc > 2 ? atof(argv[2]) : 3;
+	const bool realtime = argc > 3 && atoi(argv[3]) != 0;
+	const int ticks = int(seconds * fps);
+	const double latencyMs = 2;
+	cout << n << " cameras at " << fps << " fps, " << ticks << " triggers" << (realtime ? ", real-time priority" : "") << endl;
+
+	// old loop, trigger and read, then waitKey(fps, elapsed)
+	{
+		const chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+		for (int i = 0; i < ticks; i++){
+			const chrono::steady_clock::time_point frame = chrono::steady_clock::now();
+			this_thread::sleep_for(chrono::microseconds(int64_t(latencyMs * 1e3)));
+			const double elapsed = chrono::duration<double>(chrono::steady_clock::now() - frame).count();
+			this_thread::sleep_for(chrono::milliseconds(int(round(max(1., 1000. * (1. / fps - elapsed))))));
+		}
+		const double s = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		cout << "  " << left << setw(14) << "waitKey loop" << right << fixed << setprecision(2) << ticks / s
+			<< " fps, drift " << (s - ticks / fps) * 1e3 / seconds << " ms/s" << endl;
+		cout.unsetf(ios::floatfield);
+	}
+
+	cout << "  " << left << setw(14) << "deadlines" << right << setw(8) << "fps" << setw(10) << "mean us"
+		<< setw(8) << "p50" << setw(8) << "p99" << setw(8) << "max" << setw(8) << "missed" << "  histogram us";
+	for (int b = 0; b < TriggerScheduler::BINS - 1; b++){
+		cout << " " << int(TriggerScheduler::BIN_US[b]);
+	}
+	cout << " more" << endl;
+	bool ok = true;
+	double p50[2];
+	for (int spin = 0; spin < 2; spin++){
+		vector<Ptr<TriggeredCam> > cams;
+		for (size_t i = 0; i < n; i++){
+			SimulatedTriggeredCam::Config config;
+			config.rows = 64;
+			config.cols = 64;
+			config.bayer = BAYER_NONE;
+			config.latencyMs = latencyMs;
+			config.jitterMs = .2;
+			cams.push_back(new SimulatedTriggeredCam(uint32_t(i), config));
+		}
+		TriggerConfig trigger;
+		trigger.spinUs = spin ? 2000 : 0;
+		trigger.realtime = realtime;
+		AcquisitionEngine engine(cams, fps, ticks, 4, vector<CamOpener>(), SupervisorConfig(), trigger);
+		cams.clear();
+		vector<int64_t> first(n, 0), last(n, 0);
+		mutex mtx;
+		engine.start([&](const TriggeredFrame& f){
+			lock_guard<mutex> lock(mtx);
+			first[f.serial] = first[f.serial] ? first[f.serial] : f.stamps[STAMP_TRIGGER];
+			last[f.serial] = f.stamps[STAMP_TRIGGER];
+		});
+		while (!engine.done()){
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+		engine.stop();
+
+		// pooled over the cameras
+		TriggerScheduler::Stats all = engine.stats()[0].timing;
+		all.meanUs *= all.fired;
+		for (size_t i = 1; i < n; i++){
+			const TriggerScheduler::Stats t = engine.stats()[i].timing;
+			all.fired += t.fired;
+			all.missed += t.missed;
+			all.meanUs += t.meanUs * t.fired;
+			all.maxUs = max(all.maxUs, t.maxUs);
+			for (int b = 0; b < TriggerScheduler::BINS; b++){
+				all.histogram[b] += t.histogram[b];
+			}
+		}
+		all.meanUs /= max(all.fired, uint64_t(1));
+		// rate from the first to the last trigger, off the schedule only if it drifts
+		const double rate = (ticks - 1) / ((last[0] - first[0]) / 1e9);
+		p50[spin] = all.percentileUs(.5);
+		cout << "  " << left << setw(14) << (spin ? "sleep + spin" : "sleep") << right << fixed << setprecision(2)
+			<< setw(8) << rate << setprecision(1) << setw(10) << all.meanUs << setw(8) << p50[spin]
+			<< setw(8) << all.percentileUs(.99) << setw(8) << all.maxUs << setw(8) << all.missed << " ";
+		for (int b = 0; b < TriggerScheduler::BINS; b++){
+			cout << " " << all.histogram[b];
+		}
+		cout << endl;
+		cout.unsetf(ios::floatfield);
+		ok = ok && fabs(rate - fps) < fps * 1e-3;
+	}
+	ok = ok && p50[1] < p50[0];
+	cout << "  triggers " << (ok ? "kept to their deadlines" : "MISSED THEIR DEADLINES") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,608 @@
+#include "stdafx.h"
+
+#include "Bench.h"
+#include "TriggeredCam.h"
+#include "Metrics.h"
+#include "Pipeline.h"
+#include "SimulatedCam.h"
+#include "Synchronizer.h"
+#include "Control.h"
+#include "PreviewRing.h"
+#include "Stage.h"
+#include "ThermalCodec.h"
+#include <tbb/task_arena.h>
+#include <tbb/global_control.h>
+#include <boost/timer/timer.hpp>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <csignal>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace cv;
+using namespace boost::filesystem;
+
+/*
+cost of stamping and recording one frame through every stage, recorded from
+several threads at once, with the quantiles checked against the known input
+*/
+int bench_metrics(int argc, char **argv){
+	const size_t frames = argc > 0 ? size_t(atoi(argv[0])) : 1000000;
+	const double fps = argc > 1 ? atof(argv[1]) : 16;
+	const size_t threads = 4;
+	vector<uint32_t> serials;
+	for (uint32_t c = 0; c < threads; c++){
+		serials.push_back(c);
+	}
+	Metrics metrics(serials);
+
+	// every stage takes 1..1000 us, uniformly
+	double s = double(getTickCount());
+	vector<thread> workers;
+	for (size_t t = 0; t < threads; t++){
+		workers.push_back(thread([&, t]{
+			TriggeredFrame f;
+			f.serial = uint32_t(t);
+			for (size_t i = 0; i < frames; i++){
+				const int64_t us = int64_t(i % 1000 + 1) * 1000;
+				f.stamps[STAMP_TRIGGER] = TriggeredFrame::now();
+				f.stamps[STAMP_READ] = f.stamps[STAMP_TRIGGER] + us;
+				f.stamps[STAMP_DISPATCH] = f.stamps[STAMP_READ] + us;
+				f.stamps[STAMP_WRITE] = f.stamps[STAMP_DISPATCH] + us;
+				for (int stamp = STAMP_READ; stamp < STAMP_RENDER; stamp++){
+					metrics.record(FrameStamp(stamp), f);
+				}
+				metrics.record(STAMP_RENDER, f, f.stamps[STAMP_DISPATCH] + us);
+			}
+		}));
+	}
+	for (size_t t = 0; t < workers.size(); t++){
+		workers[t].join();
+	}
+	s = (getTickCount() - s) / getTickFrequency();
+
+	const double perFrame = s / frames * 1e9 / max<size_t>(1, min<size_t>(threads, thread::hardware_concurrency()));
+	cout << threads << " threads x " << frames << " frames" << endl
+		<< "  " << fixed << setprecision(1) << perFrame << " ns per frame for " << STAMPS - 1 << " stages, "
+		<< setprecision(5) << 100. * perFrame * 1e-9 * fps << " % of a " << setprecision(1) << fps << " fps frame period" << endl;
+
+	bool ok = true;
+	for (int stamp = STAMP_READ; stamp < STAMPS; stamp++){
+		const Metrics::Summary sum = metrics.summary(FrameStamp(stamp), 0);
+		ok = ok && sum.count == frames && fabs(sum.p50 - 500e-6) < 500e-6 / 16 && fabs(sum.p99 - 990e-6) < 990e-6 / 16;
+	}
+	metrics.dump(cout);
+	cout << "  quantiles " << (ok ? "within bucket precision" : "OUT OF RANGE") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+the whole capture graph, headless, on simulated cameras: even serials look like
+the PG cameras handing out raw mosaics, odd ones like the 16 bit XC cameras
+with a replay root, the cameras of that recording are replayed instead
+*/
+int bench_graph(int argc, char **argv){
+	const size_t maxCams = argc > 0 ? size_t(atoi(argv[0])) : 16;
+	const double seconds = argc > 1 ? atof(argv[1]) : 5;
+	const double fps = argc > 2 ? atof(argv[2]) : 16;
+	const string replay = argc > 3 ? argv[3] : "";
+	const path dir = path("bench") / "graph";
+
+	vector<uint32_t> recorded;
+	if (!replay.empty()){
+		for (directory_iterator it(replay); it != directory_iterator(); it++){
+			const string stem = it->path().stem().string();
+			if (!stem.empty() && stem.find_first_not_of("0123456789") == string::npos){
+				recorded.push_back(uint32_t(stoul(stem)));
+			}
+		}
+		sort(recorded.begin(), recorded.end());
+		recorded.erase(unique(recorded.begin(), recorded.end()), recorded.end());
+		assert_throw(!recorded.empty());
+	}
+
+	cout << left << setw(6) << "cams" << right << setw(12) << "frames/s" << setw(10) << "sets" << setw(10) << "partial"
+		<< setw(10) << "expired" << setw(10) << "dropped";
+	for (int stamp = STAMP_READ; stamp < STAMPS; stamp++){
+		cout << setw(18) << string(Metrics::stageName(FrameStamp(stamp))) + " p50/p99";
+	}
+	cout << endl;
+
+	bool ok = true;
+	for (size_t n = 1; n <= maxCams; n *= 2){
+		vector<Ptr<TriggeredCam> > cams;
+		for (size_t i = 0; i < n; i++){
+			SimulatedTriggeredCam::Config config;
+			uint32_t serial = uint32_t(i);
+			if (!replay.empty()){
+				if (i >= recorded.size()){
+					break;
+				}
+				serial = recorded[i];
+				config.replay = replay;
+			}
+			else if (i % 2){
+				config.rows = 512;
+				config.cols = 640;
+				config.type = CV_16UC1;
+				config.bayer = BAYER_NONE;
+				config.latencyMs = 10;
+			}
+			cams.push_back(new SimulatedTriggeredCam(serial, config));
+		}
+		if (cams.size() < n){
+			break;
+		}
+
+		remove_all(dir);
+		create_directories(dir);
+		PipelineConfig config;
+		config.fps = fps;
+		config.window = "";
+		double s;
+		{
+			Pipeline pipeline(cams, dir.string(), config);
+			s = double(getTickCount());
+			pipeline.start(FRAME_DISPLAY | FRAME_SAVE);
+			this_thread::sleep_for(chrono::milliseconds(int64_t(seconds * 1000)));
+			pipeline.stop();
+			s = (getTickCount() - s) / getTickFrequency();
+
+			const FrameSynchronizer::Stats sync = pipeline.syncStats();
+			const vector<pair<string, StageStats> > stages = pipeline.stageStats();
+			uint64_t dropped = 0;
+			for (size_t i = 0; i < stages.size(); i++){
+				dropped += stages[i].second.dropped;
+			}
+			cout << left << setw(6) << n << right << setw(12) << fixed << setprecision(1)
+				<< pipeline.frames() / double(n) / s << setw(10) << sync.completed << setw(10) << sync.partial
+				<< setw(10) << sync.expired << setw(10) << dropped;
+			for (int stamp = STAMP_READ; stamp < STAMPS; stamp++){
+				const Metrics::Summary sum = pipeline.metrics().summary(FrameStamp(stamp));
+				stringstream ss;
+				ss << fixed << setprecision(1) << sum.p50 * 1e3 << "/" << sum.p99 * 1e3 << " ms";
+				cout << setw(18) << ss.str();
+			}
+			cout << endl;
+			ok = ok && pipeline.frames() > 0;
+		}
+		remove_all(dir);
+	}
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+capture rate of the GUI loop, every frame shown and saved while the main thread
+waits on keys between frames, against headless capture that only saves and
+takes commands from CaptureControl. commands on the control stream and a
+SIGINT have to reach the capture
+*/
+int bench_headless(int argc, char **argv){
+	const size_t n = argc > 0 ? size_t(atoi(argv[0])) : 4;
+	const double fps = argc > 1 ? atof(argv[1]) : 120;
+	const double seconds = argc > 2 ? atof(argv[2]) : 3;
+	const path dir = path("bench") / "headless";
+	cout << n << " cameras at " << fps << " fps for " << seconds << " s" << endl;
+
+	bool ok = true;
+	{
+		// read on a detached thread that may still be at the end of the stream
+		// when control goes, so it is never destroyed under it
+		static stringstream commands("display\nsave\nrewind\nfps 60\n");
+		CaptureControl control(FRAME_SAVE, &commands, &cout);
+		const chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::seconds(1);
+		double rate = 0;
+		while (chrono::steady_clock::now() < deadline && !control.fps(rate)){
+			control.wait(deadline);
+		}
+		ok = ok && control.flags() == FRAME_DISPLAY && rate == 60 && !control.quit();
+		raise(SIGINT);
+		ok = ok && !control.wait(chrono::steady_clock::now() + chrono::seconds(1));
+		cout << "  control stream and SIGINT " << (ok ? "reached the capture" : "WERE LOST") << endl;
+	}
+
+	double rates[2];
+	for (int headless = 0; headless < 2; headless++){
+		vector<Ptr<TriggeredCam> > cams;
+		for (size_t i = 0; i < n; i++){
+			SimulatedTriggeredCam::Config config;
+			config.rows = 480;
+			config.cols = 640;
+			config.latencyMs = 2;
+			config.jitterMs = .2;
+			cams.push_back(new SimulatedTriggeredCam(uint32_t(i), config));
+		}
+		remove_all(dir);
+		create_directories(dir);
+		PipelineConfig config;
+		config.fps = fps;
+		config.window = "";
+		const uint64_t flags = headless ? FRAME_SAVE : FRAME_DISPLAY | FRAME_SAVE;
+		uint64_t frames;
+		double s;
+		{
+			Pipeline pipeline(cams, dir.string(), config);
+			cams.clear();
+			const chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+			const chrono::steady_clock::time_point end = t0 + chrono::microseconds(int64_t(seconds * 1e6));
+			pipeline.start(flags);
+			if (headless){
+				CaptureControl control(flags);
+				while (chrono::steady_clock::now() < end && control.wait(end)){
+					pipeline.setFlags(control.flags());
+				}
+			}
+			else{
+				// waitKey(fps, 0.) between frames
+				while (chrono::steady_clock::now() < end){
+					this_thread::sleep_for(chrono::milliseconds(int(round(max(1., 1000. / fps)))));
+					pipeline.setFlags(flags);
+				}
+			}
+			frames = pipeline.frames();
+			s = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+			pipeline.stop();
+		}
+		rates[headless] = frames / double(n) / s;
+		cout << "  " << left << setw(10) << (headless ? "headless" : "gui") << right << fixed << setprecision(1)
+			<< setw(8) << rates[headless] << " fps" << endl;
+		cout.unsetf(ios::floatfield);
+	}
+	remove_all(dir);
+	ok = ok && rates[1] >= fps * .95 && rates[1] >= rates[0] * .98;
+	cout << "  headless capture " << (ok ? "kept the rate without a display" : "FELL BEHIND") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+capture with previews published to the shared memory ring, with no viewers
+and with viewers mapping it. every viewer polls like camcap view and copies
+out each new frame, one of them holds on to a frame as a stalled viewer would.
+the capture rate must not change, and every viewer must see frames
+*/
+int bench_preview(int argc, char **argv){
+	const size_t n = argc > 0 ? size_t(atoi(argv[0])) : 4;
+	const double fps = argc > 1 ? atof(argv[1]) : 30;
+	const double seconds = argc > 2 ? atof(argv[2]) : 3;
+	const int maxViewers = argc > 3 ? atoi(argv[3]) : 4;
+	const path dir = path("bench") / "preview";
+	const string ring = "camcap_bench_preview";
+	cout << n << " cameras at " << fps << " fps for " << seconds << " s" << endl;
+	cout << left << setw(10) << "viewers" << right << setw(10) << "fps" << setw(12) << "published"
+		<< setw(14) << "seen/viewer" << setw(8) << "torn" << endl;
+
+	bool ok = true;
+	double rates[2];
+	for (int v = 0; v < 2; v++){
+		const int viewers = v ? maxViewers : 0;
+		vector<Ptr<TriggeredCam> > cams;
+		for (size_t i = 0; i < n; i++){
+			SimulatedTriggeredCam::Config config;
+			config.rows = 512;
+			config.cols = 640;
+			config.type = CV_16UC1;
+			config.bayer = BAYER_NONE;
+			config.latencyMs = 2;
+			config.jitterMs = .2;
+			cams.push_back(new SimulatedTriggeredCam(uint32_t(i), config));
+		}
+		remove_all(dir);
+		create_directories(dir);
+		PipelineConfig config;
+		config.fps = fps;
+		config.window = "";
+		config.previewRing = ring;
+		atomic<bool> stop(false);
+		atomic<uint64_t> seen(0), torn(0);
+		vector<thread> threads;
+		uint64_t frames, published = 0;
+		double s;
+		{
+			Pipeline pipeline(cams, dir.string(), config);
+			cams.clear();
+			for (int t = 0; t < viewers; t++){
+				threads.push_back(thread([&, t]{
+					PreviewReader reader(ring);
+					vector<uint64_t> last(reader.cams(), 0);
+					Mat frame, held;
+					uint64_t heldToken = 0;
+					while (!stop){
+						for (size_t i = 0; i < reader.cams(); i++){
+							const uint64_t p = reader.published(i);
+							if (p == last[i]){
+								continue;
+							}
+							int frame_no;
+							if (t == 0 && held.empty()){
+								// stalled viewer, keeps looking at one frame for the whole run
+								reader.latest(i, held, heldToken, frame_no);
+							}
+							if (reader.copy(i, frame, frame_no)){
+								seen++;
+							}
+							last[i] = p;
+						}
+						this_thread::sleep_for(chrono::milliseconds(1));
+					}
+					if (t == 0 && !held.empty() && !reader.check(0, heldToken)){
+						torn++;
+					}
+				}));
+			}
+			const PreviewReader reader(ring);
+			const chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+			pipeline.start(FRAME_DISPLAY);
+			this_thread::sleep_for(chrono::microseconds(int64_t(seconds * 1e6)));
+			frames = pipeline.frames();
+			s = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+			// previews still in the display stages are published while it drains
+			pipeline.stop();
+			stop = true;
+			for (size_t t = 0; t < threads.size(); t++){
+				threads[t].join();
+			}
+			for (size_t i = 0; i < reader.cams(); i++){
+				published += reader.published(i);
+			}
+		}
+		rates[v] = frames / double(n) / s;
+		const double perViewer = viewers ? seen / double(viewers) : 0;
+		cout << left << setw(10) << viewers << right << fixed << setprecision(1) << setw(10) << rates[v]
+			<< setw(12) << published << setw(14) << perViewer << setw(8) << torn << endl;
+		cout.unsetf(ios::floatfield);
+		ok = ok && published > 0 && (!viewers || perViewer > published * .5);
+	}
+	remove_all(dir);
+	ok = ok && rates[1] >= rates[0] * .97;
+	cout << "  capture rate " << (ok ? "unchanged by viewers" : "CHANGED BY VIEWERS") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+CPU the display branch takes from capture: the rig's cameras saved and shown
+with every frame demosaiced and normalized for display, against the display
+branch running at its own rate. frames are skipped by frame number before any
+work, so every shown set is still complete. process CPU time is per second
+captured, the display stages get worker threads even on a single core host
+*/
+int bench_display(int argc, char **argv){
+	const double seconds = argc > 0 ? atof(argv[0]) : 3;
+	const double displayFps = argc > 1 ? atof(argv[1]) : 10;
+	const path dir = path("bench") / "display";
+	const double rates[] = { 16, 30, 60 };
+	tbb::global_control workers(tbb::global_control::max_allowed_parallelism,
+		max(4, int(thread::hardware_concurrency())));
+	tbb::task_arena arena(max(4, int(thread::hardware_concurrency())));
+	cout << "2 PG 1280x960 RGGB and 2 XC 640x512 16 bit, display at " << displayFps << " fps" << endl;
+	cout << left << setw(6) << "fps" << setw(10) << "display" << right << setw(10) << "captured" << setw(12)
+		<< "previews/s" << setw(10) << "sets/s" << setw(12) << "CPU s/s" << endl;
+
+	bool ok = true;
+	for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++){
+		double cpu[2];
+		for (int decimated = 0; decimated < 2; decimated++){
+			vector<Ptr<TriggeredCam> > cams;
+			for (size_t i = 0; i < 4; i++){
+				SimulatedTriggeredCam::Config config;
+				if (i % 2){
+					config.rows = 512;
+					config.cols = 640;
+					config.type = CV_16UC1;
+					config.bayer = BAYER_NONE;
+				}
+				config.latencyMs = 2;
+				config.jitterMs = .2;
+				cams.push_back(new SimulatedTriggeredCam(uint32_t(i), config));
+			}
+			remove_all(dir);
+			create_directories(dir);
+			PipelineConfig config;
+			config.fps = rates[r];
+			config.window = "";
+			config.displayFps = decimated ? displayFps : 0;
+			unique_ptr<Pipeline> pipeline;
+			// the graph runs in the arena it is built in
+			arena.execute([&]{ pipeline.reset(new Pipeline(cams, dir.string(), config)); });
+			cams.clear();
+			boost::timer::cpu_timer timer;
+			pipeline->start(FRAME_DISPLAY | FRAME_SAVE);
+			this_thread::sleep_for(chrono::microseconds(int64_t(seconds * 1e6)));
+			const double captured = pipeline->frames() / 4. / seconds;
+			pipeline->stop();
+			const boost::timer::cpu_times t = timer.elapsed();
+			cpu[decimated] = (t.user + t.system) / 1e9 / seconds;
+			const vector<pair<string, StageStats> > stages = pipeline->stageStats();
+			double previews = 0, sets = 0;
+			for (size_t s = 0; s < stages.size(); s++){
+				if (stages[s].first == "normalizer"){
+					previews = stages[s].second.processed / seconds;
+				}
+				if (stages[s].first == "renderer"){
+					sets = stages[s].second.processed / seconds;
+				}
+			}
+			pipeline.reset();
+			stringstream display;
+			display << (decimated ? rates[r] / max(1., round(rates[r] / displayFps)) : rates[r]) << " fps";
+			cout << left << setw(6) << rates[r] << setw(10) << display.str() << right << fixed << setprecision(1)
+				<< setw(10) << captured << setw(12) << previews << setw(10) << sets << setprecision(2)
+				<< setw(12) << cpu[decimated] << endl;
+			cout.unsetf(ios::floatfield);
+			ok = ok && captured >= rates[r] * .95;
+			if (decimated){
+				// every camera at about the display rate, in complete sets
+				ok = ok && previews <= 4 * displayFps * 1.2 && sets > 0;
+			}
+		}
+		ok = ok && cpu[1] < cpu[0];
+	}
+	remove_all(dir);
+	cout << "  display rate " << (ok ? "freed CPU without slowing capture" : "DID NOT FREE CPU") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+resident set size in MB, 0 off Linux or where /proc isn't there
+*/
+static double residentMB(){
+#if defined(__linux__)
+	std::ifstream statm("/proc/self/statm");
+	double pages = 0, resident = 0;
+	if (!(statm >> pages >> resident)){
+		return 0;
+	}
+	return resident * sysconf(_SC_PAGESIZE) / (1 << 20);
+#else
+	return 0;
+#endif
+}
+
+/*
+a stage under BLOCK fed from the body of another one, both chained in the
+graph, has to drop instead of waiting on a full queue only a graph thread can
+drain. then capture with a writer that can't keep up: thermal frames from more
+cameras than the codec encodes in real time on one core, for `seconds`. the
+writer pushes back on the pump, the camera rings drop their oldest frames, and
+resident memory has to level off once the pools and queues have filled
+*/
+int bench_soak(int argc, char **argv){
+	const double seconds = argc > 0 ? atof(argv[0]) : 30;
+	const double fps = argc > 1 ? atof(argv[1]) : 60;
+	const double warmup = 10;
+	const double slack = 16; // MB, malloc keeps some freed memory around
+	const path dir = path("bench") / "soak";
+	tbb::global_control workers(tbb::global_control::max_allowed_parallelism,
+		max(4, int(thread::hardware_concurrency())));
+	tbb::task_arena arena(max(4, int(thread::hardware_concurrency())));
+	bool ok = true;
+
+	arena.execute([&]{
+		tbb::flow::graph g;
+		BoundedStage<int> last(g, "last", StageConfig(1, 1, BLOCK), [](const int&){
+			this_thread::sleep_for(chrono::milliseconds(1));
+		});
+		BoundedStage<int> first(g, "first", StageConfig(1, 1, BLOCK), [&](const int& i){ last.put(i); });
+		atomic<bool> drained(false);
+		thread feed([&]{
+			for (int i = 0; i < 200; i++){
+				first.put(i);
+			}
+			g.wait_for_all();
+			drained = true;
+		});
+		const chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::seconds(10);
+		while (!drained && chrono::steady_clock::now() < deadline){
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+		if (!drained){
+			// a stuck graph can't be torn down
+			cout << "  BLOCK inside the graph DEADLOCKED" << endl;
+			_Exit(EXIT_FAILURE);
+		}
+		feed.join();
+		// the feeding thread waited, the body feeding the second stage didn't
+		const StageStats fed = first.stats(), st = last.stats();
+		cout << "  BLOCK outside the graph: " << fed.processed << " processed, " << fed.dropped << " dropped" << endl;
+		cout << "  BLOCK inside the graph: " << st.processed << " processed, " << st.dropped << " dropped" << endl;
+		ok = ok && fed.processed == 200 && fed.dropped == 0 && st.processed + st.dropped == 200 && st.dropped > 0;
+	});
+
+	// what one writer thread encodes per second, the codec running on one core
+	tbb::task_arena single(1);
+	SimulatedTriggeredCam::Config config;
+	config.rows = 512;
+	config.cols = 640;
+	config.type = CV_16UC1;
+	config.bayer = BAYER_NONE;
+	config.latencyMs = 1;
+	config.jitterMs = .1;
+	double encoded;
+	{
+		SimulatedTriggeredCam cam(0, config);
+		cam.trigger();
+		const Mat frame = cam.read();
+		vector<uint8_t> buf(thermalMaxEncodedSize(frame.rows, frame.cols));
+		const chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+		int n = 0;
+		single.execute([&]{
+			while (chrono::steady_clock::now() - t0 < chrono::milliseconds(500)){
+				thermalEncode(frame, &buf[0]);
+				n++;
+			}
+		});
+		encoded = n / chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	}
+	PipelineConfig pc;
+	pc.fps = fps;
+	pc.window = "";
+	pc.ioBackend = IO_STDIO;
+	pc.ioCodec = SEQ_CODEC_THERMAL;
+	// three times what the writer threads can take
+	const size_t n = size_t(min(32., max(2., ceil(3 * encoded * pc.writer.concurrency / fps))));
+	cout << n << " XC 640x512 16 bit cameras at " << fps << " fps, the writer encodes " << fixed << setprecision(0)
+		<< encoded * pc.writer.concurrency << " frames/s, " << warmup << " s warm up, then " << seconds << " s" << endl;
+	cout.unsetf(ios::floatfield);
+
+	vector<Ptr<TriggeredCam> > cams;
+	for (size_t i = 0; i < n; i++){
+		cams.push_back(new SimulatedTriggeredCam(uint32_t(i), config));
+	}
+	remove_all(dir);
+	create_directories(dir);
+	vector<double> rss;
+	uint64_t captured, written, dropped = 0;
+	StageStats writer;
+	{
+		unique_ptr<Pipeline> graph;
+		// the graph runs in the arena it is built in
+		arena.execute([&]{ graph.reset(new Pipeline(cams, dir.string(), pc)); });
+		Pipeline& pipeline = *graph;
+		cams.clear();
+		pipeline.start(FRAME_SAVE);
+		const chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+		this_thread::sleep_for(chrono::microseconds(int64_t(warmup * 1e6)));
+		cout << left << setw(8) << "s" << right << setw(12) << "RSS MB" << setw(12) << "written" << setw(12) << "depth" << endl;
+		while (chrono::steady_clock::now() - t0 < chrono::microseconds(int64_t((warmup + seconds) * 1e6))){
+			rss.push_back(residentMB());
+			const StageStats st = pipeline.stageStats()[0].second;
+			cout << left << setw(8) << fixed << setprecision(1)
+				<< chrono::duration<double>(chrono::steady_clock::now() - t0).count() << right << setw(12) << rss.back()
+				<< setw(12) << st.processed << setw(12) << st.depth << endl;
+			cout.unsetf(ios::floatfield);
+			this_thread::sleep_for(chrono::seconds(1));
+		}
+		captured = pipeline.frames();
+		pipeline.stop();
+		writer = pipeline.stageStats()[0].second;
+		written = writer.processed;
+		const vector<AcquisitionEngine::CamStats> cs = pipeline.camStats();
+		for (size_t i = 0; i < cs.size(); i++){
+			dropped += cs[i].dropped + cs[i].skipped;
+		}
+	}
+	remove_all(dir);
+
+	// pools and queues fill up over the first two thirds, the last third must not grow past them
+	const double early = *max_element(rss.begin(), rss.begin() + rss.size() * 2 / 3),
+		late = *max_element(rss.begin() + rss.size() * 2 / 3, rss.end());
+	cout << "  " << captured << " frames captured, " << written << " written, " << dropped
+		<< " dropped or skipped at the cameras, writer queue " << writer.maxDepth << " deep at most" << endl;
+	if (late > 0){
+		cout << "  resident at most " << fixed << setprecision(1) << early << " MB over the first two thirds, "
+			<< late << " MB over the last" << endl;
+		cout.unsetf(ios::floatfield);
+	}
+	else{
+		cout << "  resident size unavailable on this platform, memory not checked" << endl;
+	}
+	// the writer fell behind, the cameras gave way, and nothing grew
+	ok = ok && dropped > 0 && written > 0 && writer.maxDepth <= pc.writer.capacity && late - early < slack;
+	cout << "  slow writer " << (ok ? "degraded capture with memory flat" : "LET MEMORY GROW OR NEVER FELL BEHIND") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
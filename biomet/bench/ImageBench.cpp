@@ -0,0 +1,294 @@
+#include "stdafx.h"
+
+#include "Bench.h"
+#include "Normalize.h"
+#include "Debayer.h"
+#include "FramePool.h"
+#include "SequenceFile.h"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <tbb/task_arena.h>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <random>
+#include <cstring>
+
+using namespace std;
+using namespace cv;
+using namespace boost::filesystem;
+
+/*
+the normalizer's former resize/cvtColor/minMaxLoc/convertTo chain
+*/
+static void normalizeChain(const Mat& src, Mat& dst, const Size& size){
+	Mat ret = src.clone();
+	resize(ret.clone(), ret, size);
+	if (ret.channels() == 1){
+		cvtColor(ret.clone(), ret, CV_GRAY2RGB);
+	}
+	double minVal, maxVal, alpha, beta;
+	minMaxLoc(ret, &minVal, &maxVal);
+	alpha = 255. / (maxVal - minVal);
+	beta = -255. * minVal / (maxVal - minVal);
+	ret.clone().convertTo(ret, CV_8U, alpha, beta);
+	ret.copyTo(dst);
+}
+
+/*
+fused preview kernel against the chain it replaced, with the largest
+per-pixel difference between the two, which has to stay within 1 LSB. the
+narrow ranges are what the min/max stretch magnifies, a thermal scene spans a
+few hundred counts and a dim colour one a few dozen levels. IPP resizes 16 bit
+frames with its own rounding, so the chain runs on OpenCV's own code
+*/
+int bench_normalize(int argc, char **argv){
+	const int iterations = argc > 0 ? atoi(argv[0]) : 200;
+	const Size size(480, 360);
+	struct { const char *name; int rows, cols, type; double lo, hi; } shapes[] = {
+		{ "PG 1280x960 BGR", 960, 1280, CV_8UC3, 0, 256 },
+		{ "PG 1280x960 BGR low contrast", 960, 1280, CV_8UC3, 100, 132 },
+		{ "XC 640x512 16bit", 512, 640, CV_16UC1, 0, 4096 },
+		{ "XC 640x512 16bit 7000..7200", 512, 640, CV_16UC1, 7000, 7200 }
+	};
+
+#if CV_MAJOR_VERSION >= 3
+	const bool useIPP = ipp::useIPP();
+	ipp::setUseIPP(false);
+#endif
+	bool ok = true;
+	for (size_t k = 0; k < sizeof(shapes) / sizeof(shapes[0]); k++){
+		Mat frame(shapes[k].rows, shapes[k].cols, shapes[k].type);
+		RNG rng(0x1234 + k);
+		rng.fill(frame, RNG::UNIFORM, Scalar::all(shapes[k].lo), Scalar::all(shapes[k].hi));
+		Mat chain, fused;
+		cout << shapes[k].name << ", " << iterations << " frames" << endl;
+
+		double s = double(getTickCount());
+		for (int i = 0; i < iterations; i++){
+			normalizeChain(frame, chain, size);
+		}
+		s = (getTickCount() - s) / getTickFrequency();
+		cout << "  chain  " << fixed << setprecision(3) << 1000. * s / iterations << " ms/frame" << endl;
+
+		s = double(getTickCount());
+		for (int i = 0; i < iterations; i++){
+			normalizePreview(frame, fused, size);
+		}
+		s = (getTickCount() - s) / getTickFrequency();
+		cout << "  fused  " << fixed << setprecision(3) << 1000. * s / iterations << " ms/frame" << endl;
+		const double diff = norm(chain, fused, NORM_INF);
+		cout << "  max abs difference " << diff << endl;
+		ok = ok && chain.size() == fused.size() && chain.type() == fused.type() && diff <= 1;
+	}
+#if CV_MAJOR_VERSION >= 3
+	ipp::setUseIPP(useIPP);
+#endif
+	cout << "  fused kernel " << (ok ? "within 1 LSB of the chain" : "DIFFERS FROM THE CHAIN") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+PG read path converting every frame to BGR on the grab thread against handing
+out the raw mosaic, then the deferred demosaic at 1, 2 and all threads
+the eager conversion is modelled by demosaic() on one thread, which is what
+Image::Convert costs the grab thread. the raw mosaic has to be quicker to hand
+out and well under half the bytes to write, and the deferred demosaic has to give
+the same image at any number of threads
+*/
+int bench_bayer(int argc, char **argv){
+	const size_t frames = argc > 0 ? size_t(atoi(argv[0])) : 200;
+	const path dir = path("bench") / "bayer";
+	Mat raw(960, 1280, CV_8UC1);
+	for (int y = 0; y < raw.rows; y++){
+		uchar *p = raw.ptr<uchar>(y);
+		for (int x = 0; x < raw.cols; x++){
+			p[x] = uchar(((y & 1) ? 40 : 200) + ((x & 1) ? 30 : 0) + (x + y) / 64);
+		}
+	}
+	cout << "PG 1280x960 RGGB, " << frames << " frames" << endl;
+
+	remove_all(dir);
+	create_directories(dir);
+	double p50[2];
+	uint64_t perFrame[2];
+	for (int eager = 1; eager >= 0; eager--){
+		FramePool pool;
+		vector<double> latencies;
+		uint64_t bytes;
+		{
+			SequenceWriter seq((dir / (eager ? "eager.seq" : "raw.seq")).string(), 0, raw.rows, raw.cols,
+				eager ? CV_8UC3 : CV_8UC1, 8 << 20, IO_STDIO, SEQ_CODEC_RAW, eager ? BAYER_NONE : BAYER_RGGB);
+			tbb::task_arena grab(1);
+			for (size_t i = 0; i < frames; i++){
+				Mat m;
+				const double s = double(getTickCount());
+				if (eager){
+					m = pool.acquire(raw.rows, raw.cols, CV_8UC3);
+					grab.execute([&]{ demosaic(raw, BAYER_RGGB, m); });
+				}
+				else{
+					m = pool.acquire(raw.rows, raw.cols, CV_8UC1);
+					raw.copyTo(m);
+				}
+				latencies.push_back((getTickCount() - s) / getTickFrequency() * 1e6);
+				seq.append(int64_t(i), int64_t(i), m);
+			}
+			seq.close();
+			bytes = seq.bytesWritten();
+		}
+		cout << (eager ? "  eager BGR" : "  raw mosaic") << ": read p50 " << fixed << setprecision(3)
+			<< percentile(latencies, 50) / 1000. << " ms, p99 " << percentile(latencies, 99) / 1000.
+			<< " ms, " << bytes / frames / 1024 << " KiB written per frame" << endl;
+		p50[eager] = percentile(latencies, 50);
+		perFrame[eager] = bytes / frames;
+	}
+	remove_all(dir);
+	bool ok = p50[0] < p50[1] && perFrame[0] * 2 < perFrame[1];
+
+	const int threads[] = { 1, 2, tbb::task_arena::automatic };
+	Mat reference;
+	for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++){
+		tbb::task_arena arena(threads[t]);
+		Mat bgr;
+		double s = double(getTickCount());
+		arena.execute([&]{
+			for (size_t i = 0; i < frames; i++){
+				demosaic(raw, BAYER_RGGB, bgr);
+			}
+		});
+		s = (getTickCount() - s) / getTickFrequency();
+		stringstream name;
+		name << "  deferred demosaic x" << arena.max_concurrency();
+		report(name.str(), frames, uint64_t(frames) * raw.total(), s);
+		if (reference.empty()){
+			reference = bgr.clone();
+		}
+		ok = ok && bgr.size() == reference.size() && bgr.type() == reference.type()
+			&& norm(bgr, reference, NORM_INF) == 0;
+	}
+	cout << "  raw mosaic " << (ok ? "handed out sooner, smaller, and demosaiced the same at any thread count"
+		: "FAILED") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+FramePool on its own: a warm pool allocates nothing, holding more buffers than
+its capacity is counted as overflows, cameras alternating between two
+geometries keep both, a new geometry takes over free buffers of the old one,
+and frames released on another thread are never handed out while still held
+*/
+int bench_pool(int argc, char **argv){
+	const size_t frames = argc > 0 ? size_t(atoi(argv[0])) : 20000;
+	const size_t cap = 8;
+	cout << left << setw(34) << "case" << right << setw(14) << "allocations" << setw(12) << "overflows" << endl;
+	bool ok = true;
+	const auto row = [&](const char *name, const FramePool& pool, const bool pass){
+		cout << left << setw(34) << name << right << setw(14) << pool.allocations() << setw(12) << pool.overflows()
+			<< (pass ? "" : "  FAILED") << endl;
+		ok = ok && pass;
+	};
+
+	{
+		FramePool pool(cap);
+		for (size_t i = 0; i < frames; i++){
+			pool.acquire(960, 1280, CV_8UC1);
+		}
+		row("recycled one at a time", pool, pool.allocations() == 1 && pool.overflows() == 0);
+	}
+	{
+		FramePool pool(cap);
+		vector<Mat> held;
+		for (size_t i = 0; i <= cap; i++){
+			held.push_back(pool.acquire(960, 1280, CV_8UC1));
+		}
+		held.clear();
+		for (size_t i = 0; i < frames; i++){
+			pool.acquire(960, 1280, CV_8UC1);
+		}
+		row("held one past capacity", pool, pool.allocations() == cap + 1 && pool.overflows() == 1);
+	}
+	{
+		FramePool pool(cap);
+		for (size_t i = 0; i < frames; i++){
+			const Mat full = pool.acquire(960, 1280, CV_8UC1);
+			const Mat decimated = pool.acquire(480, 640, CV_8UC1);
+		}
+		row("two geometries in turn", pool, pool.allocations() == 2 && pool.overflows() == 0);
+	}
+	{
+		FramePool pool(cap);
+		vector<Mat> held;
+		for (size_t i = 0; i < cap; i++){
+			held.push_back(pool.acquire(960, 1280, CV_8UC1));
+		}
+		held.resize(cap / 2);
+		for (size_t i = 0; i < cap / 2; i++){
+			held.push_back(pool.acquire(512, 640, CV_16UC1));
+		}
+		held.clear();
+		for (size_t i = 0; i < frames; i++){
+			pool.acquire(512, 640, CV_16UC1);
+		}
+		row("geometry changed, old ones held", pool, pool.allocations() == cap + cap / 2 && pool.overflows() == 0);
+	}
+	{
+		// the camera's read() on this thread, the graph dropping frames on another
+		FramePool pool(cap);
+		deque<Mat> queue;
+		mutex mtx;
+		condition_variable changed;
+		bool done = false;
+		size_t torn = 0;
+		thread consumer([&]{
+			mt19937 gen(7);
+			uniform_int_distribution<int> hold(0, 200);
+			while (true){
+				Mat m;
+				{
+					unique_lock<mutex> lock(mtx);
+					changed.wait(lock, [&]{ return done || !queue.empty(); });
+					if (queue.empty()){
+						break;
+					}
+					m = queue.front();
+					queue.pop_front();
+				}
+				changed.notify_all();
+				const uchar first = m.ptr<uchar>(0)[0];
+				this_thread::sleep_for(chrono::microseconds(hold(gen)));
+				for (int y = 0; y < m.rows; y++){
+					const uchar *p = m.ptr<uchar>(y);
+					for (int x = 0; x < m.cols; x++){
+						torn += p[x] != first ? 1 : 0;
+					}
+				}
+			}
+		});
+		for (size_t i = 0; i < frames / 10; i++){
+			Mat m = pool.acquire(120, 160, CV_8UC1);
+			for (int y = 0; y < m.rows; y++){
+				memset(m.ptr<uchar>(y), int(i & 0xff), m.cols);
+			}
+			unique_lock<mutex> lock(mtx);
+			changed.wait(lock, [&]{ return queue.size() < cap - 2; });
+			queue.push_back(m);
+			m.release();
+			changed.notify_all();
+		}
+		{
+			lock_guard<mutex> lock(mtx);
+			done = true;
+		}
+		changed.notify_all();
+		consumer.join();
+		row("released on another thread", pool, torn == 0 && pool.allocations() <= cap && pool.overflows() == 0);
+		if (torn > 0){
+			cout << "  " << torn << " pixels of held frames overwritten" << endl;
+		}
+	}
+	cout << "  frame pool " << (ok ? "recycled without allocating or handing out held buffers" : "FAILED") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
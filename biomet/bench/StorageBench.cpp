@@ -0,0 +1,259 @@
+#include "stdafx.h"
+
+#include "Bench.h"
+#include "TriggeredCam.h"
+#include "SequenceFile.h"
+#include "IoWriter.h"
+#include "ThermalCodec.h"
+#include <opencv2/highgui/highgui.hpp>
+#include <tbb/task_arena.h>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <random>
+
+using namespace std;
+using namespace cv;
+using namespace boost::filesystem;
+
+/*
+true when the sequence at p holds frames copies of frame
+*/
+static bool readsBack(const path& p, const Mat& frame, const size_t frames){
+	SequenceReader reader(p.string());
+	bool same = reader.size() == frames;
+	for (size_t i = 0; same && i < frames; i++){
+		const Mat m = reader.frame(i);
+		same = m.rows == frame.rows && m.cols == frame.cols && m.type() == frame.type();
+		for (int y = 0; same && y < frame.rows; y++){
+			same = memcmp(m.ptr(y), frame.ptr(y), frame.cols * frame.elemSize()) == 0;
+		}
+	}
+	return same;
+}
+
+/*
+one PGM/PPM per frame through imwrite against an append-only sequence file,
+which has to read back frame for frame
+*/
+int bench_sequence(int argc, char **argv){
+	const size_t frames = argc > 0 ? size_t(atoi(argv[0])) : 200;
+	const path dir = path("bench") / "sequence";
+	struct { const char *name; int rows, cols, type; } shapes[] = {
+		{ "PG 1280x960 BGR", 960, 1280, CV_8UC3 },
+		{ "XC 640x512 16bit", 512, 640, CV_16UC1 }
+	};
+
+	bool ok = true;
+	for (size_t k = 0; k < sizeof(shapes) / sizeof(shapes[0]); k++){
+		const Mat frame = syntheticFrame(shapes[k].rows, shapes[k].cols, shapes[k].type, int(k));
+		const uint64_t bytes = uint64_t(frames) * frame.total() * frame.elemSize();
+		cout << shapes[k].name << ", " << frames << " frames" << endl;
+
+		remove_all(dir);
+		create_directories(dir);
+		double s = double(getTickCount());
+		for (size_t i = 0; i < frames; i++){
+			stringstream ss;
+			ss << setw(9) << setfill('0') << i << (frame.channels() == 1 ? ".pgm" : ".ppm");
+			imwrite((dir / ss.str()).string(), frame);
+		}
+		s = (getTickCount() - s) / getTickFrequency();
+		report("  imwrite", frames, bytes, s);
+
+		remove_all(dir);
+		create_directories(dir);
+		s = double(getTickCount());
+		{
+			SequenceWriter seq((dir / "frames.seq").string(), 0, frame.rows, frame.cols, frame.type());
+			for (size_t i = 0; i < frames; i++){
+				seq.append(int64_t(i), int64_t(i), frame, int64_t(i) * 1000 + 1, int64_t(i) * 1000 + 2);
+			}
+			seq.close();
+		}
+		s = (getTickCount() - s) / getTickFrequency();
+		report("  sequence", frames, bytes, s);
+		ok = ok && readsBack(dir / "frames.seq", frame, frames);
+		// and so do the stamps only the records keep
+		SequenceReader reader((dir / "frames.seq").string());
+		for (size_t i = 0; ok && i < reader.size(); i++){
+			const SequenceRecord r = reader.record(i);
+			ok = r.captured == int64_t(i) * 1000 + 1 && r.deviceStamp == int64_t(i) * 1000 + 2;
+		}
+	}
+	remove_all(dir);
+	cout << "  sequence " << (ok ? "read back intact" : "DID NOT READ BACK") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+replays synthetic frames of a 4 camera rig through the dedicated writer for
+every I/O backend, reporting sustained bandwidth and per-frame latency. every
+backend has to write every frame, intact, and frames that can't be written
+have to be counted as failed
+fps 0 replays as fast as the writer accepts frames
+*/
+int bench_io(int argc, char **argv){
+	const size_t frames = argc > 0 ? size_t(atoi(argv[0])) : 200;
+	const double fps = argc > 1 ? atof(argv[1]) : 0;
+	const path dir = argc > 2 ? path(argv[2]) : path("bench") / "io";
+	const size_t cams = 4;
+	const IoBackendType backends[] = { IO_STDIO, IO_DIRECT, IO_URING };
+	struct { const char *name; int rows, cols, type; } shapes[] = {
+		{ "PG 1280x960 BGR", 960, 1280, CV_8UC3 },
+		{ "XC 640x512 16bit", 512, 640, CV_16UC1 }
+	};
+
+	bool ok = true;
+	for (size_t k = 0; k < sizeof(shapes) / sizeof(shapes[0]); k++){
+		const Mat frame = syntheticFrame(shapes[k].rows, shapes[k].cols, shapes[k].type, int(k));
+		cout << shapes[k].name << ", " << cams << " cameras x " << frames << " frames" << endl;
+		for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++){
+			remove_all(dir);
+			create_directories(dir);
+			double s = double(getTickCount());
+			vector<double> latencies;
+			uint64_t bytes;
+			{
+				IoWriter writer(dir.string(), StageConfig(2, 64, BLOCK), backends[b]);
+				const double start = double(getTickCount());
+				for (size_t i = 0; i < frames; i++){
+					if (fps > 0){
+						const double due = start + i / fps * getTickFrequency();
+						while (double(getTickCount()) < due){
+							camsleep(1);
+						}
+					}
+					for (size_t c = 0; c < cams; c++){
+						TriggeredFrame f;
+						f.flags = 0;
+						f.frame_no = int(i);
+						f.serial = uint32_t(c);
+						f.frame = frame;
+						writer.put(f);
+					}
+				}
+				writer.close();
+				latencies = writer.latencies();
+				bytes = writer.bytesWritten();
+			}
+			s = (getTickCount() - s) / getTickFrequency();
+			report(string("  ") + ioBackendName(backends[b]), frames * cams, bytes, s);
+			cout << "    latency p50 " << percentile(latencies, 50) / 1000. << " ms, p99 "
+				<< percentile(latencies, 99) / 1000. << " ms" << endl;
+			ok = ok && bytes == uint64_t(frames) * cams * seqAlign(sizeof(SequenceRecord) + frame.total() * frame.elemSize());
+			for (size_t c = 0; c < cams; c++){
+				ok = ok && readsBack(dir / (std::to_string(c) + ".seq"), frame, frames);
+			}
+		}
+	}
+	remove_all(dir);
+	cout << "  every backend " << (ok ? "wrote every frame intact" : "LOST OR CORRUPTED FRAMES") << endl;
+
+	// frames that can't be written are counted as failed, not as saved
+	StageStats lost;
+	{
+		IoWriter writer((dir / "missing").string(), StageConfig(1, 8, BLOCK));
+		TriggeredFrame f;
+		f.frame = syntheticFrame(64, 64, CV_8UC1, 0);
+		for (int i = 0; i < 10; i++){
+			f.frame_no = i;
+			writer.put(f);
+		}
+		writer.close();
+		lost = writer.stats();
+		ok = ok && lost.processed == 0 && lost.failed == 10 && writer.bytesWritten() == 0;
+	}
+	cout << "  unwritable directory: " << lost.processed << " processed, " << lost.failed << " failed" << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+thermal-like 16 bit frame, a smooth background and a few warm blobs that drift
+from frame to frame, with sensor noise
+*/
+static Mat thermalFrame(const int rows, const int cols, const int seed){
+	mt19937 gen(seed);
+	normal_distribution<double> noise(0, 3);
+	Mat m(rows, cols, CV_16UC1);
+	for (int y = 0; y < rows; y++){
+		ushort *p = m.ptr<ushort>(y);
+		for (int x = 0; x < cols; x++){
+			double v = 7000 + 300. * y / rows + 150. * x / cols;
+			for (int b = 0; b < 3; b++){
+				const double cx = cols * (.25 + .25 * b) + 4 * seed, cy = rows * (.3 + .2 * b);
+				const double r2 = ((x - cx) * (x - cx) + (y - cy) * (y - cy)) / (2. * 40 * 40);
+				v += 1500 * exp(-r2);
+			}
+			p[x] = saturate_cast<ushort>(v + noise(gen));
+		}
+	}
+	return m;
+}
+
+/*
+lossless thermal codec on synthetic or recorded CV_16UC1 frames at 1, 2 and all
+threads, checking every frame round-trips bit exact, packs at least 2x, and
+that one thread encodes as fast as the rig's thermal cameras capture
+*/
+int bench_codec(int argc, char **argv){
+	const size_t frames = argc > 0 ? size_t(atoi(argv[0])) : 200;
+	vector<Mat> input;
+	if (argc > 1){
+		SequenceReader reader(argv[1]);
+		assert_throw(reader.header().type == CV_16UC1);
+		for (size_t i = 0; i < reader.size() && i < frames; i++){
+			input.push_back(reader.frame(i).clone());
+		}
+		cout << argv[1] << ", " << input.size() << " frames" << endl;
+	}
+	else{
+		for (size_t i = 0; i < min<size_t>(frames, 16); i++){
+			input.push_back(thermalFrame(512, 640, int(i)));
+		}
+		cout << "XC 640x512 16bit synthetic, " << frames << " frames" << endl;
+	}
+	assert_throw(!input.empty());
+	const size_t n = max(frames, input.size());
+
+	vector<uint8_t> encoded(thermalMaxEncodedSize(input[0].rows, input[0].cols));
+	const int threads[] = { 1, 2, tbb::task_arena::automatic };
+	const int rigFps = 16 * 2; // 2 XC cameras at 16 fps
+	bool exact = true, packs = true, keepsUp = true;
+	for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++){
+		tbb::task_arena arena(threads[t]);
+		uint64_t raw = 0, packed = 0;
+		double enc = 0, dec = 0;
+		arena.execute([&]{
+			Mat decoded;
+			for (size_t i = 0; i < n; i++){
+				const Mat& frame = input[i % input.size()];
+				double s = double(getTickCount());
+				const size_t bytes = thermalEncode(frame, &encoded[0]);
+				enc += double(getTickCount()) - s;
+				s = double(getTickCount());
+				thermalDecode(&encoded[0], bytes, decoded);
+				dec += double(getTickCount()) - s;
+				raw += frame.total() * frame.elemSize();
+				packed += bytes;
+				for (int y = 0; y < frame.rows; y++){
+					exact = exact && memcmp(frame.ptr(y), decoded.ptr(y), frame.cols * frame.elemSize()) == 0;
+				}
+			}
+		});
+		stringstream name;
+		name << "  " << arena.max_concurrency() << " thread(s) ratio " << fixed << setprecision(2) << double(raw) / packed;
+		cout << name.str() << endl;
+		report("    encode", n, raw, enc / getTickFrequency());
+		report("    decode", n, raw, dec / getTickFrequency());
+		packs = packs && raw >= 2 * packed;
+		if (threads[t] == 1){
+			keepsUp = n / (enc / getTickFrequency()) >= rigFps;
+		}
+	}
+	cout << "  round trip " << (exact ? "bit exact" : "MISMATCH") << ", "
+		<< (packs ? "at least 2x" : "LESS THAN 2x") << ", one thread "
+		<< (keepsUp ? "keeps up with " : "FALLS BEHIND ") << rigFps << " frames/s" << endl;
+	return exact && packs && keepsUp ? EXIT_SUCCESS : EXIT_FAILURE;
+}
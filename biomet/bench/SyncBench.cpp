@@ -0,0 +1,225 @@
+#include "stdafx.h"
+
+#include "Bench.h"
+#include "TriggeredCam.h"
+#include "SimulatedCam.h"
+#include "Acquisition.h"
+#include "Synchronizer.h"
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <random>
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+using namespace boost::filesystem;
+
+/*
+matching by frame_no against matching by captured time on simulated cameras
+that now and then hand out the previous buffer again, a set is mixed when its
+frames were captured more than half a period apart
+*/
+int bench_sync(int argc, char **argv){
+	const size_t n = argc > 0 ? size_t(atoi(argv[0])) : 4;
+	const double fps = argc > 1 ? atof(argv[1]) : 30;
+	const double seconds = argc > 2 ? atof(argv[2]) : 5;
+	const double stale = argc > 3 ? atof(argv[3]) : .05;
+	const int64_t halfPeriod = int64_t(.5e9 / fps);
+	cout << n << " cameras at " << fps << " fps, " << stale * 100 << " % stale buffers" << endl;
+
+	bool ok = true;
+	for (int mode = SYNC_FRAME_NO; mode <= SYNC_TIMESTAMP; mode++){
+		vector<Ptr<TriggeredCam> > cams;
+		vector<uint32_t> serials;
+		for (size_t i = 0; i < n; i++){
+			SimulatedTriggeredCam::Config config;
+			config.rows = 64;
+			config.cols = 64;
+			config.bayer = BAYER_NONE;
+			config.latencyMs = 5;
+			config.jitterMs = 1;
+			config.staleRate = stale;
+			cams.push_back(new SimulatedTriggeredCam(uint32_t(i), config));
+			serials.push_back(uint32_t(i));
+		}
+		FrameSynchronizer synchronizer(serials, 8, chrono::milliseconds(500), SyncMode(mode),
+			chrono::microseconds(int64_t(250e3 / fps)));
+		atomic<uint64_t> mixed(0);
+		AcquisitionEngine engine(cams, fps, int(seconds * fps));
+		engine.start([&](const TriggeredFrame& f){
+			synchronizer.put(f, [&](const FrameSetPtr& set){
+				const FrameSet& fs = *set;
+				int64_t lo = fs[0].captured, hi = fs[0].captured;
+				for (size_t i = 1; i < fs.size(); i++){
+					lo = min(lo, fs[i].captured);
+					hi = max(hi, fs[i].captured);
+				}
+				if (hi - lo > halfPeriod){
+					mixed++;
+				}
+			});
+		});
+		while (!engine.done()){
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+		engine.stop();
+
+		const FrameSynchronizer::Stats st = synchronizer.stats();
+		cout << (mode == SYNC_TIMESTAMP ? "  by timestamp" : "  by frame_no ") << "  completed " << st.completed
+			<< " expired " << st.expired << " late " << st.late << " mixed " << mixed << endl;
+		const vector<FrameSynchronizer::PairSkew> skew = synchronizer.skew();
+		for (size_t i = 0; i < skew.size() && i < 3; i++){
+			cout << "    skew " << skew[i].first << "-" << skew[i].second << " mean " << fixed << setprecision(3)
+				<< skew[i].mean * 1e3 << " ms max " << skew[i].maxAbs * 1e3 << " ms" << endl;
+		}
+		ok = ok && st.completed > 0 && (mode == SYNC_FRAME_NO || mixed == 0);
+	}
+	cout << "  timestamp matching " << (ok ? "kept every set to one trigger" : "MIXED TRIGGERS") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+one flaky camera among healthy ones, with incomplete sets discarded against
+handed out with placeholders. the healthy cameras are checked to never miss
+a set once partial sets are on
+*/
+int bench_partial(int argc, char **argv){
+	const size_t n = argc > 0 ? size_t(atoi(argv[0])) : 4;
+	const double fps = argc > 1 ? atof(argv[1]) : 30;
+	const double seconds = argc > 2 ? atof(argv[2]) : 5;
+	const double failures = argc > 3 ? atof(argv[3]) : .2;
+	const int ticks = int(seconds * fps);
+	cout << n << " cameras at " << fps << " fps, camera 0 fails " << failures * 100 << " % of its reads" << endl;
+
+	bool ok = true;
+	for (int partial = 0; partial < 2; partial++){
+		vector<Ptr<TriggeredCam> > cams;
+		vector<uint32_t> serials;
+		for (size_t i = 0; i < n; i++){
+			SimulatedTriggeredCam::Config config;
+			config.rows = 64;
+			config.cols = 64;
+			config.bayer = BAYER_NONE;
+			config.latencyMs = 5;
+			config.jitterMs = 1;
+			config.failureRate = i == 0 ? failures : 0;
+			cams.push_back(new SimulatedTriggeredCam(uint32_t(i), config));
+			serials.push_back(uint32_t(i));
+		}
+		FrameSynchronizer synchronizer(serials, 8, chrono::milliseconds(500), SYNC_TIMESTAMP,
+			chrono::microseconds(int64_t(250e3 / fps)), partial != 0);
+		atomic<uint64_t> sets(0), placeholders(0);
+		AcquisitionEngine engine(cams, fps, ticks);
+		engine.start([&](const TriggeredFrame& f){
+			synchronizer.put(f, [&](const FrameSetPtr& set){
+				const FrameSet& fs = *set;
+				sets++;
+				for (size_t i = 0; i < fs.size(); i++){
+					placeholders += fs[i].frame.empty() ? 1 : 0;
+				}
+			});
+		});
+		while (!engine.done()){
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+		engine.stop();
+
+		const FrameSynchronizer::Stats st = synchronizer.stats();
+		const vector<uint64_t> misses = synchronizer.misses();
+		const vector<AcquisitionEngine::CamStats> cs = engine.stats();
+		cout << (partial ? "  partial sets  " : "  complete only ") << sets << " of " << ticks << " sets shown, "
+			<< placeholders << " placeholders, " << st.expired << " discarded" << endl << "    misses";
+		uint64_t healthyMisses = 0;
+		for (size_t i = 0; i < misses.size(); i++){
+			cout << " " << serials[i] << ":" << misses[i] << "/" << cs[i].failed;
+			healthyMisses += i > 0 ? misses[i] : 0;
+		}
+		cout << " (sets missed/reads failed)" << endl;
+		if (partial){
+			ok = healthyMisses == 0 && sets >= uint64_t(ticks) * 95 / 100;
+		}
+	}
+	cout << "  degraded mode " << (ok ? "kept every healthy camera in every set" : "LOST HEALTHY FRAMES") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+cost per frame of the synchronizer on its own for 1..cameras, frames of each
+trigger arriving in a shuffled camera order with a little capture jitter. for
+rigs of 8 to 16 cameras the cost per frame has to stay flat, within a factor
+of the cheapest smaller rig's, and the sets have to come from the pool
+*/
+int bench_synccost(int argc, char **argv){
+	const size_t maxCams = argc > 0 ? size_t(atoi(argv[0])) : 16;
+	const size_t sets = argc > 1 ? size_t(atoi(argv[1])) : 100000;
+	const double fps = 30;
+	const int64_t period = int64_t(1e9 / fps);
+	const double flat = 1.5;
+	cout << sets << " sets per rig" << endl;
+	cout << left << setw(6) << "cams" << right << setw(16) << "by frame_no ns" << setw(16) << "by time ns"
+		<< setw(12) << "completed" << setw(14) << "allocations" << endl;
+
+	bool ok = true;
+	double smallest[2] = { 0, 0 };
+	for (size_t n = 1; n <= maxCams; n *= 2){
+		vector<uint32_t> serials;
+		for (size_t i = 0; i < n; i++){
+			serials.push_back(uint32_t(100 + i));
+		}
+		// the same arrival order and jitter for both modes
+		mt19937 gen(static_cast<uint32_t>(n));
+		uniform_int_distribution<int64_t> jitter(0, period / 100);
+		vector<TriggeredFrame> frames(n * 64);
+		vector<size_t> order(n);
+		for (size_t i = 0; i < n; i++){
+			order[i] = i;
+		}
+		for (size_t t = 0; t < 64; t++){
+			shuffle(order.begin(), order.end(), gen);
+			for (size_t i = 0; i < n; i++){
+				TriggeredFrame& f = frames[t * n + i];
+				f.serial = serials[order[i]];
+				f.captured = int64_t(t + 1) * period + jitter(gen);
+				f.frame = Mat(1, 1, CV_8UC1);
+			}
+		}
+
+		double ns[2];
+		uint64_t completed = 0, allocations = 0;
+		for (int mode = SYNC_FRAME_NO; mode <= SYNC_TIMESTAMP; mode++){
+			FrameSynchronizer synchronizer(serials, 8, chrono::seconds(10), SyncMode(mode),
+				chrono::nanoseconds(period / 4));
+			uint64_t out = 0;
+			const FrameSynchronizer::Sink sink = [&](const FrameSetPtr&){ out++; };
+			const chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+			for (size_t s = 0; s < sets; s++){
+				const int64_t shift = int64_t(s / 64) * 64 * period;
+				for (size_t i = 0; i < n; i++){
+					TriggeredFrame& f = frames[(s % 64) * n + i];
+					f.frame_no = int(s);
+					f.captured += shift;
+					synchronizer.put(f, sink);
+					f.captured -= shift;
+				}
+			}
+			ns[mode] = chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count() / (sets * n);
+			const FrameSynchronizer::Stats st = synchronizer.stats();
+			ok = ok && out == sets && st.completed == sets && st.expired == 0 && st.late == 0
+				&& synchronizer.setPool().overflows() == 0;
+			completed += st.completed;
+			allocations += synchronizer.setPool().allocations();
+		}
+		cout << left << setw(6) << n << right << fixed << setprecision(1) << setw(16) << ns[0] << setw(16) << ns[1]
+			<< setw(12) << completed << setw(14) << allocations << endl;
+		cout.unsetf(ios::floatfield);
+		for (int mode = 0; mode < 2; mode++){
+			if (n >= 8){
+				ok = ok && ns[mode] < smallest[mode] * flat;
+			}
+			smallest[mode] = n == 1 ? ns[mode] : min(smallest[mode], ns[mode]);
+		}
+	}
+	cout << "  cost per frame " << (ok ? "flat in the number of cameras" : "GREW WITH THE CAMERAS") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
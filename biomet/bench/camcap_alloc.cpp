@@ -0,0 +1,206 @@
+#include "stdafx.h"
+
+/*
+camcap_alloc, heap allocations per frame of the warm capture graph, as an
+executable of its own because it replaces the process's allocator entry points
+to count them. built like camcap_bench from Bench.cpp, this file and every
+biomet source but camcap.cpp. nothing it counts with is linked into camcap
+*/
+
+#include "Bench.h"
+#include "TriggeredCam.h"
+#include "Pipeline.h"
+#include "SimulatedCam.h"
+#include "Synchronizer.h"
+#include <tbb/task_arena.h>
+#include <tbb/global_control.h>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <exception>
+
+#if defined(__GLIBC__)
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace std;
+using namespace cv;
+using namespace boost::filesystem;
+
+static atomic<uint64_t> heapCalls(0);
+static atomic<uint64_t> mappings(0);
+
+#if defined(__GLIBC__)
+/*
+every call into the C allocator is counted, a relaxed increment before handing
+over to glibc's own. operator new, cv::fastMalloc, TBB's cache aligned
+allocator without tbbmalloc and glibc's own internal allocations all come
+through here. TBB's scalable allocator hands out blocks from pools it maps
+itself, so what is counted for it is every anonymous mapping, which is how
+those pools grow
+*/
+extern "C" {
+void *__libc_malloc(size_t bytes);
+void *__libc_calloc(size_t n, size_t bytes);
+void *__libc_realloc(void *p, size_t bytes);
+void *__libc_memalign(size_t alignment, size_t bytes);
+void *__libc_valloc(size_t bytes);
+void *__libc_pvalloc(size_t bytes);
+
+void *malloc(size_t bytes){
+	heapCalls.fetch_add(1, memory_order_relaxed);
+	return __libc_malloc(bytes);
+}
+
+void *calloc(size_t n, size_t bytes){
+	heapCalls.fetch_add(1, memory_order_relaxed);
+	return __libc_calloc(n, bytes);
+}
+
+void *realloc(void *p, size_t bytes){
+	heapCalls.fetch_add(1, memory_order_relaxed);
+	return __libc_realloc(p, bytes);
+}
+
+void *memalign(size_t alignment, size_t bytes){
+	heapCalls.fetch_add(1, memory_order_relaxed);
+	return __libc_memalign(alignment, bytes);
+}
+
+void *aligned_alloc(size_t alignment, size_t bytes){
+	heapCalls.fetch_add(1, memory_order_relaxed);
+	return __libc_memalign(alignment, bytes);
+}
+
+void *valloc(size_t bytes){
+	heapCalls.fetch_add(1, memory_order_relaxed);
+	return __libc_valloc(bytes);
+}
+
+void *pvalloc(size_t bytes){
+	heapCalls.fetch_add(1, memory_order_relaxed);
+	return __libc_pvalloc(bytes);
+}
+
+int posix_memalign(void **p, size_t alignment, size_t bytes){
+	heapCalls.fetch_add(1, memory_order_relaxed);
+	if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0){
+		return EINVAL;
+	}
+	*p = __libc_memalign(alignment, bytes);
+	return *p == NULL ? ENOMEM : 0;
+}
+
+// glibc's own mmap is private, the system call is what it makes
+void *mmap(void *addr, size_t bytes, int prot, int flags, int fd, off_t offset){
+	if (flags & MAP_ANONYMOUS){
+		mappings.fetch_add(1, memory_order_relaxed);
+	}
+	return (void *)syscall(SYS_mmap, addr, bytes, prot, flags, fd, offset);
+}
+}
+static const bool COUNTING = true;
+#else
+static const bool COUNTING = false;
+#endif
+
+/*
+heap allocations per frame of the whole graph once it is warm, with the rig's
+cameras saved, shown at every frame and published to a preview ring. the C
+allocator calls and anonymous mappings are counted, and so are the buffers the
+frame, preview and set pools allocate
+*/
+static int bench_alloc(int argc, char **argv){
+	const double seconds = argc > 0 ? atof(argv[0]) : 3;
+	const double fps = argc > 1 ? atof(argv[1]) : 30;
+	const double warmup = 2;
+	const path dir = path("bench") / "alloc";
+	tbb::global_control workers(tbb::global_control::max_allowed_parallelism,
+		max(4, int(thread::hardware_concurrency())));
+	tbb::task_arena arena(max(4, int(thread::hardware_concurrency())));
+	cout << "2 PG 1280x960 RGGB and 2 XC 640x512 16 bit at " << fps << " fps, " << warmup << " s warm up, then "
+		<< seconds << " s counted" << endl;
+	if (!COUNTING){
+		cout << "  heap calls are only counted on glibc, pool buffers only" << endl;
+	}
+
+	vector<Ptr<TriggeredCam> > cams;
+	for (size_t i = 0; i < 4; i++){
+		SimulatedTriggeredCam::Config config;
+		if (i % 2){
+			config.rows = 512;
+			config.cols = 640;
+			config.type = CV_16UC1;
+			config.bayer = BAYER_NONE;
+		}
+		config.latencyMs = 2;
+		config.jitterMs = .2;
+		cams.push_back(new SimulatedTriggeredCam(uint32_t(i), config));
+	}
+	// the cameras' own pools count too
+	const auto buffers = [&](const Pipeline& pipeline){
+		uint64_t n = pipeline.allocations();
+		for (size_t i = 0; i < cams.size(); i++){
+			n += cams[i]->framePool().allocations();
+		}
+		return n;
+	};
+	remove_all(dir);
+	create_directories(dir);
+	PipelineConfig config;
+	config.fps = fps;
+	config.window = "";
+	config.displayFps = 0;
+	config.previewRing = "camcap_bench_alloc";
+	unique_ptr<Pipeline> pipeline;
+	arena.execute([&]{ pipeline.reset(new Pipeline(cams, dir.string(), config)); });
+	pipeline->start(FRAME_DISPLAY | FRAME_SAVE);
+	this_thread::sleep_for(chrono::microseconds(int64_t(warmup * 1e6)));
+	const uint64_t frames0 = pipeline->frames(), heap0 = heapCalls, mapped0 = mappings, buffers0 = buffers(*pipeline);
+	this_thread::sleep_for(chrono::microseconds(int64_t(seconds * 1e6)));
+	const uint64_t frames = pipeline->frames() - frames0, heap = heapCalls - heap0, mapped = mappings - mapped0,
+		pooled = buffers(*pipeline) - buffers0;
+	pipeline->stop();
+	const vector<pair<string, StageStats> > stages = pipeline->stageStats();
+	const FrameSynchronizer::Stats sync = pipeline->syncStats();
+	pipeline.reset();
+	remove_all(dir);
+
+	cout << left << setw(10) << "frames" << right << setw(12) << "heap calls" << setw(12) << "per frame"
+		<< setw(10) << "mmaps" << setw(16) << "pool buffers" << setw(10) << "sets" << endl;
+	cout << left << setw(10) << frames << right << setw(12) << heap << setw(12) << fixed << setprecision(3)
+		<< heap / max(1., double(frames)) << setw(10) << mapped << setw(16) << pooled
+		<< setw(10) << sync.completed + sync.partial << endl;
+	cout.unsetf(ios::floatfield);
+	uint64_t dropped = 0;
+	for (size_t i = 0; i < stages.size(); i++){
+		cout << "  " << left << setw(12) << stages[i].first << right << " processed " << stages[i].second.processed
+			<< " dropped " << stages[i].second.dropped << endl;
+		dropped += stages[i].second.dropped;
+	}
+	if (dropped > 0){
+		// queues at capacity hold more frames than the pools were sized for
+		cout << "  stages dropped frames, the host can't keep up at " << fps << " fps" << endl;
+	}
+	const bool ok = frames >= uint64_t(4 * fps * seconds * .95) && heap == 0 && mapped == 0 && pooled == 0;
+	cout << "  steady state " << (ok ? "captured without heap allocations" : "ALLOCATED PER FRAME") << endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+camcap_alloc [seconds] [fps]
+*/
+int _tmain(int argc, _TCHAR* argv[]) {
+	try{
+		return bench_alloc(argc - 1, argv + 1);
+	}
+	catch (const exception& e){
+		cerr << e.what() << endl;
+		return EXIT_FAILURE;
+	}
+}
@@ -0,0 +1,117 @@
+#include "stdafx.h"
+
+/*
+camcap_bench, the offline benchmarks as an executable of their own, apart from
+the camcap binary that goes on the rig. it is built from the sources in this
+directory but camcap_alloc.cpp with biomet on the include path, and links
+every biomet source but camcap.cpp. nothing here needs a camera, the rig is
+simulated
+*/
+
+#include "Bench.h"
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <exception>
+
+using namespace std;
+
+struct Bench{
+	const char *name;
+	int (*run)(int argc, char **argv);
+	const char *usage;
+};
+
+static const Bench benches[] = {
+	{ "sequence", bench_sequence, "sequence [frames]\n"
+		"    imwrite per frame vs sequence file, the sequence has to read back intact" },
+	{ "io", bench_io, "io [frames] [fps] [dir]\n"
+		"    dedicated writer bandwidth and latency per I/O backend" },
+	{ "normalize", bench_normalize, "normalize [frames]\n"
+		"    fused preview kernel vs the resize/convert chain, within 1 LSB of it" },
+	{ "codec", bench_codec, "codec [frames] [seq]\n"
+		"    lossless thermal codec ratio, MB/s and round trip" },
+	{ "bayer", bench_bayer, "bayer [frames]\n"
+		"    eager BGR conversion vs raw mosaic and deferred demosaic" },
+	{ "pool", bench_pool, "pool [frames]\n"
+		"    frame buffers recycled, overflowing, across geometries and threads" },
+	{ "metrics", bench_metrics, "metrics [frames] [fps]\n"
+		"    per frame cost of the stage latency instrumentation" },
+	{ "graph", bench_graph, "graph [cameras] [seconds] [fps] [replay root]\n"
+		"    headless capture graph on 1..cameras simulated cameras" },
+	{ "startup", bench_startup, "startup [cameras] [ms]\n"
+		"    sequential vs parallel camera bring-up" },
+	{ "discovery", bench_discovery, "discovery [cameras] [ms]\n"
+		"    per camera bus scans vs the shared device registry" },
+	{ "sync", bench_sync, "sync [cameras] [fps] [seconds] [stale rate]\n"
+		"    sets by frame_no vs by timestamp with stale buffers" },
+	{ "partial", bench_partial, "partial [cameras] [fps] [seconds] [failure rate]\n"
+		"    one flaky camera, sets discarded vs shown with placeholders" },
+	{ "synccost", bench_synccost, "synccost [cameras] [sets]\n"
+		"    synchronizer cost per frame for 1..cameras, flat from 8 to 16" },
+	{ "reconnect", bench_reconnect, "reconnect [cameras] [fps] [seconds] [outage s]\n"
+		"    one camera unplugged, reopened with backoff by its supervisor" },
+	{ "scaling", bench_scaling, "scaling [cameras] [fps] [seconds]\n"
+		"    total frame rate of 1..cameras with one slow camera, lock-step vs grab threads" },
+	{ "read", bench_read, "read [frames] [latency ms] [poll ms]\n"
+		"    polled vs blocking frame waits, and read deadlines" },
+	{ "rig", bench_rig, "rig [fps] [new fps] [seconds]\n"
+		"    rig file validation and a live fps reload" },
+	{ "roi", bench_roi, "roi [seconds] [link MB/s] [exposure ms]\n"
+		"    achievable fps against roi, binning and decimation per camera type" },
+	{ "calibrate", bench_calibrate, "calibrate [cameras] [fps] [trial s]\n"
+		"    packet size and delay sweep on a shared simulated uplink" },
+	{ "headless", bench_headless, "headless [cameras] [fps] [seconds]\n"
+		"    GUI loop vs headless capture under stdin and signal control" },
+	{ "trigger", bench_trigger, "trigger [cameras] [fps] [seconds] [realtime]\n"
+		"    trigger lateness, sleeping vs sleep then spin, and waitKey drift" },
+	{ "preview", bench_preview, "preview [cameras] [fps] [seconds] [viewers]\n"
+		"    capture rate with and without viewers on the shared memory preview ring" },
+	{ "display", bench_display, "display [seconds] [display fps]\n"
+		"    CPU of the display branch at every frame vs its own rate, at 16, 30 and 60 fps" },
+	{ "soak", bench_soak, "soak [seconds] [fps]\n"
+		"    BLOCK inside the graph, then a writer that can't keep up with memory staying flat" },
+};
+static const size_t BENCHES = sizeof(benches) / sizeof(benches[0]);
+
+/*
+a bench that throws has failed like one whose check doesn't hold
+*/
+static int run(const Bench& bench, int argc, char **argv){
+	try{
+		return bench.run(argc, argv);
+	}
+	catch (const exception& e){
+		cerr << bench.name << ": " << e.what() << endl;
+		return EXIT_FAILURE;
+	}
+}
+
+/*
+camcap_bench <name> [args] runs one benchmark
+camcap_bench all runs every one with its defaults and lists those that failed
+*/
+int _tmain(int argc, _TCHAR* argv[]) {
+	const string name = argc > 1 ? argv[1] : "";
+	if (name == "all"){
+		string failed;
+		for (size_t i = 0; i < BENCHES; i++){
+			cout << "== " << benches[i].name << endl;
+			if (run(benches[i], 0, argv + argc) != EXIT_SUCCESS){
+				failed += string(" ") + benches[i].name;
+			}
+		}
+		cout << (failed.empty() ? "all benchmarks passed" : "FAILED:" + failed) << endl;
+		return failed.empty() ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	for (size_t i = 0; i < BENCHES; i++){
+		if (name == benches[i].name){
+			return run(benches[i], argc - 2, argv + 2);
+		}
+	}
+	cerr << "usage: camcap_bench <name> [args] | all" << endl;
+	for (size_t i = 0; i < BENCHES; i++){
+		cerr << "  " << benches[i].usage << endl;
+	}
+	return EXIT_FAILURE;
+}